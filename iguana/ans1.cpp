@@ -12,18 +12,37 @@
 //  See the License for the specific language governing permissions and
 //  limitations under the License.
 
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include "ans1.h"
 #include "utils.h"
 
 namespace iguana::ans1 {
-    void (*encoder::g_Compress)(context& ctx) = &encoder::compress_portable;
-    const internal::initializer<encoder> encoder::g_Initializer;
+    namespace {
+        // The names of the interleaved coders, for the error messages
+        template <
+            std::size_t N_STATES
+        > constexpr const char* ans1_encoder_name = (N_STATES == 1) ? "ans1 encoder" : (N_STATES == 4) ? "ans4 encoder" : "ans8 encoder";
+
+        template <
+            std::size_t N_STATES
+        > constexpr const char* ans1_decoder_name = (N_STATES == 1) ? "ans1 decoder" : (N_STATES == 4) ? "ans4 decoder" : "ans8 decoder";
+    }
+
+    template <std::size_t N_STATES> const cpu::kernel_table<typename interleaved_encoder<N_STATES>::kernel_function> interleaved_encoder<N_STATES>::g_Kernels = { &interleaved_encoder<N_STATES>::compress_portable };
+    template <std::size_t N_STATES> cpu::kernel_dispatch<typename interleaved_encoder<N_STATES>::kernel_function> interleaved_encoder<N_STATES>::g_Compress(ans1_encoder_name<N_STATES>, g_Kernels);
+    template <std::size_t N_STATES> const internal::initializer<interleaved_encoder<N_STATES>> interleaved_encoder<N_STATES>::g_Initializer;
 
-    void (*decoder::g_Decompress)(context& ctx) = &decoder::decompress_portable;
-    const internal::initializer<decoder> decoder::g_Initializer;
+    template <std::size_t N_STATES> const cpu::kernel_table<typename interleaved_decoder<N_STATES>::kernel_function> interleaved_decoder<N_STATES>::g_Kernels = { &interleaved_decoder<N_STATES>::decompress_portable };
+    template <std::size_t N_STATES> cpu::kernel_dispatch<typename interleaved_decoder<N_STATES>::kernel_function> interleaved_decoder<N_STATES>::g_Decompress(ans1_decoder_name<N_STATES>, g_Kernels);
+    template <std::size_t N_STATES> const internal::initializer<interleaved_decoder<N_STATES>> interleaved_decoder<N_STATES>::g_Initializer;
 }
 
-iguana::ans1::encoder::~encoder() noexcept {}
+template <
+    std::size_t N_STATES
+> iguana::ans1::interleaved_encoder<N_STATES>::~interleaved_encoder() noexcept {}
 
 // This experimental arithmetic compression/decompression functionality is based on
 // the work of Fabian Giesen, available here: https://github.com/rygorous/ryg_rans
@@ -33,45 +52,79 @@ iguana::ans1::encoder::~encoder() noexcept {}
 // For theoretical background, please refer to Jaroslaw Duda's seminal paper on rANS:
 // https://arxiv.org/pdf/1311.2540.pdf
 
-void iguana::ans1::encoder::encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len) {
-    context ctx { .dst = dst, .stats = stats, .src = src, .src_len = src_len };
+template <
+    std::size_t N_STATES
+> void iguana::ans1::interleaved_encoder<N_STATES>::encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len) {
+    typename statistics::encoding_table tab;
+    stats.build_encoding_table(tab);
+    context ctx { .dst = dst, .stats = stats, .tab = tab, .src = src, .src_len = src_len };
     g_Compress(ctx);
 
     if (ctx.ec != error_code::ok) {
         exception::from_error(ctx.ec);
     }
     dst.reserve_more(statistics::dense_table_max_length);
+    stats.serialize(dst);
 }
 
-void iguana::ans1::encoder::compress_portable(context& ctx) {
-    std::uint32_t state = statistics::word_L;
-    
-	for(auto *p = ctx.src + ctx.src_len; p > ctx.src;) {
-        const std::uint8_t v = *--p;
-        const auto q = ctx.stats[v];
-        const auto freq = q & statistics::frequency_mask;
-        const auto start = (q >> statistics::frequency_bits) & statistics::cumulative_frequency_mask;
+template <
+    std::size_t N_STATES
+> void iguana::ans1::interleaved_encoder<N_STATES>::compress_portable(context& ctx) {
+    // The i-th symbol goes to the state i % N_STATES
+    std::uint32_t states[N_STATES];
+    std::fill_n(states, N_STATES, statistics::word_L);
+
+    const auto put = [&](std::uint32_t& state, std::uint8_t v) {
+        const auto& sym = ctx.tab[v];
         // renormalize
         auto x = state;
-        if (x >= ((statistics::word_L >> statistics::word_M_bits) << statistics::word_L_bits) * freq) {
+        if (x >= sym.x_max) {
             ctx.dst.append_little_endian(static_cast<std::uint16_t>(x));
             x >>= statistics::word_L_bits;
         }
         // x = C(s,x)
-        state = ((x / freq) << statistics::word_M_bits) + (x % freq) + start;
-	}
+        state = sym.encode(x);
+    };
+
+    // The symbols are coded backwards, starting with the incomplete round at the end
+    const auto round_end = ctx.src_len - (ctx.src_len % N_STATES);
+    for(auto i = ctx.src_len; i != round_end;) {
+        --i;
+        put(states[i - round_end], ctx.src[i]);
+    }
+
+    for(auto i = round_end; i != 0;) {
+        i -= N_STATES;
+        for(auto j = N_STATES; j != 0;) {
+            --j;
+            put(states[j], ctx.src[i + j]);
+        }
+    }
 
-    ctx.dst.append_little_endian(state);
-	ctx.ec = error_code::ok;    
+    // The state of the first symbol comes last
+    for(auto j = N_STATES; j != 0;) {
+        ctx.dst.append_little_endian(states[--j]);
+    }
+    ctx.ec = error_code::ok;
 }
 
-void iguana::ans1::encoder::at_process_start() {}
+template <
+    std::size_t N_STATES
+> void iguana::ans1::interleaved_encoder<N_STATES>::at_process_start() {
+    g_Compress.select();
+}
 
-void iguana::ans1::encoder::at_process_end() {}
+template <
+    std::size_t N_STATES
+> void iguana::ans1::interleaved_encoder<N_STATES>::at_process_end() {}
 
-iguana::ans1::decoder::~decoder() noexcept {}
+template <
+    std::size_t N_STATES
+> iguana::ans1::interleaved_decoder<N_STATES>::~interleaved_decoder() noexcept {}
 
-void iguana::ans1::decoder::decode(output_stream& dst, std::size_t result_size, input_stream& src, const statistics::decoding_table& tab) {
+template <
+    std::size_t N_STATES
+> void iguana::ans1::interleaved_decoder<N_STATES>::decode(output_stream& dst, std::size_t result_size, input_stream& src, const typename statistics::decoding_table& tab) {
     dst.reserve_more(result_size);
     context ctx{ .dst = dst, .result_size = result_size, .src = src, .tab = tab };
     g_Decompress(ctx);
@@ -79,52 +132,109 @@ void iguana::ans1::decoder::decode(output_stream& dst, std::size_t result_size,
     if (ctx.ec != error_code::ok) {
         exception::from_error(ctx.ec);
     }
-}        
+}
 
-void iguana::ans1::decoder::decompress_portable(context& ctx) {
-	const auto src_len = ctx.src.size();
+template <
+    std::size_t N_STATES
+> void iguana::ans1::interleaved_decoder<N_STATES>::decompress_portable(context& ctx) {
+    const auto src_len = ctx.src.size();
 
-	if (src_len < 4) {
-		ctx.ec = error_code::wrong_source_size;
+    if (src_len < 4 * N_STATES) {
+        ctx.ec = error_code::wrong_source_size;
         return;
-	}
+    }
 
-	auto cursor_src = src_len - 4;
     const std::uint8_t* const src = ctx.src.data();
-	auto state = utils::read_little_endian<std::uint32_t>(src + cursor_src);
+    std::uint32_t states[N_STATES];
+    for(std::size_t j = 0; j != N_STATES; ++j) {
+        states[j] = utils::read_little_endian<std::uint32_t>(src + src_len - 4 * (j + 1));
+    }
+    auto cursor_src = src_len - 4 * N_STATES;
+
+    const std::uint32_t* const tab = ctx.tab.slots;
+    const std::uint8_t* const symbols = ctx.tab.symbols;
+    const std::uint32_t scale_bits = ctx.tab.word_M_bits;
+    const std::uint32_t mask_M = (std::uint32_t(1) << scale_bits) - 1;
+    const std::uint32_t bias_shift = ctx.tab.bias_shift;
+    const std::uint32_t mask_F = (std::uint32_t(1) << bias_shift) - 1;
+    const auto origin = ctx.dst.size();
+    ctx.dst.resize(origin + ctx.result_size);
+    auto* const dst = ctx.dst.data() + origin;
+
+    // The states are independent, a round of N_STATES symbols has as many dependency chains
+    const auto decode_symbol = [&](std::uint32_t x, std::uint8_t& out) {
+        const auto slot = x & mask_M;
+        const auto t = tab[slot];
+        const auto freq = t & mask_F;
+        const auto bias = (t >> bias_shift) & mask_F;
+        // s, x = D(x)
+        const auto y = freq * (x >> scale_bits) + bias;
+        out = symbols[slot];
+        return y;
+    };
+
     std::size_t cursor_dst = 0;
 
-	for(;;) {
-		{   const std::uint32_t x = state;
-            const auto slot = x & (statistics::word_M - 1);
-            const auto t = ctx.tab[slot];
-            const auto freq = t & (statistics::word_M - 1);
-            const auto bias = (t >> statistics::word_M_bits) & (statistics::word_M - 1);
-            // s, x = D(x)
-            state = freq * (x >> statistics::word_M_bits) + bias;
-            ctx.dst.append(static_cast<std::uint8_t>(t >> 24));
-        
-            if (++cursor_dst >= ctx.result_size) {
-                break;
-            }
+    // A single state is better off with a predicted branch, which is off its dependency chain
+    if constexpr (N_STATES > 1) {
+        // A round consumes at most N_STATES words: while they are all there, the states are renormalized without
+        // branching. The rounds are unrolled, so that the states can live in registers
+        const auto decode_round = [&]<std::size_t... J>(std::index_sequence<J...>) {
+            ((states[J] = [&](std::uint32_t y) {
+                const std::uint32_t w = utils::read_little_endian<std::uint16_t>(src + cursor_src - 2);
+                const std::uint32_t r = (y < statistics::word_L) ? 1 : 0;
+                cursor_src -= 2 * r;
+                return (y << (statistics::word_L_bits * r)) | (w & (0 - r));
+            }(decode_symbol(states[J], dst[cursor_dst + J]))), ...);
+        };
+
+        for(const auto round_end = ctx.result_size - (ctx.result_size % N_STATES); (cursor_dst != round_end) && (cursor_src >= 2 * N_STATES); cursor_dst += N_STATES) {
+            decode_round(std::make_index_sequence<N_STATES>{});
         }
+    }
 
-		// Normalize state
-		if (const auto x = state; x < statistics::word_L) {
-			const auto v = utils::read_little_endian<std::uint16_t>(src + cursor_src - 2);
-			cursor_src -= 2;
-			state = (x << statistics::word_L_bits) | std::uint32_t(v);
-		}
-	}
+    for(; cursor_dst != ctx.result_size; ++cursor_dst) {
+        auto& state = states[cursor_dst % N_STATES];
+        const auto y = decode_symbol(state, dst[cursor_dst]);
 
-    if (state != statistics::word_L) {
-        ctx.ec = error_code::corrupted_bitstream;
-        return;
+        // Normalize state
+        if (y < statistics::word_L) {
+            if (cursor_src < 2) {
+                ctx.ec = error_code::corrupted_bitstream;
+                return;
+            }
+            cursor_src -= 2;
+            state = (y << statistics::word_L_bits) | std::uint32_t(utils::read_little_endian<std::uint16_t>(src + cursor_src));
+        } else {
+            state = y;
+        }
+    }
+
+    for(std::size_t j = 0; j != N_STATES; ++j) {
+        if (states[j] != statistics::word_L) {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
     }
 
-	ctx.ec = error_code::ok;
+    ctx.ec = error_code::ok;
+}
+
+template <
+    std::size_t N_STATES
+> void iguana::ans1::interleaved_decoder<N_STATES>::at_process_start() {
+    g_Decompress.select();
 }
 
-void iguana::ans1::decoder::at_process_start() {}
+template <
+    std::size_t N_STATES
+> void iguana::ans1::interleaved_decoder<N_STATES>::at_process_end() {}
+
+//
 
-void iguana::ans1::decoder::at_process_end() {}
+template class iguana::ans1::interleaved_encoder<1>;
+template class iguana::ans1::interleaved_encoder<4>;
+template class iguana::ans1::interleaved_encoder<8>;
+template class iguana::ans1::interleaved_decoder<1>;
+template class iguana::ans1::interleaved_decoder<4>;
+template class iguana::ans1::interleaved_decoder<8>;
@@ -17,33 +17,58 @@
 #include "error.h"
 #include "ans_encoder.h"
 #include "ans_decoder.h"
+#include "cpu.h"
 #include "ans_byte_statistics.h"
 
 namespace iguana::ans1 {
-
-    class IGUANA_API encoder final : public ans::basic_encoder<encoder, ans::byte_statistics> {
-        using super = ans::basic_encoder<encoder, ans::byte_statistics>;
-        friend internal::initializer<encoder>;
+    // The N_STATES states take the symbols in turns, so that the decoder can work on N_STATES independent dependency
+    // chains at once. All of them renormalize into the same stream of 16-bit words; the single-state format is ans1.
+    template <
+        std::size_t N_STATES
+    > class IGUANA_API interleaved_encoder final : public ans::basic_encoder<interleaved_encoder<N_STATES>, ans::byte_statistics> {
+        using super = ans::basic_encoder<interleaved_encoder<N_STATES>, ans::byte_statistics>;
+        friend internal::initializer<interleaved_encoder>;
         struct context;
         
     private:
-        static void (*g_Compress)(context& ctx);
-        static const internal::initializer<encoder> g_Initializer;
+        using kernel_function = void (*)(context& ctx);
+
+        static const cpu::kernel_table<kernel_function> g_Kernels;
+        static cpu::kernel_dispatch<kernel_function> g_Compress;
+        static const internal::initializer<interleaved_encoder> g_Initializer;
+
+    public:
+        using statistics = ans::byte_statistics;
+        static constexpr const std::size_t states = N_STATES;
 
     public:
-        encoder() noexcept = default;
-        ~encoder() noexcept;
+        interleaved_encoder() noexcept = default;
+        ~interleaved_encoder() noexcept;
 
-        encoder(const encoder&) = delete;
-        encoder& operator =(const encoder&) = delete;
+        interleaved_encoder(const interleaved_encoder&) = delete;
+        interleaved_encoder& operator =(const interleaved_encoder&) = delete;
 
-        encoder(encoder&& v) = default;
-        encoder& operator =(encoder&& v) = default;
+        interleaved_encoder(interleaved_encoder&& v) = default;
+        interleaved_encoder& operator =(interleaved_encoder&& v) = default;
 
     public:
         void encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len);
         using super::encode;
 
+        // The kernel is shared by all the encoders, and must not be changed while any of them is running
+        static kernel get_kernel() noexcept {
+            return g_Compress.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_Compress.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_Compress.set(k);
+        }
+
     private:
         static void compress_portable(context& ctx);
         static void at_process_start();
@@ -52,9 +77,12 @@ namespace iguana::ans1 {
 
     //
 
-    struct encoder::context final {
+    template <
+        std::size_t N_STATES
+    > struct interleaved_encoder<N_STATES>::context final {
         output_stream&      dst;
         const statistics&   stats;
+        const statistics::encoding_table& tab;
         const std::uint8_t  *src;
         std::size_t         src_len;
         error_code          ec;
@@ -62,29 +90,52 @@ namespace iguana::ans1 {
 
     //
 
-    class IGUANA_API decoder final : public ans::basic_decoder<decoder, ans::byte_statistics> {
-        using super = ans::basic_decoder<decoder, ans::byte_statistics>;
-        friend internal::initializer<decoder>;
+    template <
+        std::size_t N_STATES
+    > class IGUANA_API interleaved_decoder final : public ans::basic_decoder<interleaved_decoder<N_STATES>, ans::byte_statistics> {
+        using super = ans::basic_decoder<interleaved_decoder<N_STATES>, ans::byte_statistics>;
+        friend internal::initializer<interleaved_decoder>;
         struct context;
 
     private:
-        static void (*g_Decompress)(context& ctx);
-        static const internal::initializer<decoder> g_Initializer;
+        using kernel_function = void (*)(context& ctx);
+
+        static const cpu::kernel_table<kernel_function> g_Kernels;
+        static cpu::kernel_dispatch<kernel_function> g_Decompress;
+        static const internal::initializer<interleaved_decoder> g_Initializer;
 
     public:
-        decoder() {}
-        ~decoder() noexcept;
+        using statistics = ans::byte_statistics;
+        static constexpr const std::size_t states = N_STATES;
 
-        decoder(const decoder&) = delete;
-        decoder& operator =(const decoder&) = delete;
+    public:
+        interleaved_decoder() {}
+        ~interleaved_decoder() noexcept;
 
-        decoder(decoder&& v) = default;
-        decoder& operator =(decoder&& v) = default;
+        interleaved_decoder(const interleaved_decoder&) = delete;
+        interleaved_decoder& operator =(const interleaved_decoder&) = delete;
+
+        interleaved_decoder(interleaved_decoder&& v) = default;
+        interleaved_decoder& operator =(interleaved_decoder&& v) = default;
 
     public:
         void decode(output_stream& dst, std::size_t result_size, input_stream& src, const statistics::decoding_table& tab);
         using super::decode;
 
+        // The kernel is shared by all the decoders, and must not be changed while any of them is running
+        static kernel get_kernel() noexcept {
+            return g_Decompress.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_Decompress.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_Decompress.set(k);
+        }
+
     private:
         static void decompress_portable(context& ctx);
         static void at_process_start();
@@ -93,11 +144,35 @@ namespace iguana::ans1 {
 
     //
 
-    struct decoder::context final {
+    template <
+        std::size_t N_STATES
+    > struct interleaved_decoder<N_STATES>::context final {
         output_stream&                      dst;
         std::size_t                         result_size;
         input_stream&                       src;
         const statistics::decoding_table&   tab;
         error_code                          ec;
     };
+
+    //
+
+    extern template class interleaved_encoder<1>;
+    extern template class interleaved_encoder<4>;
+    extern template class interleaved_encoder<8>;
+    extern template class interleaved_decoder<1>;
+    extern template class interleaved_decoder<4>;
+    extern template class interleaved_decoder<8>;
+
+    using encoder = interleaved_encoder<1>;
+    using decoder = interleaved_decoder<1>;
+}
+
+namespace iguana::ans4 {
+    using encoder = ans1::interleaved_encoder<4>;
+    using decoder = ans1::interleaved_decoder<4>;
+}
+
+namespace iguana::ans8 {
+    using encoder = ans1::interleaved_encoder<8>;
+    using decoder = ans1::interleaved_decoder<8>;
 }
@@ -12,6 +12,8 @@
 //  See the License for the specific language governing permissions and
 //  limitations under the License.
 
+#include <stdexcept>
+#include <string>
 #include "ans32.h"
 #include "memops.h"
 #include "utils.h"
@@ -19,16 +21,31 @@
 //
 
 namespace iguana::ans32 {
-    void (*encoder::g_Compress)(context& ctx) = &encoder::compress_portable;
+    const cpu::kernel_table<encoder::kernel_function> encoder::g_Kernels = {
+        &encoder::compress_portable,
+#if defined(IGUANA_PROCESSOR_X64)
+        &encoder::compress_avx2,
+        &encoder::compress_avx512
+#endif
+    };
+    cpu::kernel_dispatch<encoder::kernel_function> encoder::g_Compress("ans32 encoder", g_Kernels);
     const internal::initializer<encoder> encoder::g_Initializer;
 
-    void (*decoder::g_Decompress)(context& ctx) = &decoder::decompress_portable;
+    const cpu::kernel_table<decoder::kernel_function> decoder::g_Kernels = {
+        &decoder::decompress_portable,
+#if defined(IGUANA_PROCESSOR_X64)
+        &decoder::decompress_avx2,
+        &decoder::decompress_avx512
+#endif
+    };
+    cpu::kernel_dispatch<decoder::kernel_function> decoder::g_Decompress("ans32 decoder", g_Kernels);
     const internal::initializer<decoder> decoder::g_Initializer;
 }
 
 //
 
 iguana::ans32::encoder::encoder() {
+    m_fwd.reserve(statistics::initial_buffer_size);
     m_rev.reserve(statistics::initial_buffer_size);
 }
 
@@ -46,40 +63,39 @@ void iguana::ans32::encoder::put(context& ctx, const std::uint8_t* p, std::size_
 	// the forward half
 	for(int lane = 15; lane >= 0; --lane) {
 		if (lane < n) {
-			const auto q = ctx.stats[p[lane]];
-			const auto freq = q & statistics::frequency_mask;
-			const auto start = (q >> statistics::frequency_bits) & statistics::cumulative_frequency_mask;
+			const auto& sym = ctx.tab[p[lane]];
 			// renormalize
 			auto x = ctx.state[lane];
-			if (x >= ((statistics::word_L >> statistics::word_M_bits) << statistics::word_L_bits) * freq) {
+			if (x >= sym.x_max) {
 				ctx.fwd.append_big_endian(static_cast<std::uint16_t>(x));
 				x >>= statistics::word_L_bits;
 			}
 			// x = C(s,x)
-			ctx.state[lane] = ((x / freq) << statistics::word_M_bits) + (x % freq) + start;
+			ctx.state[lane] = sym.encode(x);
 		}
 	}
 	// the reverse half
 	for(int lane = 31; lane >= 16; --lane) {
 		if (lane < n) {
-			const auto q = ctx.stats[p[lane]];
-			const auto freq = q & statistics::frequency_mask;
-			const auto start = (q >> statistics::frequency_bits) & statistics::cumulative_frequency_mask;
+			const auto& sym = ctx.tab[p[lane]];
 			// renormalize
 			auto x = ctx.state[lane];
-			if (x >= ((statistics::word_L >> statistics::word_M_bits) << statistics::word_L_bits) * freq) {
+			if (x >= sym.x_max) {
 				ctx.rev.append_little_endian(static_cast<std::uint16_t>(x));
 				x >>= statistics::word_L_bits;
 			}
 			// x = C(s,x)
-			ctx.state[lane] = ((x / freq) << statistics::word_M_bits) + (x % freq) + start;
+			ctx.state[lane] = sym.encode(x);
 		}
 	}
 }
 
 void iguana::ans32::encoder::encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len) {
+    m_fwd.clear();
     m_rev.clear();
-    context ctx { .fwd = dst, .rev = m_rev, .stats = stats, .src = src, .src_len = src_len };
+    statistics::encoding_table tab;
+    stats.build_encoding_table(tab);
+    context ctx { .fwd = m_fwd, .rev = m_rev, .stats = stats, .tab = tab, .src = src, .src_len = src_len };
     memory::fill(ctx.state, statistics::word_L);
     g_Compress(ctx);
         
@@ -87,9 +103,12 @@ void iguana::ans32::encoder::encode(output_stream& dst, const statistics& stats,
         exception::from_error(ctx.ec);
     }
 
-	const auto len_rev = m_rev.size();
-    dst.reserve_more(len_rev + statistics::dense_table_max_length);
-	dst.append_reverse(m_rev.data(), m_rev.size());
+    // The forward half is decoded from the start of the stream, so it must be reversed. The reverse
+    // half is decoded backwards from the end of the stream, preceding the statistics.
+    dst.reserve_more(m_fwd.size() + m_rev.size() + statistics::dense_table_max_length);
+	dst.append_reverse(m_fwd.data(), m_fwd.size());
+	dst.append(m_rev.data(), m_rev.size());
+    stats.serialize(dst);
 }
 
 void iguana::ans32::encoder::compress_portable(context& ctx) {
@@ -104,7 +123,11 @@ void iguana::ans32::encoder::compress_portable(context& ctx) {
 		put(ctx, ctx.src + k, 32);
 	}
 
-    // Flush
+    flush(ctx);
+    ctx.ec = error_code::ok;
+}
+
+void iguana::ans32::encoder::flush(context& ctx) {
 	for(int lane = 15; lane >= 0; --lane) {
         ctx.fwd.append_big_endian(ctx.state[lane]);
 	}
@@ -112,11 +135,11 @@ void iguana::ans32::encoder::compress_portable(context& ctx) {
 	for(int lane = 16; lane < 32; ++lane) {
         ctx.rev.append_little_endian(ctx.state[lane]);
 	}
-
-    ctx.ec = error_code::ok;
 }
 
-void iguana::ans32::encoder::at_process_start() {}
+void iguana::ans32::encoder::at_process_start() {
+    g_Compress.select();
+}
 
 void iguana::ans32::encoder::at_process_end() {}
 
@@ -146,23 +169,25 @@ void iguana::ans32::decoder::decompress_portable(context& ctx) {
 	}
 
 	std::size_t cursor_dst = 0;
+	const std::uint32_t scale_bits = ctx.tab.word_M_bits;
+	const std::uint32_t mask_M = (std::uint32_t(1) << scale_bits) - 1;
+	const std::uint32_t bias_shift = ctx.tab.bias_shift;
+	const std::uint32_t mask_F = (std::uint32_t(1) << bias_shift) - 1;
 
 	for(;;) {
 		for(std::size_t lane = 0; lane != 32; ++lane) {
+			if (cursor_dst == ctx.result_size) {
+				goto done;
+			}
 			std::uint32_t x = state[lane];
-			const auto slot = x & (statistics::word_M - 1);
+			const auto slot = x & mask_M;
 			const auto t = ctx.tab[slot];
-			const auto freq = std::uint32_t(t & (statistics::word_M - 1));
-			const auto bias = std::uint32_t((t >> statistics::word_M_bits) & (statistics::word_M - 1));
+			const auto freq = std::uint32_t(t & mask_F);
+			const auto bias = std::uint32_t((t >> bias_shift) & mask_F);
 			// s, x = D(x)
-			state[lane] = freq * (x >> statistics::word_M_bits) + bias;
-			const auto s = std::uint8_t(t >> 24);
-			if (cursor_dst < ctx.result_size) {
-				ctx.dst.append(s);
-				++cursor_dst;
-			} else {
-				goto done;
-			}
+			state[lane] = freq * (x >> scale_bits) + bias;
+			ctx.dst.append(ctx.tab.symbols[slot]);
+			++cursor_dst;
 		}
 		// Normalize the forward part
 		for(std::size_t lane = 0; lane != 16; ++lane) {
@@ -194,6 +219,8 @@ done:
     ctx.ec = error_code::ok;
 }
 
-void iguana::ans32::decoder::at_process_start() {}
+void iguana::ans32::decoder::at_process_start() {
+    g_Decompress.select();
+}
 
 void iguana::ans32::decoder::at_process_end() {}
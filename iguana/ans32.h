@@ -17,6 +17,7 @@
 #include "error.h"
 #include "ans_encoder.h"
 #include "ans_decoder.h"
+#include "cpu.h"
 #include "ans_byte_statistics.h"
 
 namespace iguana::ans32 {
@@ -27,10 +28,14 @@ namespace iguana::ans32 {
         struct context;
 
     private:
-       static void (*g_Compress)(context& ctx);
+       using kernel_function = void (*)(context& ctx);
+
+       static const cpu::kernel_table<kernel_function> g_Kernels;
+       static cpu::kernel_dispatch<kernel_function> g_Compress;
        static const internal::initializer<encoder> g_Initializer;
 
     private:
+        output_stream m_fwd;
         output_stream m_rev;
 
     public:
@@ -47,9 +52,28 @@ namespace iguana::ans32 {
         void encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len);
         using super::encode;
 
+        // The kernel is shared by all the encoders, and must not be changed while any of them is running
+        static kernel get_kernel() noexcept {
+            return g_Compress.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_Compress.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_Compress.set(k);
+        }
+
     private:
         static void compress_portable(context& ctx);
+#if defined(IGUANA_PROCESSOR_X64)
+        static void compress_avx2(context& ctx);
+        static void compress_avx512(context& ctx);
+#endif
         static void put(context& ctx, const std::uint8_t* p, std::size_t n);
+        static void flush(context& ctx);
         static void at_process_start();
         static void at_process_end();
     };
@@ -61,6 +85,7 @@ namespace iguana::ans32 {
         output_stream&      fwd;
         output_stream&      rev;
         const statistics&   stats;
+        const statistics::encoding_table& tab;
         const std::uint8_t  *src;
         std::size_t         src_len;
         error_code          ec;
@@ -74,7 +99,10 @@ namespace iguana::ans32 {
         struct context;
 
     private:
-        static void (*g_Decompress)(context& ctx);
+        using kernel_function = void (*)(context& ctx);
+
+        static const cpu::kernel_table<kernel_function> g_Kernels;
+        static cpu::kernel_dispatch<kernel_function> g_Decompress;
         static const internal::initializer<decoder> g_Initializer;
 
     public:
@@ -91,8 +119,26 @@ namespace iguana::ans32 {
         void decode(output_stream& dst, std::size_t result_size, input_stream& src, const statistics::decoding_table& tab);
         using super::decode;
 
+        // The kernel is shared by all the decoders, and must not be changed while any of them is running
+        static kernel get_kernel() noexcept {
+            return g_Decompress.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_Decompress.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_Decompress.set(k);
+        }
+
     private:
         static void decompress_portable(context& ctx);
+#if defined(IGUANA_PROCESSOR_X64)
+        static void decompress_avx2(context& ctx);
+        static void decompress_avx512(context& ctx);
+#endif
         static void at_process_start();
         static void at_process_end();
     };
@@ -0,0 +1,307 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "common.h"
+
+#if defined(IGUANA_PROCESSOR_X64)
+#include <array>
+#include <immintrin.h>
+#include "ans32.h"
+
+// The AVX2 ans32 encoder keeps the states of either half in two YMM registers in descending lane order, the order
+// the portable encoder emits their words in, and compacts the words of the lanes due for renormalization with a
+// permutation looked up by the lane mask. The divisions are carried out as in compress_avx512.
+//
+// The AVX2 ans32 decoder keeps the 32 states in four YMM registers, lanes 0-7 and 8-15 forward, 16-23 and 24-31
+// reverse, and decodes a symbol from every lane with four gathers into the decoding table. AVX2 has no expansion,
+// so the words are distributed to the lanes below word_L with a permutation looked up by the lane mask.
+
+namespace iguana::ans32 {
+    namespace {
+        using statistics = decoder::statistics;
+
+        constexpr const std::size_t avx2_lanes = 32;
+        constexpr const std::size_t avx2_state_bytes = (avx2_lanes / 2) * sizeof(std::uint32_t);
+
+        // For every 8-bit lane mask, the index of the word each set lane takes, i.e. the number of set lanes below it
+        constexpr std::array<std::uint64_t, 256> avx2_make_expand_indices() noexcept {
+            std::array<std::uint64_t, 256> r{};
+            for(unsigned m = 0; m != 256; ++m) {
+                std::uint64_t v = 0;
+                unsigned k = 0;
+                for(unsigned lane = 0; lane != 8; ++lane) {
+                    if ((m >> lane) & 1) {
+                        v |= std::uint64_t(k++) << (lane * 8);
+                    }
+                }
+                r[m] = v;
+            }
+            return r;
+        }
+
+        // For every 8-bit lane mask, the lane holding the k-th set bit at byte k
+        constexpr std::array<std::uint64_t, 256> avx2_make_compress_indices() noexcept {
+            std::array<std::uint64_t, 256> r{};
+            for(unsigned m = 0; m != 256; ++m) {
+                std::uint64_t v = 0;
+                unsigned k = 0;
+                for(unsigned lane = 0; lane != 8; ++lane) {
+                    if ((m >> lane) & 1) {
+                        v |= std::uint64_t(lane) << (8 * k++);
+                    }
+                }
+                r[m] = v;
+            }
+            return r;
+        }
+
+        alignas(64) constexpr const std::array<std::uint64_t, 256> avx2_expand_indices = avx2_make_expand_indices();
+        alignas(64) constexpr const std::array<std::uint64_t, 256> avx2_compress_indices = avx2_make_compress_indices();
+
+        IGUANA_TARGET_AVX2 inline __m256i avx2_reverse_lanes(__m256i v) noexcept {
+            return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+        }
+
+        // The states may exceed the range of the signed conversion, the quotients do not
+        IGUANA_TARGET_AVX2 inline __m256d avx2_uint32_to_double(__m128i v) noexcept {
+            const __m256d d = _mm256_cvtepi32_pd(_mm_xor_si128(v, _mm_set1_epi32(std::int32_t(0x80000000u))));
+            return _mm256_add_pd(d, _mm256_set1_pd(2147483648.0));
+        }
+
+        // See avx512_divide
+        IGUANA_TARGET_AVX2 inline __m256i avx2_divide(__m256i x, __m256i d, __m256i& rem) noexcept {
+            const __m256 rcp = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_cvtepi32_ps(d));
+            const __m128i lo = _mm256_cvttpd_epi32(_mm256_mul_pd(avx2_uint32_to_double(_mm256_castsi256_si128(x)), _mm256_cvtps_pd(_mm256_castps256_ps128(rcp))));
+            const __m128i hi = _mm256_cvttpd_epi32(_mm256_mul_pd(avx2_uint32_to_double(_mm256_extracti128_si256(x, 1)), _mm256_cvtps_pd(_mm256_extractf128_ps(rcp, 1))));
+            __m256i q = _mm256_set_m128i(hi, lo);
+            __m256i r = _mm256_sub_epi32(x, _mm256_mullo_epi32(q, d));
+
+            // The all-ones masks subtract or add one
+            const __m256i over = _mm256_cmpgt_epi32(_mm256_setzero_si256(), r);
+            q = _mm256_add_epi32(q, over);
+            r = _mm256_add_epi32(r, _mm256_and_si256(over, d));
+
+            const __m256i under = _mm256_cmpgt_epi32(r, _mm256_sub_epi32(d, _mm256_set1_epi32(1)));
+            q = _mm256_sub_epi32(q, under);
+            rem = _mm256_sub_epi32(r, _mm256_and_si256(under, d));
+            return q;
+        }
+
+        // Encodes the 8 symbols into the states of a quarter, see encoder::put
+        template <
+            bool T_BIG_ENDIAN
+        > IGUANA_TARGET_AVX2 inline __m256i avx2_encode_step(__m256i x, __m128i syms, const statistics& stats, __m256i scale_bits, __m256i renormalization_shift, std::uint8_t*& out) noexcept {
+            const __m256i q = _mm256_i32gather_epi32(reinterpret_cast<const int*>(stats.m_table.data()), _mm256_cvtepu8_epi32(syms), sizeof(std::uint32_t));
+            const __m256i freq = _mm256_and_si256(q, _mm256_set1_epi32(statistics::frequency_mask));
+            const __m256i start = _mm256_and_si256(_mm256_srli_epi32(q, statistics::frequency_bits), _mm256_set1_epi32(statistics::cumulative_frequency_mask));
+
+            // renormalize
+            const __m256i above = _mm256_cmpeq_epi32(_mm256_max_epu32(x, _mm256_sllv_epi32(freq, renormalization_shift)), x);
+            const auto m = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(above)));
+            if (m != 0) {
+                const __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&avx2_compress_indices[m])));
+                const __m256i w = _mm256_and_si256(_mm256_permutevar8x32_epi32(x, idx), _mm256_set1_epi32(0xffff));
+                __m128i words = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi32(w, w), _MM_SHUFFLE(3, 1, 2, 0)));
+                if constexpr (T_BIG_ENDIAN) {
+                    words = _mm_shuffle_epi8(words, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), words);
+                out += 2 * std::size_t(_mm_popcnt_u32(m));
+                x = _mm256_blendv_epi8(x, _mm256_srli_epi32(x, statistics::word_L_bits), above);
+            }
+
+            // x = C(s,x)
+            __m256i rem;
+            const __m256i quot = avx2_divide(x, freq, rem);
+            return _mm256_add_epi32(_mm256_add_epi32(_mm256_sllv_epi32(quot, scale_bits), rem), start);
+        }
+
+        // Above the compact precision, the symbols are gathered as the words at their bytes, see decoding_table
+        IGUANA_TARGET_AVX2 inline __m256i avx2_decode_step(__m256i x, const statistics::decoding_table& tab, __m256i scale_bits, __m256i mask_M, __m256i bias_shift, __m256i mask_F, bool wide, __m256i& sym) noexcept {
+            const __m256i slot = _mm256_and_si256(x, mask_M);
+            const __m256i t = _mm256_i32gather_epi32(reinterpret_cast<const int*>(tab.slots), slot, sizeof(std::uint32_t));
+            const __m256i freq = _mm256_and_si256(t, mask_F);
+            const __m256i bias = _mm256_and_si256(_mm256_srlv_epi32(t, bias_shift), mask_F);
+
+            // s, x = D(x)
+            sym = wide ? _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(tab.symbols), slot, 1), _mm256_set1_epi32(0xff)) : _mm256_srli_epi32(t, 24);
+            return _mm256_add_epi32(_mm256_mullo_epi32(freq, _mm256_srlv_epi32(x, scale_bits)), bias);
+        }
+
+        // Narrows the symbols of the 32 lanes to bytes, in lane order
+        IGUANA_TARGET_AVX2 inline void avx2_store_symbols(std::uint8_t* out, __m256i a, __m256i b, __m256i c, __m256i d) noexcept {
+            const __m256i ab = _mm256_packus_epi32(a, b);
+            const __m256i cd = _mm256_packus_epi32(c, d);
+            const __m256i abcd = _mm256_packus_epi16(ab, cd);
+            const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permutevar8x32_epi32(abcd, order));
+        }
+
+        // Shifts a word into every lane below word_L, taking the words in order from p. The reverse lanes take
+        // theirs in descending order from the 16 bytes below p. Returns the number of words consumed.
+        template <
+            bool T_REVERSE
+        > IGUANA_TARGET_AVX2 inline unsigned avx2_renormalize(__m256i& x, const std::uint8_t* p) noexcept {
+            const __m256i below = _mm256_cmpeq_epi32(_mm256_srli_epi32(x, statistics::word_L_bits), _mm256_setzero_si256());
+            const auto m = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(below)));
+            if (m == 0) {
+                return 0;
+            }
+
+            __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&avx2_expand_indices[m])));
+            __m128i raw;
+            if constexpr (T_REVERSE) {
+                idx = _mm256_sub_epi32(_mm256_set1_epi32(7), idx);
+                raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p - 16));
+            } else {
+                raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            }
+
+            const __m256i w = _mm256_permutevar8x32_epi32(_mm256_cvtepu16_epi32(raw), idx);
+            x = _mm256_blendv_epi8(x, _mm256_or_si256(_mm256_slli_epi32(x, statistics::word_L_bits), w), below);
+            return unsigned(_mm_popcnt_u32(m));
+        }
+    }
+}
+
+//
+
+IGUANA_TARGET_AVX2 void iguana::ans32::encoder::compress_avx2(context& ctx) {
+    const std::size_t n_last = ctx.src_len % avx2_lanes;
+    std::size_t k = ctx.src_len - n_last;
+
+    // Process the last chunk first
+    put(ctx, ctx.src + k, n_last);
+
+    // See compress_avx512
+    const std::size_t fwd_origin = ctx.fwd.size();
+    const std::size_t rev_origin = ctx.rev.size();
+    ctx.fwd.resize(fwd_origin + k);
+    ctx.rev.resize(rev_origin + k);
+    std::uint8_t* const fwd_begin = ctx.fwd.data() + fwd_origin;
+    std::uint8_t* const rev_begin = ctx.rev.data() + rev_origin;
+    std::uint8_t* fwd_out = fwd_begin;
+    std::uint8_t* rev_out = rev_begin;
+
+    // Lanes 15-8, 7-0, 31-24 and 23-16
+    const auto* const state = reinterpret_cast<const __m256i*>(ctx.state);
+    __m256i x0 = avx2_reverse_lanes(_mm256_loadu_si256(state + 1));
+    __m256i x1 = avx2_reverse_lanes(_mm256_loadu_si256(state));
+    __m256i x2 = avx2_reverse_lanes(_mm256_loadu_si256(state + 3));
+    __m256i x3 = avx2_reverse_lanes(_mm256_loadu_si256(state + 2));
+
+    const __m128i reverse_bytes = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256i scale_bits = _mm256_set1_epi32(std::int32_t(ctx.stats.scale_bits()));
+    const __m256i renormalization_shift = _mm256_set1_epi32(std::int32_t(2 * statistics::word_L_bits - ctx.stats.scale_bits()));
+
+    // Process the remaining chunks
+    while(k != 0) {
+        k -= avx2_lanes;
+        const __m128i fwd_syms = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctx.src + k)), reverse_bytes);
+        const __m128i rev_syms = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctx.src + k + 16)), reverse_bytes);
+
+        x0 = avx2_encode_step<true>(x0, fwd_syms, ctx.stats, scale_bits, renormalization_shift, fwd_out);
+        x1 = avx2_encode_step<true>(x1, _mm_srli_si128(fwd_syms, 8), ctx.stats, scale_bits, renormalization_shift, fwd_out);
+        x2 = avx2_encode_step<false>(x2, rev_syms, ctx.stats, scale_bits, renormalization_shift, rev_out);
+        x3 = avx2_encode_step<false>(x3, _mm_srli_si128(rev_syms, 8), ctx.stats, scale_bits, renormalization_shift, rev_out);
+    }
+
+    auto* const state_out = reinterpret_cast<__m256i*>(ctx.state);
+    _mm256_storeu_si256(state_out, avx2_reverse_lanes(x1));
+    _mm256_storeu_si256(state_out + 1, avx2_reverse_lanes(x0));
+    _mm256_storeu_si256(state_out + 2, avx2_reverse_lanes(x3));
+    _mm256_storeu_si256(state_out + 3, avx2_reverse_lanes(x2));
+    ctx.fwd.resize(fwd_origin + std::size_t(fwd_out - fwd_begin));
+    ctx.rev.resize(rev_origin + std::size_t(rev_out - rev_begin));
+
+    flush(ctx);
+    ctx.ec = error_code::ok;
+}
+
+IGUANA_TARGET_AVX2 void iguana::ans32::decoder::decompress_avx2(context& ctx) {
+    const std::uint8_t* const src = ctx.src.data();
+    const std::size_t src_len = ctx.src.size();
+
+    if (src_len < 2 * avx2_state_bytes) {
+        ctx.ec = error_code::corrupted_bitstream;
+        return;
+    }
+
+    std::size_t cursor_fwd = avx2_state_bytes;
+    std::size_t cursor_rev = src_len - avx2_state_bytes;
+
+    __m256i x0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    __m256i x1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32));
+    __m256i x2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + cursor_rev));
+    __m256i x3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + cursor_rev + 32));
+
+    const std::size_t dst_origin = ctx.dst.size();
+    ctx.dst.resize(dst_origin + ctx.result_size);
+    std::uint8_t* out = ctx.dst.data() + dst_origin;
+    std::uint8_t* const out_end = out + ctx.result_size;
+
+    const __m256i scale_bits = _mm256_set1_epi32(std::int32_t(ctx.tab.word_M_bits));
+    const __m256i mask_M = _mm256_set1_epi32(std::int32_t((std::uint32_t(1) << ctx.tab.word_M_bits) - 1));
+    const __m256i bias_shift = _mm256_set1_epi32(std::int32_t(ctx.tab.bias_shift));
+    const __m256i mask_F = _mm256_set1_epi32(std::int32_t((std::uint32_t(1) << ctx.tab.bias_shift) - 1));
+    const bool wide = (ctx.tab.word_M_bits > statistics::compact_word_M_bits);
+
+    // See decompress_avx512, every renormalization reads at most 32 bytes from either cursor
+    while(std::size_t(out_end - out) >= avx2_lanes) {
+        __m256i s0, s1, s2, s3;
+        x0 = avx2_decode_step(x0, ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide, s0);
+        x1 = avx2_decode_step(x1, ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide, s1);
+        x2 = avx2_decode_step(x2, ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide, s2);
+        x3 = avx2_decode_step(x3, ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide, s3);
+        avx2_store_symbols(out, s0, s1, s2, s3);
+        out += avx2_lanes;
+
+        cursor_fwd += 2 * avx2_renormalize<false>(x0, src + cursor_fwd);
+        cursor_fwd += 2 * avx2_renormalize<false>(x1, src + cursor_fwd);
+        cursor_rev -= 2 * avx2_renormalize<true>(x2, src + cursor_rev);
+        cursor_rev -= 2 * avx2_renormalize<true>(x3, src + cursor_rev);
+        if (cursor_fwd > cursor_rev) [[unlikely]] {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+    }
+
+    alignas(32) std::uint32_t state[avx2_lanes];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(state), x0);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(state + 8), x1);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(state + 16), x2);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(state + 24), x3);
+
+    for(std::size_t lane = 0; out != out_end; ++lane) {
+        const std::uint32_t x = state[lane];
+        const auto slot = x & ((std::uint32_t(1) << ctx.tab.word_M_bits) - 1);
+        const auto t = ctx.tab[slot];
+        const auto mask_F = (std::uint32_t(1) << ctx.tab.bias_shift) - 1;
+        const auto freq = std::uint32_t(t & mask_F);
+        const auto bias = std::uint32_t((t >> ctx.tab.bias_shift) & mask_F);
+        state[lane] = freq * (x >> ctx.tab.word_M_bits) + bias;
+        *out++ = ctx.tab.symbols[slot];
+    }
+
+    for(std::size_t i = 0; i != avx2_lanes; ++i) {
+        if (state[i] != statistics::word_L) {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+    }
+
+    ctx.ec = error_code::ok;
+}
+
+#endif
@@ -0,0 +1,245 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "common.h"
+
+#if defined(IGUANA_PROCESSOR_X64)
+#include <immintrin.h>
+#include "ans32.h"
+#include "utils.h"
+
+// The AVX-512 ans32 encoder keeps the states of either half in a ZMM register in descending lane order, which
+// is the order the portable encoder emits their words in. The words of the lanes due for renormalization are
+// compressed to the bottom of the register, narrowed and stored to the end of the buffer in a single write.
+// The divisions multiply by the reciprocal of the frequency and correct the truncated quotient.
+//
+// The AVX-512 ans32 decoder keeps the forward states (lanes 0-15) and the reverse states (lanes 16-31) in a ZMM
+// register each, and decodes a symbol from all 32 lanes with two gathers into the decoding table. The lanes that
+// fall below word_L are renormalized together: a 32-byte load from either end of the stream is expanded into
+// them, the reverse half with its 16-bit words in descending order, as the portable decoder reads them.
+
+namespace iguana::ans32 {
+    namespace {
+        using statistics = decoder::statistics;
+
+        constexpr const std::size_t avx512_lanes = 32;
+
+        // The streams begin with the final states of the forward lanes and end with those of the reverse lanes
+        constexpr const std::size_t avx512_state_bytes = (avx512_lanes / 2) * sizeof(std::uint32_t);
+
+        // Reverses the order of the lanes. The encoder keeps its states this way, and the 32 bytes below the
+        // reverse cursor of the decoder hold the words of lanes 16, 17, ... from their top down.
+        alignas(64) constexpr const std::uint32_t avx512_reverse_lanes[16] = {
+            15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+        };
+
+        // Reverses the order of the symbols of a half
+        alignas(16) constexpr const std::uint8_t avx512_reverse_bytes[16] = {
+            15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+        };
+
+        // Swaps the bytes of every 16-bit word
+        alignas(32) constexpr const std::uint8_t avx512_swap_words[32] = {
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+        };
+
+        // The quotient is estimated with a single-precision reciprocal, which is within 2^-2 of the exact one
+        // for a 22-bit quotient at the lowest precision, and the truncated estimate is corrected by at most one
+        // either way
+        IGUANA_TARGET_AVX512 inline __m512i avx512_divide(__m512i x, __m512i d, __m512i& rem) noexcept {
+            const __m512 rcp = _mm512_div_ps(_mm512_set1_ps(1.0f), _mm512_cvtepu32_ps(d));
+            const __m256i lo = _mm512_cvttpd_epu32(_mm512_mul_pd(_mm512_cvtepu32_pd(_mm512_castsi512_si256(x)), _mm512_cvtps_pd(_mm512_castps512_ps256(rcp))));
+            const __m256i hi = _mm512_cvttpd_epu32(_mm512_mul_pd(_mm512_cvtepu32_pd(_mm512_extracti64x4_epi64(x, 1)),
+                _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(rcp), 1)))));
+            __m512i q = _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+            __m512i r = _mm512_sub_epi32(x, _mm512_mullo_epi32(q, d));
+
+            const __mmask16 over = _mm512_cmplt_epi32_mask(r, _mm512_setzero_si512());
+            q = _mm512_mask_sub_epi32(q, over, q, _mm512_set1_epi32(1));
+            r = _mm512_mask_add_epi32(r, over, r, d);
+
+            const __mmask16 under = _mm512_cmpge_epu32_mask(r, d);
+            q = _mm512_mask_add_epi32(q, under, q, _mm512_set1_epi32(1));
+            rem = _mm512_mask_sub_epi32(r, under, r, d);
+            return q;
+        }
+
+        // Encodes the 16 symbols at p into the states of a half, see encoder::put. A state at or above
+        // freq << renormalization_shift emits a word before encoding.
+        template <
+            bool T_BIG_ENDIAN
+        > IGUANA_TARGET_AVX512 inline __m512i avx512_encode_step(__m512i x, const std::uint8_t* p, const statistics& stats, __m512i scale_bits, __m512i renormalization_shift, std::uint8_t*& out) noexcept {
+            const __m128i syms = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), _mm_load_si128(reinterpret_cast<const __m128i*>(avx512_reverse_bytes)));
+            const __m512i q = _mm512_i32gather_epi32(_mm512_cvtepu8_epi32(syms), stats.m_table.data(), sizeof(std::uint32_t));
+            const __m512i freq = _mm512_and_si512(q, _mm512_set1_epi32(statistics::frequency_mask));
+            const __m512i start = _mm512_and_si512(_mm512_srli_epi32(q, statistics::frequency_bits), _mm512_set1_epi32(statistics::cumulative_frequency_mask));
+
+            // renormalize
+            const __mmask16 m = _mm512_cmpge_epu32_mask(x, _mm512_sllv_epi32(freq, renormalization_shift));
+            __m256i words = _mm512_cvtepi32_epi16(_mm512_maskz_compress_epi32(m, x));
+            if constexpr (T_BIG_ENDIAN) {
+                words = _mm256_shuffle_epi8(words, _mm256_load_si256(reinterpret_cast<const __m256i*>(avx512_swap_words)));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), words);
+            out += 2 * std::size_t(_mm_popcnt_u32(m));
+            x = _mm512_mask_srli_epi32(x, m, x, statistics::word_L_bits);
+
+            // x = C(s,x)
+            __m512i rem;
+            const __m512i quot = avx512_divide(x, freq, rem);
+            return _mm512_add_epi32(_mm512_add_epi32(_mm512_sllv_epi32(quot, scale_bits), rem), start);
+        }
+
+        // Above the compact precision, the symbols are gathered as the words at their bytes, see decoding_table.
+        // The narrowing keeps their low bytes.
+        IGUANA_TARGET_AVX512 inline __m512i avx512_decode_step(__m512i x, const statistics::decoding_table& tab, __m512i scale_bits, __m512i mask_M, __m512i bias_shift, __m512i mask_F, bool wide, std::uint8_t* out) noexcept {
+            const __m512i slot = _mm512_and_si512(x, mask_M);
+            const __m512i t = _mm512_i32gather_epi32(slot, tab.slots, sizeof(std::uint32_t));
+            const __m512i freq = _mm512_and_si512(t, mask_F);
+            const __m512i bias = _mm512_and_si512(_mm512_srlv_epi32(t, bias_shift), mask_F);
+
+            // s, x = D(x)
+            const __m512i sym = wide ? _mm512_i32gather_epi32(slot, tab.symbols, 1) : _mm512_srli_epi32(t, 24);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm512_cvtepi32_epi8(sym));
+            return _mm512_add_epi32(_mm512_mullo_epi32(freq, _mm512_srlv_epi32(x, scale_bits)), bias);
+        }
+
+        // Shifts a word into every masked lane, the words are taken in order from the lanes of w
+        IGUANA_TARGET_AVX512 inline __m512i avx512_renormalize(__m512i x, __mmask16 m, __m512i w) noexcept {
+            return _mm512_mask_or_epi32(x, m, _mm512_slli_epi32(x, statistics::word_L_bits), _mm512_maskz_expand_epi32(m, w));
+        }
+    }
+}
+
+//
+
+IGUANA_TARGET_AVX512 void iguana::ans32::encoder::compress_avx512(context& ctx) {
+    const std::size_t n_last = ctx.src_len % avx512_lanes;
+    std::size_t k = ctx.src_len - n_last;
+
+    // Process the last chunk first
+    put(ctx, ctx.src + k, n_last);
+
+    // Every chunk stores 32 bytes at most 32 bytes past the previous one into either buffer
+    const std::size_t fwd_origin = ctx.fwd.size();
+    const std::size_t rev_origin = ctx.rev.size();
+    ctx.fwd.resize(fwd_origin + k);
+    ctx.rev.resize(rev_origin + k);
+    std::uint8_t* const fwd_begin = ctx.fwd.data() + fwd_origin;
+    std::uint8_t* const rev_begin = ctx.rev.data() + rev_origin;
+    std::uint8_t* fwd_out = fwd_begin;
+    std::uint8_t* rev_out = rev_begin;
+
+    const __m512i reverse_lanes = _mm512_load_si512(avx512_reverse_lanes);
+    const __m512i scale_bits = _mm512_set1_epi32(std::int32_t(ctx.stats.scale_bits()));
+    const __m512i renormalization_shift = _mm512_set1_epi32(std::int32_t(2 * statistics::word_L_bits - ctx.stats.scale_bits()));
+    __m512i fwd = _mm512_permutexvar_epi32(reverse_lanes, _mm512_loadu_si512(ctx.state));
+    __m512i rev = _mm512_permutexvar_epi32(reverse_lanes, _mm512_loadu_si512(ctx.state + (avx512_lanes / 2)));
+
+    // Process the remaining chunks
+    while(k != 0) {
+        k -= avx512_lanes;
+        fwd = avx512_encode_step<true>(fwd, ctx.src + k, ctx.stats, scale_bits, renormalization_shift, fwd_out);
+        rev = avx512_encode_step<false>(rev, ctx.src + k + (avx512_lanes / 2), ctx.stats, scale_bits, renormalization_shift, rev_out);
+    }
+
+    _mm512_storeu_si512(ctx.state, _mm512_permutexvar_epi32(reverse_lanes, fwd));
+    _mm512_storeu_si512(ctx.state + (avx512_lanes / 2), _mm512_permutexvar_epi32(reverse_lanes, rev));
+    ctx.fwd.resize(fwd_origin + std::size_t(fwd_out - fwd_begin));
+    ctx.rev.resize(rev_origin + std::size_t(rev_out - rev_begin));
+
+    flush(ctx);
+    ctx.ec = error_code::ok;
+}
+
+IGUANA_TARGET_AVX512 void iguana::ans32::decoder::decompress_avx512(context& ctx) {
+    const std::uint8_t* const src = ctx.src.data();
+    const std::size_t src_len = ctx.src.size();
+
+    if (src_len < 2 * avx512_state_bytes) {
+        ctx.ec = error_code::corrupted_bitstream;
+        return;
+    }
+
+    std::size_t cursor_fwd = avx512_state_bytes;
+    std::size_t cursor_rev = src_len - avx512_state_bytes;
+
+    __m512i fwd = _mm512_loadu_si512(src);
+    __m512i rev = _mm512_loadu_si512(src + cursor_rev);
+
+    const std::size_t dst_origin = ctx.dst.size();
+    ctx.dst.resize(dst_origin + ctx.result_size);
+    std::uint8_t* out = ctx.dst.data() + dst_origin;
+    std::uint8_t* const out_end = out + ctx.result_size;
+
+    const __m512i word_L = _mm512_set1_epi32(statistics::word_L);
+    const __m512i reverse_words = _mm512_load_si512(avx512_reverse_lanes);
+    const __m512i scale_bits = _mm512_set1_epi32(std::int32_t(ctx.tab.word_M_bits));
+    const __m512i mask_M = _mm512_set1_epi32(std::int32_t((std::uint32_t(1) << ctx.tab.word_M_bits) - 1));
+    const __m512i bias_shift = _mm512_set1_epi32(std::int32_t(ctx.tab.bias_shift));
+    const __m512i mask_F = _mm512_set1_epi32(std::int32_t((std::uint32_t(1) << ctx.tab.bias_shift) - 1));
+    const bool wide = (ctx.tab.word_M_bits > statistics::compact_word_M_bits);
+
+    // The cursors stay within [avx512_state_bytes, src_len - avx512_state_bytes] and the forward one
+    // never passes the reverse one, so the 32-byte loads at both of them are within the stream
+    while(std::size_t(out_end - out) >= avx512_lanes) {
+        fwd = avx512_decode_step(fwd, ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide, out);
+        rev = avx512_decode_step(rev, ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide, out + (avx512_lanes / 2));
+        out += avx512_lanes;
+
+        const __mmask16 m_fwd = _mm512_cmplt_epu32_mask(fwd, word_L);
+        const __mmask16 m_rev = _mm512_cmplt_epu32_mask(rev, word_L);
+
+        const __m256i words_fwd = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + cursor_fwd));
+        const __m256i words_rev = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + cursor_rev - 32));
+
+        fwd = avx512_renormalize(fwd, m_fwd, _mm512_cvtepu16_epi32(words_fwd));
+        rev = avx512_renormalize(rev, m_rev, _mm512_permutexvar_epi32(reverse_words, _mm512_cvtepu16_epi32(words_rev)));
+
+        cursor_fwd += 2 * std::size_t(_mm_popcnt_u32(m_fwd));
+        cursor_rev -= 2 * std::size_t(_mm_popcnt_u32(m_rev));
+        if (cursor_fwd > cursor_rev) [[unlikely]] {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+    }
+
+    // The final symbols come from the first lanes, which are not renormalized anymore
+    alignas(64) std::uint32_t state[avx512_lanes];
+    _mm512_store_si512(state, fwd);
+    _mm512_store_si512(state + (avx512_lanes / 2), rev);
+
+    for(std::size_t lane = 0; out != out_end; ++lane) {
+        const std::uint32_t x = state[lane];
+        const auto slot = x & ((std::uint32_t(1) << ctx.tab.word_M_bits) - 1);
+        const auto t = ctx.tab[slot];
+        const auto mask_F = (std::uint32_t(1) << ctx.tab.bias_shift) - 1;
+        const auto freq = std::uint32_t(t & mask_F);
+        const auto bias = std::uint32_t((t >> ctx.tab.bias_shift) & mask_F);
+        state[lane] = freq * (x >> ctx.tab.word_M_bits) + bias;
+        *out++ = ctx.tab.symbols[slot];
+    }
+
+    for(std::size_t i = 0; i != avx512_lanes; ++i) {
+        if (state[i] != statistics::word_L) {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+    }
+
+    ctx.ec = error_code::ok;
+}
+
+#endif
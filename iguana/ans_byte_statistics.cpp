@@ -13,8 +13,11 @@
 //  limitations under the License.
 
 #include <array>
+#include <cmath>
 #include "ans_byte_statistics.h"
 #include "ans_bitstream.h"
+#include "ans_histogram.h"
+#include "ans_normalize.h"
 #include "utils.h"
 #include "error.h"
 
@@ -26,8 +29,12 @@ namespace iguana::ans {
         friend byte_statistics;
 
     private:
+        std::array<std::uint64_t, 256>  m_counts;
         std::array<std::uint64_t, 256>  m_freqs;
         std::array<std::uint64_t, 257>  m_cum_freqs;
+        std::size_t                     m_total = 0;
+        int                             m_first = -1;
+        std::size_t                     m_scale_bits = 0;
 
     public:
         builder() noexcept = default;
@@ -40,30 +47,41 @@ namespace iguana::ans {
         builder& operator =(builder&&) = default;
 
     public:
-        void build(const std::uint8_t *p, std::size_t n) noexcept;
+        void count(const std::uint8_t *p, std::size_t n) noexcept;
+        void build(std::size_t scale_bits) noexcept;
+        std::size_t select_scale_bits(std::size_t max_bits) noexcept;
 
     private:
         void normalize_freqs() noexcept;
         void calc_cum_freqs() noexcept;
         int compute_histogram(const std::uint8_t *p, std::size_t n) noexcept;
+        double coded_size() const noexcept;
     };
 }
 
-void iguana::ans::byte_statistics::builder::build(const std::uint8_t *p, std::size_t n) noexcept {
+void iguana::ans::byte_statistics::builder::count(const std::uint8_t *p, std::size_t n) noexcept {
+    memory::zero(m_counts);
+    m_first = compute_histogram(p, n);
+    m_total = n;
+}
+
+void iguana::ans::byte_statistics::builder::build(std::size_t scale_bits) noexcept {
+    const std::uint64_t M = std::uint64_t(1) << scale_bits;
+    m_scale_bits = scale_bits;
     memory::zero(m_freqs);
     memory::zero(m_cum_freqs);
 
-	if (n == 0) {
+	if (m_total == 0) {
 		// Edge case #1: empty input. Arbitrarily assign probability 1/2 to the last two symbols
 
-        m_freqs[254]     = word_M / 2;
-        m_freqs[255]     = word_M / 2;
-        m_cum_freqs[255] = word_M / 2;
-        m_cum_freqs[256] = word_M;
+        m_freqs[254]     = M / 2;
+        m_freqs[255]     = M / 2;
+        m_cum_freqs[255] = M / 2;
+        m_cum_freqs[256] = M;
 		return;
 	}
 
-	if (const auto non_zero_freq_idx = compute_histogram(p, n); m_freqs[non_zero_freq_idx] == n) {
+	if (m_counts[m_first] == m_total) {
 		// Edge case #2: repetition of a single character.
 		//
 		// The ANS normalized cumulative frequencies by definition must sum up to a power of 2 (=ansWordM)
@@ -79,9 +97,9 @@ void iguana::ans::byte_statistics::builder::build(const std::uint8_t *p, std::si
 		// as no symbol can have the probability of ocurrence equal to 1 -- it will be (ansWordM-1)/ansWordM
 		// in the worst case.
 
-		m_freqs[non_zero_freq_idx] = word_M - 1;
-		for(auto i = non_zero_freq_idx + 1; i != m_freqs.size(); ++i) {
-			m_cum_freqs[i] = word_M - 1;
+		m_freqs[m_first] = M - 1;
+		for(auto i = std::size_t(m_first) + 1; i != m_cum_freqs.size(); ++i) {
+			m_cum_freqs[i] = M - 1;
 		}
 		return;
 	}
@@ -89,53 +107,39 @@ void iguana::ans::byte_statistics::builder::build(const std::uint8_t *p, std::si
 	normalize_freqs();
 }
 
-void iguana::ans::byte_statistics::builder::normalize_freqs() noexcept {
-    calc_cum_freqs();
-	const std::uint64_t target_total = word_M;
-	const std::uint64_t cur_total = m_cum_freqs[256]; // TODO: prefix sum
-
-	// resample distribution based on cumulative freqs
-	for(std::size_t i = 1; i <= 256; ++i) {
-		m_cum_freqs[i] = (target_total * m_cum_freqs[i]) / cur_total;
-	}
-
-	// if we nuked any non-0 frequency symbol to 0, we need to steal
-	// the range to make the frequency nonzero from elsewhere.
-	//
-	// this is not at all optimal, i'm just doing the first thing that comes to mind.
-	for(int i = 0; i != 256; ++i) {
-		if ((m_freqs[i] != 0) && (m_cum_freqs[i+1] == m_cum_freqs[i])) {
-			// symbol i was set to zero freq
-
-			// find best symbol to steal frequency from (try to steal from low-freq ones)
-			auto best_freq = ~std::uint64_t(0);
-			auto best_steal = -1;
-			for(int j = 0; j != 256; ++j) {
-				const auto freq = m_cum_freqs[j+1] - m_cum_freqs[j];
-				if ((freq > 1) && (freq < best_freq)) {
-					best_freq = freq;
-					best_steal = j;
-				}
-			}
+std::size_t iguana::ans::byte_statistics::builder::select_scale_bits(std::size_t max_bits) noexcept {
+    // Going up from the lowest precision worth trying, the ties are settled in favour of the smaller decoding table
+    std::size_t best_bits = (m_total > scale_selection_max_symbols) ? std::min(compact_word_M_bits, max_bits) : min_word_M_bits;
+    build(best_bits);
+    double best_size = coded_size();
+    for(std::size_t bits = best_bits + 1; bits <= max_bits; ++bits) {
+        build(bits);
+        const auto size = coded_size();
+        if ((bits > compact_word_M_bits) ? (size < best_size - best_size / wide_scale_min_gain) : (size < best_size)) {
+            best_bits = bits;
+            best_size = size;
+        }
+    }
+    return best_bits;
+}
 
-			// and steal from it!
-			if (best_steal < i) {
-				for(auto j = best_steal + 1; j <= i; ++j) {
-					--m_cum_freqs[j];
-				}
-			} else {
-				for(auto j = i + 1; j <= best_steal; ++j) {
-					++m_cum_freqs[j];
-				}
-			}
-		}
-	}
+double iguana::ans::byte_statistics::builder::coded_size() const noexcept {
+    // The bits of the symbols, then the nibbles of the frequencies, see serialize
+    double bits = 0;
+    for(std::size_t i = 0; i != m_freqs.size(); ++i) {
+        if (m_counts[i] != 0) {
+            bits += double(m_counts[i]) * (double(m_scale_bits) - std::log2(double(m_freqs[i])));
+        }
+        const auto f = m_freqs[i];
+        bits += (f < 5) ? 0 : (f < 21) ? 4 : (f < 277) ? 8 : (f < 4096) ? 12 : 28;
+    }
+    return bits;
+}
 
-	// calculate updated freqs and make sure we didn't screw anything up
-	for(std::size_t i = 0; i != 256; ++i) {
-		// calc updated freq
-		m_freqs[i] = m_cum_freqs[i+1] - m_cum_freqs[i];
-	}
+void iguana::ans::byte_statistics::builder::normalize_freqs() noexcept {
+    m_freqs = m_counts;
+    normalize_frequencies(m_freqs.data(), m_freqs.size(), std::uint64_t(1) << m_scale_bits);
+    calc_cum_freqs();
 }
 
 void iguana::ans::byte_statistics::builder::calc_cum_freqs() noexcept {
@@ -146,37 +150,15 @@ void iguana::ans::byte_statistics::builder::calc_cum_freqs() noexcept {
 }
 
 int iguana::ans::byte_statistics::builder::compute_histogram(const std::uint8_t *p, std::size_t n) noexcept {
-	// 4-way histogram calculation to compensate for the store-to-load forwarding issues observed here:
-	// https://fastcompression.blogspot.com/2014/09/counting-bytes-fast-little-trick-from.html
-
     if (n == 0) {
         return -1;
     }
 
-	std::uint64_t partial[4][256];
-    memory::zero(partial);
-    auto k = utils::align_down(n, 4);
-
-	for(std::size_t i = 0; i < k; i += 4) {
-		++partial[0][p[i+0]];
-		++partial[1][p[i+1]];
-		++partial[2][p[i+2]];
-		++partial[3][p[i+3]];
-	}
-
-	// Process the remainder
-	for(; k != n; ++k) {
-		++partial[0][p[k]];
-	}
-
-	// Add up all the ways
-	for(std::size_t i = 0; i != 256; ++i) {
-		m_freqs[i] = partial[0][i] + partial[1][i] + partial[2][i] + partial[3][i];
-	}
+	histogram::count_bytes(m_counts, p, n);
 
 	// Find the index of some non-zero freq
 	for(int i = 0; i != 256; ++i) {
-		if (m_freqs[i] != 0) {
+		if (m_counts[i] != 0) {
 			return i;
 		}
 	}
@@ -185,12 +167,34 @@ int iguana::ans::byte_statistics::builder::compute_histogram(const std::uint8_t
 }
 
 void iguana::ans::byte_statistics::compute(const std::uint8_t *p, std::size_t n) noexcept {
+    compute_within(p, n, max_word_M_bits);
+}
+
+void iguana::ans::byte_statistics::compute_within(const std::uint8_t *p, std::size_t n, std::size_t max_scale_bits) noexcept {
+    assert((max_scale_bits >= min_word_M_bits) && (max_scale_bits <= max_word_M_bits));
+
+    builder bld;
+    bld.count(p, n);
+    if (const auto bits = bld.select_scale_bits(max_scale_bits); bits != bld.m_scale_bits) {
+        bld.build(bits);
+    }
+    store(bld);
+}
+
+void iguana::ans::byte_statistics::compute(const std::uint8_t *p, std::size_t n, std::size_t scale_bits) noexcept {
+    assert((scale_bits >= min_word_M_bits) && (scale_bits <= max_word_M_bits));
+
     builder bld;
-    bld.build(p, n);
+    bld.count(p, n);
+    bld.build(scale_bits);
+    store(bld);
+}
 
+void iguana::ans::byte_statistics::store(const builder& bld) noexcept {
 	for(std::size_t i = 0; i != 256; ++i) {
 		m_table[i] = (bld.m_cum_freqs[i] << cumulative_frequency_bits) | bld.m_freqs[i];
 	}
+    m_scale_bits = std::uint32_t(bld.m_scale_bits);
 }
 
 void iguana::ans::byte_statistics::serialize(output_stream& s) const {
@@ -207,7 +211,7 @@ void iguana::ans::byte_statistics::serialize(output_stream& s) const {
 		// 100 => 4
 		// 101 => one nibble f - 5
 		// 110 => two nibbles f - 21
-		// 111 => three nibbles f - 277
+		// 111 => three nibbles f - 277, or 0xfff and four nibbles f above 4095
 
 		if (f < 5) {
 			ctrl.append(f, 3);
@@ -217,9 +221,13 @@ void iguana::ans::byte_statistics::serialize(output_stream& s) const {
 		} else if (f < 277) {
 			ctrl.append(0b110, 3);
 			data.append(f-21, 8);
-		} else {
+		} else if (f < 4096) {
 			ctrl.append(0b111, 3);
 			data.append(f-277, 12);
+		} else {
+			ctrl.append(0b111, 3);
+			data.append(0xfff, 12);
+			data.append(f, 16);
 		}
 	}
 
@@ -254,11 +262,19 @@ void iguana::ans::byte_statistics::deserialize(input_stream& s) {
 			x >>= 3;
 			switch(v) {
 			case 0b111: {
-				// Three nibbles f - 277
+				// Three nibbles f - 277, 0xfff being followed by four nibbles f
                 const auto x0 = fetch_nibble(s, nibidx);
                 const auto x1 = fetch_nibble(s, nibidx);
                 const auto x2 = fetch_nibble(s, nibidx);
-				m_table[k] = (x0 | (x1 << 4) | (x2 << 8)) + 277;
+                if (const auto v = x0 | (x1 << 4) | (x2 << 8); v != 0xfff) {
+                    m_table[k] = v + 277;
+                } else {
+                    const auto y0 = fetch_nibble(s, nibidx);
+                    const auto y1 = fetch_nibble(s, nibidx);
+                    const auto y2 = fetch_nibble(s, nibidx);
+                    const auto y3 = fetch_nibble(s, nibidx);
+                    m_table[k] = y0 | (y1 << 4) | (y2 << 8) | (y3 << 12);
+                }
             } break;
 
 			case 0b110: {
@@ -283,21 +299,47 @@ void iguana::ans::byte_statistics::deserialize(input_stream& s) {
 	}
 
     s.set_end(s.data() + ((nibidx + 1) >> 1));
+
+    // The sum of the frequencies tells their precision apart, see builder::build
+    std::uint32_t sum = 0;
+    for(const auto f : m_table) {
+        sum += f;
+    }
+    for(m_scale_bits = min_word_M_bits; m_scale_bits <= max_word_M_bits; ++m_scale_bits) {
+        if ((sum == (std::uint32_t(1) << m_scale_bits)) || (sum == (std::uint32_t(1) << m_scale_bits) - 1)) {
+            return;
+        }
+    }
+    throw corrupted_bitstream_exception("invalid ANS frequencies");
 }
 
 void iguana::ans::byte_statistics::build_decoding_table(decoding_table& tab) const noexcept {
 	// The normalized frequencies have been recovered. Fill the decoding table accordingly.
+    const bool compact = (m_scale_bits <= compact_word_M_bits);
+    tab.word_M_bits = m_scale_bits;
+    tab.bias_shift = compact ? compact_word_M_bits : frequency_bits;
     std::uint64_t start = 0;
     for(std::uint64_t sym = 0; sym != 256; ++sym) {
         const auto freq = m_table[sym];
+        const auto top = compact ? (sym << 24) : 0;
         for(std::uint64_t i = 0; i < freq; ++i) {
             const auto slot = start + i;
-            tab[slot] = (sym << 24) | (i << word_M_bits) | freq;
+            tab.slots[slot] = std::uint32_t(top | (i << tab.bias_shift) | freq);
+            tab.symbols[slot] = std::uint8_t(sym);
         }
         start += freq;
     }
 }
 
+void iguana::ans::byte_statistics::build_encoding_table(encoding_table& tab) const noexcept {
+    for(std::size_t sym = 0; sym != 256; ++sym) {
+        const auto q = m_table[sym];
+        const auto freq = q & frequency_mask;
+        const auto start = (q >> frequency_bits) & cumulative_frequency_mask;
+        tab[sym].init(start, freq, m_scale_bits, word_L_bits, word_L);
+    }
+}
+
 std::uint32_t iguana::ans::byte_statistics::fetch_nibble(input_stream& s, ssize_t& idx) {
 	if (idx < 0) {
 		throw out_of_input_data_exception();
@@ -19,6 +19,7 @@
 #include "memops.h"
 #include "input_stream.h"
 #include "output_stream.h"
+#include "ans_encoding_symbol.h"
 
 namespace iguana::ans {
 
@@ -30,29 +31,60 @@ namespace iguana::ans {
 
         //
 
-        constexpr inline static std::size_t   word_M_bits = 12;
+        // The frequencies sum up to 1 << scale_bits() for any precision in between. The table fields are
+        // sized for the highest one.
+        constexpr inline static std::size_t   min_word_M_bits = 10;
+        constexpr inline static std::size_t   max_word_M_bits = 15;
+        constexpr inline static std::size_t   word_M_bits = max_word_M_bits;
         constexpr inline static std::size_t   word_L_bits = 16;
         constexpr inline static std::uint32_t word_L = std::uint32_t(1) << word_L_bits;
         constexpr inline static std::uint32_t word_M = std::uint32_t(1) << word_M_bits;
 
+        // Up to that precision the decoding table stays within the L1 cache. The higher ones are only picked when
+        // they save more than 1 / wide_scale_min_gain of the coded size, which takes very skewed data.
+        constexpr inline static std::size_t compact_word_M_bits = 12;
+        constexpr inline static double      wide_scale_min_gain = 64;
+
+        // Above that many symbols, the tables are too small a part of the stream for a precision below the compact
+        // one to pay off
+        constexpr inline static std::size_t scale_selection_max_symbols = std::size_t(4) << compact_word_M_bits;
+
         //
 
+        // A frequency above 4095 takes the 0xfff escape of a 3-nibble group and 4 more nibbles. As they sum up to
+        // 1 << max_word_M_bits at most, no more than 8 frequencies do.
         constexpr inline static std::size_t ctrl_block_size         = 96;
-        constexpr inline static std::size_t nibble_block_max_length = 384; // 256 3-nibble groups
+        constexpr inline static std::size_t nibble_block_max_length = 384 + 16; // 256 3-nibble groups, 8 escapes
         constexpr inline static std::size_t dense_table_max_length  = ctrl_block_size + nibble_block_max_length;
 
         //
 
-        constexpr inline static std::uint32_t frequency_bits = word_M_bits;
+        constexpr inline static std::uint32_t frequency_bits = 16;
         constexpr inline static std::uint32_t frequency_mask = (1 << frequency_bits) - 1;
-        constexpr inline static std::uint32_t cumulative_frequency_bits = word_M_bits;
+        constexpr inline static std::uint32_t cumulative_frequency_bits = 16;
         constexpr inline static std::uint32_t cumulative_frequency_mask = (1 << cumulative_frequency_bits) - 1;
 
     public:
-        using decoding_table = std::uint32_t[word_M];
+        // Only the first 1 << word_M_bits slots are used. A slot holds the frequency, and the bias shifted by
+        // bias_shift. Up to the compact precision they leave the top byte to the symbol, which saves the vector
+        // decoders a lookup. Above, the symbol is only found in symbols, which is filled at every precision and
+        // followed by 3 bytes of padding for the 32-bit gathers of the vector decoders.
+        struct decoding_table final {
+            std::uint32_t   word_M_bits;
+            std::uint32_t   bias_shift;
+            std::uint32_t   slots[word_M];
+            std::uint8_t    symbols[word_M + 3];
+
+            std::uint32_t operator [](std::size_t k) const noexcept {
+                return slots[k];
+            }
+        };
+
+        using encoding_table = encoding_symbol[256];
 
     public:
         std::array<std::uint32_t, 256> m_table;
+        std::uint32_t                  m_scale_bits = word_M_bits;
 
     public:
         byte_statistics() noexcept {
@@ -83,20 +115,33 @@ namespace iguana::ans {
             return m_table[k];
         }
 
+        std::size_t scale_bits() const noexcept {
+            return m_scale_bits;
+        }
+
     public:
+        // Picks the precision: the lower ones are cheaper to decode and to store, which pays off on the small blocks,
+        // the higher ones on the very skewed data
         void compute(const std::uint8_t *p, std::size_t n) noexcept;
+        void compute(const std::uint8_t *p, std::size_t n, std::size_t scale_bits) noexcept;
 
         void compute(const_byte_span s) noexcept {
             return compute(s.data(), s.size());
         }
 
         void build_decoding_table(decoding_table& tab) const noexcept;
+        void build_encoding_table(encoding_table& tab) const noexcept;
 
     public:
         void serialize(output_stream& s) const;
         void deserialize(input_stream& s);
 
+    protected:
+        // Picks the precision up to max_scale_bits, for the tables that are sized for less
+        void compute_within(const std::uint8_t *p, std::size_t n, std::size_t max_scale_bits) noexcept;
+
     private:
+        void store(const builder& bld) noexcept;
         static std::uint32_t fetch_nibble(input_stream& s, ssize_t& nibidx);
     };
 }
@@ -0,0 +1,61 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include "common.h"
+#if defined(IGUANA_COMPILER_MSVC)
+    #include <intrin.h>
+
+    //
+
+    #pragma intrinsic(__umulh)
+#endif
+
+namespace iguana::ans {
+
+    // The precomputed parameters for encoding a symbol, after RansEncSymbol of ryg_rans. The division of the state
+    // by the frequency is replaced by a multiplication with the 64-bit reciprocal of the frequency, whose high half
+    // is the exact quotient for every 32-bit state, so no shift is needed.
+    struct encoding_symbol final {
+        std::uint64_t rcp_freq;
+        std::uint32_t x_max;
+        std::uint32_t bias;
+        std::uint32_t cmpl_freq;
+
+        void init(std::uint32_t start, std::uint32_t freq, std::uint32_t scale_bits, std::uint32_t renorm_bits, std::uint32_t word_L) noexcept {
+            x_max = ((word_L >> scale_bits) << renorm_bits) * freq;
+            cmpl_freq = (std::uint32_t(1) << scale_bits) - freq;
+            if (freq < 2) {
+                // x / 1 is one more than the high half of x * (2^64 - 1), which the bias makes up for
+                rcp_freq = ~std::uint64_t(0);
+                bias = start + (std::uint32_t(1) << scale_bits) - 1;
+            } else {
+                rcp_freq = (~std::uint64_t(0) / freq) + 1;
+                bias = start;
+            }
+        }
+
+        // x = C(s,x), the state has been renormalized below x_max
+        std::uint32_t encode(std::uint32_t x) const noexcept {
+        #if defined(IGUANA_COMPILER_MSVC)
+            const auto q = std::uint32_t(__umulh(x, rcp_freq));
+        #elif defined(IGUANA_COMPILER_GNU) || defined(IGUANA_COMPILER_CLANG)
+            const auto q = std::uint32_t((static_cast<unsigned __int128>(x) * rcp_freq) >> 64);
+        #else
+            #error Unsupported compiler
+        #endif
+            return x + bias + q * cmpl_freq;
+        }
+    };
+}
@@ -0,0 +1,117 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include "ans_histogram.h"
+#include "memops.h"
+#include "utils.h"
+
+//
+
+namespace iguana::ans {
+    const cpu::kernel_table<histogram::kernel_function> histogram::g_Kernels = {
+        &histogram::count_nibbles_portable,
+#if defined(IGUANA_PROCESSOR_X64)
+        nullptr,
+        &histogram::count_nibbles_avx512
+#endif
+    };
+    cpu::kernel_dispatch<histogram::kernel_function> histogram::g_CountNibbles("histogram", g_Kernels);
+    const internal::initializer<histogram> histogram::g_Initializer;
+
+    namespace {
+        // Every way counts at most 1/8 of a round, so its 32-bit counters cannot overflow
+        constexpr const std::size_t histogram_ways = 8;
+        constexpr const std::size_t histogram_round_size = std::size_t(1) << 30;
+    }
+}
+
+//
+
+void iguana::ans::histogram::count_bytes(byte_counts& freqs, const std::uint8_t* p, std::size_t n) noexcept {
+    // 8-way histogram calculation to compensate for the store-to-load forwarding issues observed here:
+    // https://fastcompression.blogspot.com/2014/09/counting-bytes-fast-little-trick-from.html
+    //
+    // The input is loaded 8 bytes at a time, and the 32-bit counters keep the partial tables within 8 KiB.
+
+    std::uint32_t partial[histogram_ways][256];
+    memory::zero(partial);
+    memory::zero(freqs);
+
+    while(n != 0) {
+        const auto m = std::min(n, histogram_round_size);
+        const auto k = utils::align_down(m, 16);
+        std::size_t i = 0;
+
+        for(; i != k; i += 16) {
+            const auto a = utils::read_little_endian<std::uint64_t>(p + i);
+            const auto b = utils::read_little_endian<std::uint64_t>(p + i + 8);
+
+            ++partial[0][std::uint8_t(a)];
+            ++partial[1][std::uint8_t(a >> 8)];
+            ++partial[2][std::uint8_t(a >> 16)];
+            ++partial[3][std::uint8_t(a >> 24)];
+            ++partial[4][std::uint8_t(a >> 32)];
+            ++partial[5][std::uint8_t(a >> 40)];
+            ++partial[6][std::uint8_t(a >> 48)];
+            ++partial[7][std::uint8_t(a >> 56)];
+            ++partial[0][std::uint8_t(b)];
+            ++partial[1][std::uint8_t(b >> 8)];
+            ++partial[2][std::uint8_t(b >> 16)];
+            ++partial[3][std::uint8_t(b >> 24)];
+            ++partial[4][std::uint8_t(b >> 32)];
+            ++partial[5][std::uint8_t(b >> 40)];
+            ++partial[6][std::uint8_t(b >> 48)];
+            ++partial[7][std::uint8_t(b >> 56)];
+        }
+
+        // Process the remainder
+        for(; i != m; ++i) {
+            ++partial[0][p[i]];
+        }
+
+        // Add up all the ways, then clear them for the next round
+        for(std::size_t s = 0; s != 256; ++s) {
+            std::uint64_t total = 0;
+            for(std::size_t w = 0; w != histogram_ways; ++w) {
+                total += partial[w][s];
+                partial[w][s] = 0;
+            }
+            freqs[s] += total;
+        }
+
+        p += m;
+        n -= m;
+    }
+}
+
+void iguana::ans::histogram::count_nibbles_portable(nibble_counts& freqs, const std::uint8_t* p, std::size_t n) noexcept {
+    // Counting the bytes and folding their counts is cheaper than indexing the tables twice per byte
+    byte_counts bytes;
+    count_bytes(bytes, p, n);
+
+    memory::zero(freqs);
+    for(std::size_t s = 0; s != 256; ++s) {
+        freqs[s & 0x0f] += bytes[s];
+        freqs[s >> 4] += bytes[s];
+    }
+}
+
+void iguana::ans::histogram::at_process_start() {
+    g_CountNibbles.select();
+}
+
+void iguana::ans::histogram::at_process_end() {}
@@ -0,0 +1,72 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include <array>
+#include "common.h"
+#include "cpu.h"
+
+namespace iguana::ans {
+
+    // The symbol counts the byte and nibble statistics are normalized from. Every encode_entropy trial makes
+    // an extra pass over its data to count them, so the pass should run close to the memory bandwidth.
+    class IGUANA_API histogram final {
+        friend internal::initializer<histogram>;
+
+    public:
+        using byte_counts = std::array<std::uint64_t, 256>;
+        using nibble_counts = std::array<std::uint64_t, 16>;
+
+    private:
+        using kernel_function = void (*)(nibble_counts& freqs, const std::uint8_t* p, std::size_t n);
+
+        static const cpu::kernel_table<kernel_function> g_Kernels;
+        static cpu::kernel_dispatch<kernel_function> g_CountNibbles;
+        static const internal::initializer<histogram> g_Initializer;
+
+    public:
+        histogram() = delete;
+
+    public:
+        // Overwrites freqs with the number of occurrences of every byte value
+        static void count_bytes(byte_counts& freqs, const std::uint8_t* p, std::size_t n) noexcept;
+
+        // Overwrites freqs with the number of occurrences of every nibble value, counting both nibbles of every byte
+        static void count_nibbles(nibble_counts& freqs, const std::uint8_t* p, std::size_t n) noexcept {
+            g_CountNibbles(freqs, p, n);
+        }
+
+        // The kernel is shared by all the statistics builders, and must not be changed while any of them is running
+        static kernel get_kernel() noexcept {
+            return g_CountNibbles.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_CountNibbles.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_CountNibbles.set(k);
+        }
+
+    private:
+        static void count_nibbles_portable(nibble_counts& freqs, const std::uint8_t* p, std::size_t n) noexcept;
+#if defined(IGUANA_PROCESSOR_X64)
+        static void count_nibbles_avx512(nibble_counts& freqs, const std::uint8_t* p, std::size_t n) noexcept;
+#endif
+        static void at_process_start();
+        static void at_process_end();
+    };
+}
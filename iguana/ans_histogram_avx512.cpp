@@ -0,0 +1,53 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "common.h"
+
+#if defined(IGUANA_PROCESSOR_X64)
+#include <immintrin.h>
+#include "ans_histogram.h"
+#include "memops.h"
+
+// The AVX-512 nibble histogram splits 64 bytes into their lower and upper nibbles and compares both against each
+// of the 16 values. The population counts of the comparison masks are added up in general purpose registers, so
+// there are no table updates to serialize on repeated values.
+
+IGUANA_TARGET_AVX512 void iguana::ans::histogram::count_nibbles_avx512(nibble_counts& freqs, const std::uint8_t* p, std::size_t n) noexcept {
+    const __m512i nibble_mask = _mm512_set1_epi8(0x0f);
+    std::uint64_t counts[16] = {};
+    std::size_t i = 0;
+
+    for(; i + 64 <= n; i += 64) {
+        const __m512i v = _mm512_loadu_si512(p + i);
+        const __m512i lo = _mm512_and_si512(v, nibble_mask);
+        const __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble_mask);
+
+        for(int s = 0; s != 16; ++s) {
+            const __m512i c = _mm512_set1_epi8(char(s));
+            counts[s] += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(lo, c)) + _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(hi, c));
+        }
+    }
+
+    // Process the remainder
+    for(; i != n; ++i) {
+        ++counts[p[i] & 0x0f];
+        ++counts[p[i] >> 4];
+    }
+
+    for(std::size_t s = 0; s != 16; ++s) {
+        freqs[s] = counts[s];
+    }
+}
+
+#endif
@@ -12,76 +12,120 @@
 //  See the License for the specific language governing permissions and
 //  limitations under the License.
 
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include "ans_nibble.h"
 #include "utils.h"
 
 //
 
 namespace iguana::ans_nibble {
-    void (*encoder::g_Compress)(context& ctx) = &encoder::compress_portable;
-    const internal::initializer<encoder> encoder::g_Initializer;
+    namespace {
+        // The names of the interleaved coders, for the error messages
+        template <
+            std::size_t N_STATES
+        > constexpr const char* ans_nibble_encoder_name = (N_STATES == 1) ? "ans_nibble encoder" : "ans_nibble2 encoder";
 
-    void (*decoder::g_Decompress)(context& ctx) = &decoder::decompress_portable;
-    const internal::initializer<decoder> decoder::g_Initializer;
+        template <
+            std::size_t N_STATES
+        > constexpr const char* ans_nibble_decoder_name = (N_STATES == 1) ? "ans_nibble decoder" : "ans_nibble2 decoder";
+    }
+
+    template <std::size_t N_STATES> const cpu::kernel_table<typename interleaved_encoder<N_STATES>::kernel_function> interleaved_encoder<N_STATES>::g_Kernels = { &interleaved_encoder<N_STATES>::compress_portable };
+    template <std::size_t N_STATES> cpu::kernel_dispatch<typename interleaved_encoder<N_STATES>::kernel_function> interleaved_encoder<N_STATES>::g_Compress(ans_nibble_encoder_name<N_STATES>, g_Kernels);
+    template <std::size_t N_STATES> const internal::initializer<interleaved_encoder<N_STATES>> interleaved_encoder<N_STATES>::g_Initializer;
+
+    template <std::size_t N_STATES> const cpu::kernel_table<typename interleaved_decoder<N_STATES>::kernel_function> interleaved_decoder<N_STATES>::g_Kernels = { &interleaved_decoder<N_STATES>::decompress_portable };
+    template <std::size_t N_STATES> cpu::kernel_dispatch<typename interleaved_decoder<N_STATES>::kernel_function> interleaved_decoder<N_STATES>::g_Decompress(ans_nibble_decoder_name<N_STATES>, g_Kernels);
+    template <std::size_t N_STATES> const internal::initializer<interleaved_decoder<N_STATES>> interleaved_decoder<N_STATES>::g_Initializer;
 }
 
-iguana::ans_nibble::encoder::~encoder() noexcept {}
+template <
+    std::size_t N_STATES
+> iguana::ans_nibble::interleaved_encoder<N_STATES>::~interleaved_encoder() noexcept {}
 
-void iguana::ans_nibble::encoder::encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len) {
-    context ctx { .dst = dst, .stats = stats, .src = src, .src_len = src_len };
+template <
+    std::size_t N_STATES
+> void iguana::ans_nibble::interleaved_encoder<N_STATES>::encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len) {
+    typename statistics::encoding_table tab;
+    stats.build_encoding_table(tab);
+    context ctx { .dst = dst, .stats = stats, .tab = tab, .src = src, .src_len = src_len };
     g_Compress(ctx);
 
     if (ctx.ec != error_code::ok) {
         exception::from_error(ctx.ec);
     }
     dst.reserve_more(statistics::dense_table_max_length);
+    stats.serialize(dst);
 }
 
-void iguana::ans_nibble::encoder::compress_portable(context& ctx) {
-    std::uint32_t state = statistics::word_L;
-
-	for(auto *p = ctx.src + ctx.src_len; p > ctx.src;) {
-        const std::uint8_t v = *--p;
-        
-        // Process the upper nibble
-        {   const std::uint32_t q = ctx.stats[v >> 4];
-	        const auto freq = q & statistics::frequency_mask;
-	        const auto start = (q >> statistics::frequency_bits) & statistics::cumulative_frequency_mask;
-            // renormalize
-            std::uint32_t x = state;
-            if (x >= ((statistics::word_L >> statistics::word_M_bits) << statistics::word_L_bits) * freq) {
-                ctx.dst.append_little_endian(static_cast<std::uint16_t>(x));
-                x >>= statistics::word_L_bits;
-            }
-            // x = C(s,x)
-            state = ((x / freq) << statistics::word_M_bits) + (x % freq) + start;
+template <
+    std::size_t N_STATES
+> void iguana::ans_nibble::interleaved_encoder<N_STATES>::compress_portable(context& ctx) {
+    // The lower nibble of the i-th byte goes to the state (2 * i) % N_STATES, the upper one to the next state
+    std::uint32_t states[N_STATES];
+    std::fill_n(states, N_STATES, statistics::word_L);
+
+    const auto put = [&](std::uint32_t& state, std::uint8_t nibble) {
+        const auto& sym = ctx.tab[nibble];
+        // renormalize
+        std::uint32_t x = state;
+        if (x >= sym.x_max) {
+            ctx.dst.append_little_endian(static_cast<std::uint16_t>(x));
+            x >>= statistics::word_L_bits;
         }
+        // x = C(s,x)
+        state = sym.encode(x);
+    };
 
-        // Process the lower nibble
-        {   const std::uint32_t q = ctx.stats[v & 0x0f];
-	        const auto freq = q & statistics::frequency_mask;
-	        const auto start = (q >> statistics::frequency_bits) & statistics::cumulative_frequency_mask;
-            // renormalize
-            std::uint32_t x = state;
-            if (x >= ((statistics::word_L >> statistics::word_M_bits) << statistics::word_L_bits) * freq) {
-                ctx.dst.append_little_endian(static_cast<std::uint16_t>(x));
-                x >>= statistics::word_L_bits;
-            }
-            // x = C(s,x)
-            state = ((x / freq) << statistics::word_M_bits) + (x % freq) + start;
+    // The bytes are coded backwards, starting with the incomplete round at the end; a round takes every state once
+    constexpr const std::size_t round_size = (N_STATES + 1) / 2;
+    const auto put_byte = [&](std::size_t i, std::size_t b) {
+        const std::uint8_t v = ctx.src[i];
+        put(states[(2 * b + 1) % N_STATES], v >> 4);
+        put(states[(2 * b) % N_STATES], v & 0x0f);
+    };
+
+    const auto round_end = ctx.src_len - (ctx.src_len % round_size);
+    for(auto i = ctx.src_len; i != round_end;) {
+        --i;
+        put_byte(i, i - round_end);
+    }
+
+    for(auto i = round_end; i != 0;) {
+        i -= round_size;
+        for(auto b = round_size; b != 0;) {
+            --b;
+            put_byte(i + b, b);
         }
-	}
-    ctx.dst.append_little_endian(state);
-	ctx.ec = error_code::ok;
+    }
+
+    // The state of the first nibble comes last
+    for(auto j = N_STATES; j != 0;) {
+        ctx.dst.append_little_endian(states[--j]);
+    }
+    ctx.ec = error_code::ok;
 }
 
-void iguana::ans_nibble::encoder::at_process_start() {}
+template <
+    std::size_t N_STATES
+> void iguana::ans_nibble::interleaved_encoder<N_STATES>::at_process_start() {
+    g_Compress.select();
+}
 
-void iguana::ans_nibble::encoder::at_process_end() {}
+template <
+    std::size_t N_STATES
+> void iguana::ans_nibble::interleaved_encoder<N_STATES>::at_process_end() {}
 
-iguana::ans_nibble::decoder::~decoder() noexcept {}
+template <
+    std::size_t N_STATES
+> iguana::ans_nibble::interleaved_decoder<N_STATES>::~interleaved_decoder() noexcept {}
 
-void iguana::ans_nibble::decoder::decode(output_stream& dst, std::size_t result_size, input_stream& src, const statistics::decoding_table& tab) {
+template <
+    std::size_t N_STATES
+> void iguana::ans_nibble::interleaved_decoder<N_STATES>::decode(output_stream& dst, std::size_t result_size, input_stream& src, const typename statistics::decoding_table& tab) {
     dst.reserve_more(result_size);
     context ctx{ .dst = dst, .result_size = result_size, .src = src, .tab = tab };
     g_Decompress(ctx);
@@ -89,72 +133,124 @@ void iguana::ans_nibble::decoder::decode(output_stream& dst, std::size_t result_
     if (ctx.ec != error_code::ok) {
         exception::from_error(ctx.ec);
     }
-}        
+}
 
-void iguana::ans_nibble::decoder::decompress_portable(context& ctx) {
-	const auto src_len = ctx.src.size();
+template <
+    std::size_t N_STATES
+> void iguana::ans_nibble::interleaved_decoder<N_STATES>::decompress_portable(context& ctx) {
+    const auto src_len = ctx.src.size();
 
-	if (src_len < 4) {
-		ctx.ec = error_code::wrong_source_size;
+    if (src_len < 4 * N_STATES) {
+        ctx.ec = error_code::wrong_source_size;
         return;
-	}
+    }
 
     const std::uint8_t* const src = ctx.src.data();
-	auto state = utils::read_little_endian<std::uint32_t>(src + src_len - 4);
-	auto cursor_src = src_len - 6;
+    std::uint32_t states[N_STATES];
+    for(std::size_t j = 0; j != N_STATES; ++j) {
+        states[j] = utils::read_little_endian<std::uint32_t>(src + src_len - 4 * (j + 1));
+    }
+    auto cursor_src = src_len - 4 * N_STATES;
+
+    const std::uint32_t* const tab = ctx.tab.slots;
+    const std::uint8_t* const symbols = ctx.tab.symbols;
+    const std::uint32_t scale_bits = ctx.tab.word_M_bits;
+    const std::uint32_t mask_M = (std::uint32_t(1) << scale_bits) - 1;
+    const std::uint32_t bias_shift = ctx.tab.bias_shift;
+    const std::uint32_t mask_F = (std::uint32_t(1) << bias_shift) - 1;
+    const auto origin = ctx.dst.size();
+    ctx.dst.resize(origin + ctx.result_size);
+    auto* const dst = ctx.dst.data() + origin;
+
+    const auto get = [&](std::uint32_t x, std::uint32_t& nibble) {
+        const auto slot = x & mask_M;
+        const std::uint32_t t = tab[slot];
+        const std::uint32_t freq = t & mask_F;
+        const std::uint32_t bias = (t >> bias_shift) & mask_F;
+        // s, x = D(x)
+        nibble = symbols[slot];
+        return freq * (x >> scale_bits) + bias;
+    };
+
+    const auto get_checked = [&](std::uint32_t& state, std::uint32_t& nibble) {
+        const std::uint32_t y = get(state, nibble);
+        // Normalize
+        if (y < statistics::word_L) {
+            if (cursor_src < 2) {
+                return false;
+            }
+            cursor_src -= 2;
+            state = (y << statistics::word_L_bits) | static_cast<std::uint32_t>(utils::read_little_endian<std::uint16_t>(src + cursor_src));
+        } else {
+            state = y;
+        }
+        return true;
+    };
+
+    // A round takes every state once, the states of a byte's nibbles only depend on the position of the byte within the round
+    constexpr const std::size_t round_size = (N_STATES + 1) / 2;
     std::size_t cursor_dst = 0;
 
-	for(;;) {
-        // Process the lower nibble
-        std::uint8_t lo_nib;
-		{   std::uint32_t x = state;
-			const auto slot = x & (statistics::word_M - 1);
-			const std::uint32_t t = ctx.tab[slot];
-			const std::uint32_t freq = t & (statistics::word_M - 1);
-			const std::uint32_t bias = (t >> statistics::word_M_bits) & (statistics::word_M - 1);
-			// s, x = D(x)
-			state = freq * (x >> statistics::word_M_bits) + bias;
-            lo_nib = static_cast<std::uint8_t>(t >> 24);
-			// Normalize
-			if (const std::uint32_t y = state; y < statistics::word_L) {
-				const auto z = utils::read_little_endian<std::uint16_t>(src + cursor_src);
-				cursor_src -= 2;
-				state = (y << statistics::word_L_bits) | static_cast<std::uint32_t>(z);
-			}
-		}
-
-        // Process the upper nibble
-        std::uint8_t hi_nib;
-		{   std::uint32_t x = state;
-			const auto slot = x & (statistics::word_M - 1);
-			const std::uint32_t t = ctx.tab[slot];
-			const std::uint32_t freq = t & (statistics::word_M - 1);
-			const std::uint32_t bias = (t >> statistics::word_M_bits) & (statistics::word_M - 1);
-			// s, x = D(x)
-			state = freq * (x >> statistics::word_M_bits) + bias;
-            hi_nib = static_cast<std::uint8_t>(t >> 24);
-			// Normalize
-			if (const std::uint32_t y = state; y < statistics::word_L) {
-				const auto z = utils::read_little_endian<std::uint16_t>(src + cursor_src);
-				cursor_src -= 2;
-				state = (y << statistics::word_L_bits) | static_cast<std::uint32_t>(z);
-			}
-		}
-
-        ctx.dst.append((hi_nib << 4) | lo_nib);        
-        if (++cursor_dst >= ctx.result_size) {
-            break;
+    // A single state is better off with a predicted branch, which is off its dependency chain
+    if constexpr (N_STATES > 1) {
+        // Renormalizes without branching, the caller makes sure that the word is there
+        const auto get_unchecked = [&](std::uint32_t& state, std::uint32_t& nibble) {
+            const std::uint32_t y = get(state, nibble);
+            const std::uint32_t z = utils::read_little_endian<std::uint16_t>(src + cursor_src - 2);
+            const std::uint32_t r = (y < statistics::word_L) ? 1 : 0;
+            cursor_src -= 2 * r;
+            state = (y << (statistics::word_L_bits * r)) | (z & (0 - r));
+        };
+
+        // The rounds are unrolled, so that the states can live in registers
+        const auto decode_round = [&]<std::size_t... B>(std::index_sequence<B...>) {
+            ([&] {
+                std::uint32_t lo_nib, hi_nib;
+                get_unchecked(states[(2 * B) % N_STATES], lo_nib);
+                get_unchecked(states[(2 * B + 1) % N_STATES], hi_nib);
+                dst[cursor_dst + B] = static_cast<std::uint8_t>((hi_nib << 4) | lo_nib);
+            }(), ...);
+        };
+
+        // A round consumes at most two words per byte
+        for(const auto round_end = ctx.result_size - (ctx.result_size % round_size); (cursor_dst != round_end) && (cursor_src >= 4 * round_size); cursor_dst += round_size) {
+            decode_round(std::make_index_sequence<round_size>{});
         }
     }
 
-    if (state != statistics::word_L) {
-        ctx.ec = error_code::corrupted_bitstream;
-        return;
+    for(; cursor_dst != ctx.result_size; ++cursor_dst) {
+        const auto b = cursor_dst % round_size;
+        std::uint32_t lo_nib, hi_nib;
+        if (!get_checked(states[(2 * b) % N_STATES], lo_nib) || !get_checked(states[(2 * b + 1) % N_STATES], hi_nib)) {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+        dst[cursor_dst] = static_cast<std::uint8_t>((hi_nib << 4) | lo_nib);
+    }
+
+    for(std::size_t j = 0; j != N_STATES; ++j) {
+        if (states[j] != statistics::word_L) {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
     }
 
-	ctx.ec = error_code::ok;
+    ctx.ec = error_code::ok;
 }
 
-void iguana::ans_nibble::decoder::at_process_start() {}
+template <
+    std::size_t N_STATES
+> void iguana::ans_nibble::interleaved_decoder<N_STATES>::at_process_start() {
+    g_Decompress.select();
+}
+
+template <
+    std::size_t N_STATES
+> void iguana::ans_nibble::interleaved_decoder<N_STATES>::at_process_end() {}
+
+//
 
-void iguana::ans_nibble::decoder::at_process_end() {}
+template class iguana::ans_nibble::interleaved_encoder<1>;
+template class iguana::ans_nibble::interleaved_encoder<2>;
+template class iguana::ans_nibble::interleaved_decoder<1>;
+template class iguana::ans_nibble::interleaved_decoder<2>;
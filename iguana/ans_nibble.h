@@ -18,35 +18,60 @@
 #include "common.h"
 #include "ans_encoder.h"
 #include "ans_decoder.h"
+#include "cpu.h"
 #include "ans_nibble_statistics.h"
 
 //
 
 namespace iguana::ans_nibble {
-
-    class IGUANA_API encoder final : public ans::basic_encoder<encoder, ans::nibble_statistics> {
-        using super = ans::basic_encoder<encoder, ans::nibble_statistics>;
-        friend internal::initializer<encoder>;
+    // Every byte is coded as its lower nibble followed by its upper nibble, and the N_STATES states take the nibbles in
+    // turns; with two states, one of them codes the lower nibbles and the other the upper ones. See ans1::interleaved_encoder
+    template <
+        std::size_t N_STATES
+    > class IGUANA_API interleaved_encoder final : public ans::basic_encoder<interleaved_encoder<N_STATES>, ans::nibble_statistics> {
+        using super = ans::basic_encoder<interleaved_encoder<N_STATES>, ans::nibble_statistics>;
+        friend internal::initializer<interleaved_encoder>;
         struct context;
         
     private:
-        static void (*g_Compress)(context& ctx);
-        static const internal::initializer<encoder> g_Initializer;
+        using kernel_function = void (*)(context& ctx);
+
+        static const cpu::kernel_table<kernel_function> g_Kernels;
+        static cpu::kernel_dispatch<kernel_function> g_Compress;
+        static const internal::initializer<interleaved_encoder> g_Initializer;
 
     public:
-        encoder() noexcept = default;
-        ~encoder() noexcept;
+        using statistics = ans::nibble_statistics;
+        static constexpr const std::size_t states = N_STATES;
 
-        encoder(const encoder&) = delete;
-        encoder& operator =(const encoder&) = delete;
+    public:
+        interleaved_encoder() noexcept = default;
+        ~interleaved_encoder() noexcept;
 
-        encoder(encoder&& v) = default;
-        encoder& operator =(encoder&& v) = default;
+        interleaved_encoder(const interleaved_encoder&) = delete;
+        interleaved_encoder& operator =(const interleaved_encoder&) = delete;
+
+        interleaved_encoder(interleaved_encoder&& v) = default;
+        interleaved_encoder& operator =(interleaved_encoder&& v) = default;
 
     public:
         void encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len);
         using super::encode;
 
+        // The kernel is shared by all the encoders, and must not be changed while any of them is running
+        static kernel get_kernel() noexcept {
+            return g_Compress.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_Compress.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_Compress.set(k);
+        }
+
     private:
         static void compress_portable(context& ctx);
         static void at_process_start();
@@ -55,9 +80,12 @@ namespace iguana::ans_nibble {
 
     //
 
-    struct encoder::context final {
+    template <
+        std::size_t N_STATES
+    > struct interleaved_encoder<N_STATES>::context final {
         output_stream&      dst;
         const statistics&   stats;
+        const statistics::encoding_table& tab;
         const std::uint8_t  *src;
         std::size_t         src_len;
         error_code          ec;
@@ -65,29 +93,52 @@ namespace iguana::ans_nibble {
 
     //
 
-    class IGUANA_API decoder final : public ans::basic_decoder<decoder, ans::nibble_statistics> {
-        using super = ans::basic_decoder<decoder, ans::nibble_statistics>;
-        friend internal::initializer<decoder>;
+    template <
+        std::size_t N_STATES
+    > class IGUANA_API interleaved_decoder final : public ans::basic_decoder<interleaved_decoder<N_STATES>, ans::nibble_statistics> {
+        using super = ans::basic_decoder<interleaved_decoder<N_STATES>, ans::nibble_statistics>;
+        friend internal::initializer<interleaved_decoder>;
         struct context;
 
     private:
-        static void (*g_Decompress)(context& ctx);
-        static const internal::initializer<decoder> g_Initializer;
+        using kernel_function = void (*)(context& ctx);
+
+        static const cpu::kernel_table<kernel_function> g_Kernels;
+        static cpu::kernel_dispatch<kernel_function> g_Decompress;
+        static const internal::initializer<interleaved_decoder> g_Initializer;
+
+    public:
+        using statistics = ans::nibble_statistics;
+        static constexpr const std::size_t states = N_STATES;
 
     public:
-        decoder() {}
-        ~decoder() noexcept;
+        interleaved_decoder() {}
+        ~interleaved_decoder() noexcept;
 
-        decoder(const decoder&) = delete;
-        decoder& operator =(const decoder&) = delete;
+        interleaved_decoder(const interleaved_decoder&) = delete;
+        interleaved_decoder& operator =(const interleaved_decoder&) = delete;
 
-        decoder(decoder&& v) = default;
-        decoder& operator =(decoder&& v) = default;
+        interleaved_decoder(interleaved_decoder&& v) = default;
+        interleaved_decoder& operator =(interleaved_decoder&& v) = default;
 
     public:
         void decode(output_stream& dst, std::size_t result_size, input_stream& src, const statistics::decoding_table& tab);
         using super::decode;
 
+        // The kernel is shared by all the decoders, and must not be changed while any of them is running
+        static kernel get_kernel() noexcept {
+            return g_Decompress.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_Decompress.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_Decompress.set(k);
+        }
+
     private:
         static void decompress_portable(context& ctx);
         static void at_process_start();
@@ -96,11 +147,28 @@ namespace iguana::ans_nibble {
 
     //
 
-    struct decoder::context final {
+    template <
+        std::size_t N_STATES
+    > struct interleaved_decoder<N_STATES>::context final {
         output_stream&                      dst;
         std::size_t                         result_size;
         input_stream&                       src;
         const statistics::decoding_table&   tab;
         error_code                          ec;
     };
+
+    //
+
+    extern template class interleaved_encoder<1>;
+    extern template class interleaved_encoder<2>;
+    extern template class interleaved_decoder<1>;
+    extern template class interleaved_decoder<2>;
+
+    using encoder = interleaved_encoder<1>;
+    using decoder = interleaved_decoder<1>;
+}
+
+namespace iguana::ans_nibble2 {
+    using encoder = ans_nibble::interleaved_encoder<2>;
+    using decoder = ans_nibble::interleaved_decoder<2>;
 }
@@ -0,0 +1,237 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "ans_nibble64.h"
+#include "memops.h"
+#include "utils.h"
+
+//
+
+namespace iguana::ans_nibble64 {
+    const cpu::kernel_table<encoder::kernel_function> encoder::g_Kernels = { &encoder::compress_portable };
+    cpu::kernel_dispatch<encoder::kernel_function> encoder::g_Compress("ans_nibble64 encoder", g_Kernels);
+    const internal::initializer<encoder> encoder::g_Initializer;
+
+    const cpu::kernel_table<decoder::kernel_function> decoder::g_Kernels = {
+        &decoder::decompress_portable,
+#if defined(IGUANA_PROCESSOR_X64)
+        &decoder::decompress_avx2,
+        &decoder::decompress_avx512
+#endif
+    };
+    cpu::kernel_dispatch<decoder::kernel_function> decoder::g_Decompress("ans_nibble64 decoder", g_Kernels);
+    const internal::initializer<decoder> decoder::g_Initializer;
+}
+
+//
+
+iguana::ans_nibble64::encoder::encoder() {
+    m_fwd.reserve(statistics::initial_buffer_size);
+    m_rev.reserve(statistics::initial_buffer_size);
+}
+
+iguana::ans_nibble64::encoder::~encoder() noexcept {}
+
+void iguana::ans_nibble64::encoder::put(context& ctx, const std::uint8_t* p, std::size_t n) {
+	// the lower nibbles, forward
+	for(std::size_t lane = chunk_size; lane-- != 0;) {
+		if (lane < n) {
+			const auto& sym = ctx.tab[p[lane] & 0x0f];
+			// renormalize
+			auto x = ctx.state[lane];
+			if (x >= sym.x_max) {
+				ctx.fwd.append_big_endian(static_cast<std::uint16_t>(x));
+				x >>= statistics::word_L_bits;
+			}
+			// x = C(s,x)
+			ctx.state[lane] = sym.encode(x);
+		}
+	}
+	// the upper nibbles, reverse
+	for(std::size_t lane = chunk_size; lane-- != 0;) {
+		if (lane < n) {
+			const auto& sym = ctx.tab[p[lane] >> 4];
+			// renormalize
+			auto x = ctx.state[chunk_size + lane];
+			if (x >= sym.x_max) {
+				ctx.rev.append_little_endian(static_cast<std::uint16_t>(x));
+				x >>= statistics::word_L_bits;
+			}
+			// x = C(s,x)
+			ctx.state[chunk_size + lane] = sym.encode(x);
+		}
+	}
+}
+
+void iguana::ans_nibble64::encoder::encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len) {
+    m_fwd.clear();
+    m_rev.clear();
+    statistics::encoding_table tab;
+    stats.build_encoding_table(tab);
+    context ctx { .fwd = m_fwd, .rev = m_rev, .stats = stats, .tab = tab, .src = src, .src_len = src_len };
+    memory::fill(ctx.state, statistics::word_L);
+    g_Compress(ctx);
+
+    if (ctx.ec != error_code::ok) {
+        exception::from_error(ctx.ec);
+    }
+
+    // See ans32::encoder::encode
+    dst.reserve_more(m_fwd.size() + m_rev.size() + statistics::dense_table_max_length);
+	dst.append_reverse(m_fwd.data(), m_fwd.size());
+	dst.append(m_rev.data(), m_rev.size());
+    stats.serialize(dst);
+}
+
+void iguana::ans_nibble64::encoder::compress_portable(context& ctx) {
+	const auto n_last = ctx.src_len % chunk_size;
+	auto k = ctx.src_len - n_last;
+
+	// Process the last chunk first
+	put(ctx, ctx.src + k, n_last);
+
+	// Process the remaining chunks
+	while(k != 0) {
+        k -= chunk_size;
+		put(ctx, ctx.src + k, chunk_size);
+	}
+
+    flush(ctx);
+    ctx.ec = error_code::ok;
+}
+
+void iguana::ans_nibble64::encoder::flush(context& ctx) {
+	for(std::size_t lane = chunk_size; lane-- != 0;) {
+        ctx.fwd.append_big_endian(ctx.state[lane]);
+	}
+
+	for(std::size_t lane = chunk_size; lane != lanes; ++lane) {
+        ctx.rev.append_little_endian(ctx.state[lane]);
+	}
+}
+
+void iguana::ans_nibble64::encoder::at_process_start() {
+    g_Compress.select();
+}
+
+void iguana::ans_nibble64::encoder::at_process_end() {}
+
+//
+
+iguana::ans_nibble64::decoder::~decoder() noexcept {}
+
+void iguana::ans_nibble64::decoder::decode(output_stream& dst, std::size_t result_size, input_stream& src, const statistics::decoding_table& tab) {
+    dst.reserve_more(result_size);
+    context ctx{ .dst = dst, .result_size = result_size, .src = src, .tab = tab };
+    g_Decompress(ctx);
+
+    if (ctx.ec != error_code::ok) {
+        exception::from_error(ctx.ec);
+    }
+}
+
+void iguana::ans_nibble64::decoder::decompress_portable(context& ctx) {
+    constexpr const std::size_t state_bytes = chunk_size * sizeof(std::uint32_t);
+    const std::uint8_t* const src = ctx.src.data();
+
+    if (ctx.src.size() < 2 * state_bytes) {
+        ctx.ec = error_code::corrupted_bitstream;
+        return;
+    }
+
+	std::uint32_t state[lanes];
+	std::size_t cursor_fwd = state_bytes;
+	std::size_t cursor_rev = ctx.src.size() - state_bytes;
+
+	for(std::size_t lane = 0; lane != chunk_size; ++lane) {
+		state[lane]              = utils::read_little_endian<std::uint32_t>(src + lane * 4);
+		state[chunk_size + lane] = utils::read_little_endian<std::uint32_t>(src + cursor_rev + lane * 4);
+	}
+
+    const std::size_t dst_origin = ctx.dst.size();
+    ctx.dst.resize(dst_origin + ctx.result_size);
+    std::uint8_t* out = ctx.dst.data() + dst_origin;
+    std::uint8_t* const out_end = out + ctx.result_size;
+    const std::uint32_t scale_bits = ctx.tab.word_M_bits;
+    const std::uint32_t mask_M = (std::uint32_t(1) << scale_bits) - 1;
+    const std::uint32_t bias_shift = ctx.tab.bias_shift;
+    const std::uint32_t mask_F = (std::uint32_t(1) << bias_shift) - 1;
+
+    const auto get = [&](std::size_t lane) {
+        const std::uint32_t x = state[lane];
+        const auto slot = x & mask_M;
+        const auto t = ctx.tab[slot];
+        const auto freq = std::uint32_t(t & mask_F);
+        const auto bias = std::uint32_t((t >> bias_shift) & mask_F);
+        // s, x = D(x)
+        state[lane] = freq * (x >> scale_bits) + bias;
+        return ctx.tab.symbols[slot];
+    };
+
+	for(;;) {
+        const auto n = std::min<std::size_t>(std::size_t(out_end - out), chunk_size);
+		for(std::size_t lane = 0; lane != n; ++lane) {
+            out[lane] = std::uint8_t(get(lane) | (get(chunk_size + lane) << 4));
+		}
+        out += n;
+
+        // The last chunk is not followed by a renormalization, the states are back at word_L
+        if (out == out_end) {
+            break;
+        }
+
+		// Normalize the forward part
+		for(std::size_t lane = 0; lane != chunk_size; ++lane) {
+			if (const auto x = state[lane]; x < statistics::word_L) {
+                if (cursor_fwd + 2 > cursor_rev) {
+                    ctx.ec = error_code::corrupted_bitstream;
+                    return;
+                }
+				const auto v = utils::read_little_endian<std::uint16_t>(src + cursor_fwd);
+				cursor_fwd += 2;
+				state[lane] = (x << statistics::word_L_bits) | std::uint32_t(v);
+			}
+		}
+		// Normalize the reverse part
+		for(std::size_t lane = chunk_size; lane != lanes; ++lane) {
+			if (const auto x = state[lane]; x < statistics::word_L) {
+                if (cursor_rev < cursor_fwd + 2) {
+                    ctx.ec = error_code::corrupted_bitstream;
+                    return;
+                }
+				const auto v = utils::read_little_endian<std::uint16_t>(src + cursor_rev - 2);
+				cursor_rev -= 2;
+				state[lane] = (x << statistics::word_L_bits) | std::uint32_t(v);
+			}
+		}
+	}
+
+    for(std::size_t i = 0; i != lanes; ++i) {
+        if (state[i] != statistics::word_L) {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+    }
+
+    ctx.ec = error_code::ok;
+}
+
+void iguana::ans_nibble64::decoder::at_process_start() {
+    g_Decompress.select();
+}
+
+void iguana::ans_nibble64::decoder::at_process_end() {}
@@ -0,0 +1,160 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include "common.h"
+#include "error.h"
+#include "ans_encoder.h"
+#include "ans_decoder.h"
+#include "cpu.h"
+#include "ans_nibble_statistics.h"
+
+// The vectorized nibble format. The stream is coded in chunks of 32 bytes, the lower nibbles of a chunk by the
+// states 0-31, the upper nibbles by the states 32-63, so that a decoder can rebuild the bytes of a chunk from the
+// symbols of two halves of its states. As in ans32, the first half renormalizes into a stream read forwards from
+// the start, the second half into one read backwards from the end.
+
+namespace iguana::ans_nibble64 {
+    constexpr const std::size_t lanes = 64;
+    constexpr const std::size_t chunk_size = lanes / 2;
+
+    //
+
+    class IGUANA_API encoder final : public ans::basic_encoder<encoder, ans::nibble_statistics> {
+        using super = ans::basic_encoder<encoder, ans::nibble_statistics>;
+        friend internal::initializer<encoder>;
+        struct context;
+
+    private:
+       using kernel_function = void (*)(context& ctx);
+
+       static const cpu::kernel_table<kernel_function> g_Kernels;
+       static cpu::kernel_dispatch<kernel_function> g_Compress;
+       static const internal::initializer<encoder> g_Initializer;
+
+    private:
+        output_stream m_fwd;
+        output_stream m_rev;
+
+    public:
+        encoder();
+        ~encoder() noexcept;
+
+        encoder(const encoder&) = delete;
+        encoder& operator =(const encoder&) = delete;
+
+        encoder(encoder&& v) = default;
+        encoder& operator =(encoder&& v) = default;
+
+    public:
+        void encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len);
+        using super::encode;
+
+        // The kernel is shared by all the encoders, and must not be changed while any of them is running
+        static kernel get_kernel() noexcept {
+            return g_Compress.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_Compress.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_Compress.set(k);
+        }
+
+    private:
+        static void compress_portable(context& ctx);
+        static void put(context& ctx, const std::uint8_t* p, std::size_t n);
+        static void flush(context& ctx);
+        static void at_process_start();
+        static void at_process_end();
+    };
+
+    //
+
+    struct encoder::context final {
+        std::uint32_t       state[lanes];
+        output_stream&      fwd;
+        output_stream&      rev;
+        const statistics&   stats;
+        const statistics::encoding_table& tab;
+        const std::uint8_t  *src;
+        std::size_t         src_len;
+        error_code          ec;
+    };
+
+    //
+
+    class IGUANA_API decoder final : public ans::basic_decoder<decoder, ans::nibble_statistics> {
+        using super = ans::basic_decoder<decoder, ans::nibble_statistics>;
+        friend internal::initializer<decoder>;
+        struct context;
+
+    private:
+        using kernel_function = void (*)(context& ctx);
+
+        static const cpu::kernel_table<kernel_function> g_Kernels;
+        static cpu::kernel_dispatch<kernel_function> g_Decompress;
+        static const internal::initializer<decoder> g_Initializer;
+
+    public:
+        decoder() {}
+        ~decoder() noexcept;
+
+        decoder(const decoder&) = delete;
+        decoder& operator =(const decoder&) = delete;
+
+        decoder(decoder&& v) = default;
+        decoder& operator =(decoder&& v) = default;
+
+    public:
+        void decode(output_stream& dst, std::size_t result_size, input_stream& src, const statistics::decoding_table& tab);
+        using super::decode;
+
+        // The kernel is shared by all the decoders, and must not be changed while any of them is running
+        static kernel get_kernel() noexcept {
+            return g_Decompress.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_Decompress.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_Decompress.set(k);
+        }
+
+    private:
+        static void decompress_portable(context& ctx);
+#if defined(IGUANA_PROCESSOR_X64)
+        static void decompress_avx2(context& ctx);
+        static void decompress_avx512(context& ctx);
+#endif
+        static void at_process_start();
+        static void at_process_end();
+    };
+
+    //
+
+    struct decoder::context final {
+        output_stream&                      dst;
+        std::size_t                         result_size;
+        input_stream&                       src;
+        const statistics::decoding_table&   tab;
+        error_code                          ec;
+    };
+}
@@ -0,0 +1,186 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "common.h"
+
+#if defined(IGUANA_PROCESSOR_X64)
+#include <array>
+#include <immintrin.h>
+#include "ans_nibble64.h"
+
+// The AVX2 ans_nibble64 decoder keeps the 64 states in eight YMM registers, four forward and four reverse, and
+// decodes a nibble from every lane with eight gathers into the decoding table. The words are distributed to the
+// lanes below word_L as in ans32::decoder::decompress_avx2, and the bytes are rebuilt as in decompress_avx512.
+
+namespace iguana::ans_nibble64 {
+    namespace {
+        using statistics = decoder::statistics;
+
+        static_assert(chunk_size == 32, "the AVX2 decoder handles 32 lanes per half");
+
+        constexpr const std::size_t avx2_nibble_state_bytes = chunk_size * sizeof(std::uint32_t);
+
+        // For every 8-bit lane mask, the index of the word each set lane takes, i.e. the number of set lanes below it
+        constexpr std::array<std::uint64_t, 256> avx2_nibble_make_expand_indices() noexcept {
+            std::array<std::uint64_t, 256> r{};
+            for(unsigned m = 0; m != 256; ++m) {
+                std::uint64_t v = 0;
+                unsigned k = 0;
+                for(unsigned lane = 0; lane != 8; ++lane) {
+                    if ((m >> lane) & 1) {
+                        v |= std::uint64_t(k++) << (lane * 8);
+                    }
+                }
+                r[m] = v;
+            }
+            return r;
+        }
+
+        alignas(64) constexpr const std::array<std::uint64_t, 256> avx2_nibble_expand_indices = avx2_nibble_make_expand_indices();
+
+        // Above the compact precision, the nibbles are gathered as the words at their bytes, see decoding_table
+        IGUANA_TARGET_AVX2 inline __m256i avx2_nibble_decode_step(__m256i& x, const statistics::decoding_table& tab, __m256i scale_bits, __m256i mask_M, __m256i bias_shift, __m256i mask_F, bool wide) noexcept {
+            const __m256i slot = _mm256_and_si256(x, mask_M);
+            const __m256i t = _mm256_i32gather_epi32(reinterpret_cast<const int*>(tab.slots), slot, sizeof(std::uint32_t));
+            const __m256i freq = _mm256_and_si256(t, mask_F);
+            const __m256i bias = _mm256_and_si256(_mm256_srlv_epi32(t, bias_shift), mask_F);
+
+            // s, x = D(x)
+            x = _mm256_add_epi32(_mm256_mullo_epi32(freq, _mm256_srlv_epi32(x, scale_bits)), bias);
+            return wide ? _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(tab.symbols), slot, 1), _mm256_set1_epi32(0xff)) : _mm256_srli_epi32(t, 24);
+        }
+
+        // Combines the lower and upper nibbles of 32 lanes into bytes, in lane order
+        IGUANA_TARGET_AVX2 inline void avx2_nibble_store_bytes(std::uint8_t* out, const __m256i* lo, const __m256i* hi) noexcept {
+            const __m256i a = _mm256_or_si256(lo[0], _mm256_slli_epi32(hi[0], 4));
+            const __m256i b = _mm256_or_si256(lo[1], _mm256_slli_epi32(hi[1], 4));
+            const __m256i c = _mm256_or_si256(lo[2], _mm256_slli_epi32(hi[2], 4));
+            const __m256i d = _mm256_or_si256(lo[3], _mm256_slli_epi32(hi[3], 4));
+            const __m256i abcd = _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_packus_epi32(c, d));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permutevar8x32_epi32(abcd, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)));
+        }
+
+        // Shifts a word into every lane below word_L, taking the words in order from p. The reverse lanes take
+        // theirs in descending order from the 16 bytes below p. Returns the number of words consumed.
+        template <
+            bool T_REVERSE
+        > IGUANA_TARGET_AVX2 inline unsigned avx2_nibble_renormalize(__m256i& x, const std::uint8_t* p) noexcept {
+            const __m256i below = _mm256_cmpeq_epi32(_mm256_srli_epi32(x, statistics::word_L_bits), _mm256_setzero_si256());
+            const auto m = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(below)));
+            if (m == 0) {
+                return 0;
+            }
+
+            __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&avx2_nibble_expand_indices[m])));
+            __m128i raw;
+            if constexpr (T_REVERSE) {
+                idx = _mm256_sub_epi32(_mm256_set1_epi32(7), idx);
+                raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p - 16));
+            } else {
+                raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            }
+
+            const __m256i w = _mm256_permutevar8x32_epi32(_mm256_cvtepu16_epi32(raw), idx);
+            x = _mm256_blendv_epi8(x, _mm256_or_si256(_mm256_slli_epi32(x, statistics::word_L_bits), w), below);
+            return unsigned(_mm_popcnt_u32(m));
+        }
+    }
+}
+
+//
+
+IGUANA_TARGET_AVX2 void iguana::ans_nibble64::decoder::decompress_avx2(context& ctx) {
+    const std::uint8_t* const src = ctx.src.data();
+    const std::size_t src_len = ctx.src.size();
+
+    if (src_len < 2 * avx2_nibble_state_bytes) {
+        ctx.ec = error_code::corrupted_bitstream;
+        return;
+    }
+
+    std::size_t cursor_fwd = avx2_nibble_state_bytes;
+    std::size_t cursor_rev = src_len - avx2_nibble_state_bytes;
+
+    __m256i fwd[4], rev[4];
+    for(std::size_t i = 0; i != 4; ++i) {
+        fwd[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32 * i));
+        rev[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + cursor_rev + 32 * i));
+    }
+
+    const std::size_t dst_origin = ctx.dst.size();
+    ctx.dst.resize(dst_origin + ctx.result_size);
+    std::uint8_t* out = ctx.dst.data() + dst_origin;
+    std::uint8_t* const out_end = out + ctx.result_size;
+
+    const __m256i scale_bits = _mm256_set1_epi32(std::int32_t(ctx.tab.word_M_bits));
+    const __m256i mask_M = _mm256_set1_epi32(std::int32_t((std::uint32_t(1) << ctx.tab.word_M_bits) - 1));
+    const __m256i bias_shift = _mm256_set1_epi32(std::int32_t(ctx.tab.bias_shift));
+    const __m256i mask_F = _mm256_set1_epi32(std::int32_t((std::uint32_t(1) << ctx.tab.bias_shift) - 1));
+    const bool wide = (ctx.tab.word_M_bits > statistics::compact_word_M_bits);
+
+    // See decompress_avx512, every renormalization reads at most 16 bytes from either cursor
+    while(std::size_t(out_end - out) > chunk_size) {
+        __m256i lo[4], hi[4];
+        for(std::size_t i = 0; i != 4; ++i) {
+            lo[i] = avx2_nibble_decode_step(fwd[i], ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide);
+            hi[i] = avx2_nibble_decode_step(rev[i], ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide);
+        }
+        avx2_nibble_store_bytes(out, lo, hi);
+        out += chunk_size;
+
+        for(std::size_t i = 0; i != 4; ++i) {
+            cursor_fwd += 2 * avx2_nibble_renormalize<false>(fwd[i], src + cursor_fwd);
+        }
+        for(std::size_t i = 0; i != 4; ++i) {
+            cursor_rev -= 2 * avx2_nibble_renormalize<true>(rev[i], src + cursor_rev);
+        }
+        if (cursor_fwd > cursor_rev) [[unlikely]] {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+    }
+
+    // The last chunk, complete or not, is not followed by a renormalization
+    alignas(32) std::uint32_t state[lanes];
+    for(std::size_t i = 0; i != 4; ++i) {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(state + 8 * i), fwd[i]);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(state + chunk_size + 8 * i), rev[i]);
+    }
+
+    const auto get = [&](std::size_t lane) {
+        const std::uint32_t x = state[lane];
+        const auto slot = x & ((std::uint32_t(1) << ctx.tab.word_M_bits) - 1);
+        const auto t = ctx.tab[slot];
+        const auto mask_F = (std::uint32_t(1) << ctx.tab.bias_shift) - 1;
+        const auto freq = std::uint32_t(t & mask_F);
+        const auto bias = std::uint32_t((t >> ctx.tab.bias_shift) & mask_F);
+        state[lane] = freq * (x >> ctx.tab.word_M_bits) + bias;
+        return ctx.tab.symbols[slot];
+    };
+
+    for(std::size_t lane = 0; out != out_end; ++lane) {
+        *out++ = std::uint8_t(get(lane) | (get(chunk_size + lane) << 4));
+    }
+
+    for(std::size_t i = 0; i != lanes; ++i) {
+        if (state[i] != statistics::word_L) {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+    }
+
+    ctx.ec = error_code::ok;
+}
+
+#endif
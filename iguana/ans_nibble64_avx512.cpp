@@ -0,0 +1,154 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "common.h"
+
+#if defined(IGUANA_PROCESSOR_X64)
+#include <immintrin.h>
+#include "ans_nibble64.h"
+
+// The AVX-512 ans_nibble64 decoder keeps the states in four ZMM registers, lanes 0-15 and 16-31 forward, 32-47 and
+// 48-63 reverse, and decodes a nibble from every lane with four gathers into the decoding table. The nibbles of the
+// forward lanes are the lower halves of the 32 bytes of a chunk and those of the reverse lanes the upper halves, so
+// each byte is a shift and an OR away. The renormalization is that of ans32::decoder::decompress_avx512, with two
+// registers sharing either cursor.
+
+namespace iguana::ans_nibble64 {
+    namespace {
+        using statistics = decoder::statistics;
+
+        static_assert(chunk_size == 32, "the AVX-512 decoder handles 32 lanes per half");
+
+        constexpr const std::size_t avx512_nibble_state_bytes = chunk_size * sizeof(std::uint32_t);
+
+        // Reverses the order of the 16-bit words loaded from below the reverse cursor
+        alignas(64) constexpr const std::uint32_t avx512_nibble_reverse_lanes[16] = {
+            15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+        };
+
+        // Above the compact precision, the nibbles are gathered as the words at their bytes, see decoding_table.
+        // Only the low bytes of the combined lanes are narrowed to.
+        IGUANA_TARGET_AVX512 inline __m512i avx512_nibble_decode_step(__m512i& x, const statistics::decoding_table& tab, __m512i scale_bits, __m512i mask_M, __m512i bias_shift, __m512i mask_F, bool wide) noexcept {
+            const __m512i slot = _mm512_and_si512(x, mask_M);
+            const __m512i t = _mm512_i32gather_epi32(slot, tab.slots, sizeof(std::uint32_t));
+            const __m512i freq = _mm512_and_si512(t, mask_F);
+            const __m512i bias = _mm512_and_si512(_mm512_srlv_epi32(t, bias_shift), mask_F);
+
+            // s, x = D(x)
+            x = _mm512_add_epi32(_mm512_mullo_epi32(freq, _mm512_srlv_epi32(x, scale_bits)), bias);
+            return wide ? _mm512_i32gather_epi32(slot, tab.symbols, 1) : _mm512_srli_epi32(t, 24);
+        }
+
+        // Shifts a word into every lane below word_L, taking the words in order from p, and returns their number.
+        // The reverse lanes take theirs in descending order from the 32 bytes below p.
+        template <
+            bool T_REVERSE
+        > IGUANA_TARGET_AVX512 inline std::size_t avx512_nibble_renormalize(__m512i& x, const std::uint8_t* p) noexcept {
+            const __mmask16 m = _mm512_cmplt_epu32_mask(x, _mm512_set1_epi32(statistics::word_L));
+            __m512i w;
+            if constexpr (T_REVERSE) {
+                w = _mm512_permutexvar_epi32(_mm512_load_si512(avx512_nibble_reverse_lanes), _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p - 32))));
+            } else {
+                w = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+            }
+            x = _mm512_mask_or_epi32(x, m, _mm512_slli_epi32(x, statistics::word_L_bits), _mm512_maskz_expand_epi32(m, w));
+            return std::size_t(_mm_popcnt_u32(m));
+        }
+    }
+}
+
+//
+
+IGUANA_TARGET_AVX512 void iguana::ans_nibble64::decoder::decompress_avx512(context& ctx) {
+    const std::uint8_t* const src = ctx.src.data();
+    const std::size_t src_len = ctx.src.size();
+
+    if (src_len < 2 * avx512_nibble_state_bytes) {
+        ctx.ec = error_code::corrupted_bitstream;
+        return;
+    }
+
+    std::size_t cursor_fwd = avx512_nibble_state_bytes;
+    std::size_t cursor_rev = src_len - avx512_nibble_state_bytes;
+
+    __m512i x0 = _mm512_loadu_si512(src);
+    __m512i x1 = _mm512_loadu_si512(src + 64);
+    __m512i x2 = _mm512_loadu_si512(src + cursor_rev);
+    __m512i x3 = _mm512_loadu_si512(src + cursor_rev + 64);
+
+    const std::size_t dst_origin = ctx.dst.size();
+    ctx.dst.resize(dst_origin + ctx.result_size);
+    std::uint8_t* out = ctx.dst.data() + dst_origin;
+    std::uint8_t* const out_end = out + ctx.result_size;
+
+    const __m512i scale_bits = _mm512_set1_epi32(std::int32_t(ctx.tab.word_M_bits));
+    const __m512i mask_M = _mm512_set1_epi32(std::int32_t((std::uint32_t(1) << ctx.tab.word_M_bits) - 1));
+    const __m512i bias_shift = _mm512_set1_epi32(std::int32_t(ctx.tab.bias_shift));
+    const __m512i mask_F = _mm512_set1_epi32(std::int32_t((std::uint32_t(1) << ctx.tab.bias_shift) - 1));
+    const bool wide = (ctx.tab.word_M_bits > statistics::compact_word_M_bits);
+
+    // The cursors stay within [avx512_nibble_state_bytes, src_len - avx512_nibble_state_bytes] between the
+    // chunks, and move by at most 32 bytes per register, so all the loads are within the stream
+    while(std::size_t(out_end - out) > chunk_size) {
+        const __m512i lo0 = avx512_nibble_decode_step(x0, ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide);
+        const __m512i lo1 = avx512_nibble_decode_step(x1, ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide);
+        const __m512i hi0 = avx512_nibble_decode_step(x2, ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide);
+        const __m512i hi1 = avx512_nibble_decode_step(x3, ctx.tab, scale_bits, mask_M, bias_shift, mask_F, wide);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm512_cvtepi32_epi8(_mm512_or_si512(lo0, _mm512_slli_epi32(hi0, 4))));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm512_cvtepi32_epi8(_mm512_or_si512(lo1, _mm512_slli_epi32(hi1, 4))));
+        out += chunk_size;
+
+        cursor_fwd += 2 * avx512_nibble_renormalize<false>(x0, src + cursor_fwd);
+        cursor_fwd += 2 * avx512_nibble_renormalize<false>(x1, src + cursor_fwd);
+        cursor_rev -= 2 * avx512_nibble_renormalize<true>(x2, src + cursor_rev);
+        cursor_rev -= 2 * avx512_nibble_renormalize<true>(x3, src + cursor_rev);
+        if (cursor_fwd > cursor_rev) [[unlikely]] {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+    }
+
+    // The last chunk, complete or not, is not followed by a renormalization
+    alignas(64) std::uint32_t state[lanes];
+    _mm512_store_si512(state, x0);
+    _mm512_store_si512(state + 16, x1);
+    _mm512_store_si512(state + 32, x2);
+    _mm512_store_si512(state + 48, x3);
+
+    const auto get = [&](std::size_t lane) {
+        const std::uint32_t x = state[lane];
+        const auto slot = x & ((std::uint32_t(1) << ctx.tab.word_M_bits) - 1);
+        const auto t = ctx.tab[slot];
+        const auto mask_F = (std::uint32_t(1) << ctx.tab.bias_shift) - 1;
+        const auto freq = std::uint32_t(t & mask_F);
+        const auto bias = std::uint32_t((t >> ctx.tab.bias_shift) & mask_F);
+        state[lane] = freq * (x >> ctx.tab.word_M_bits) + bias;
+        return ctx.tab.symbols[slot];
+    };
+
+    for(std::size_t lane = 0; out != out_end; ++lane) {
+        *out++ = std::uint8_t(get(lane) | (get(chunk_size + lane) << 4));
+    }
+
+    for(std::size_t i = 0; i != lanes; ++i) {
+        if (state[i] != statistics::word_L) {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+    }
+
+    ctx.ec = error_code::ok;
+}
+
+#endif
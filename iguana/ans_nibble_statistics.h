@@ -19,6 +19,7 @@
 #include "memops.h"
 #include "input_stream.h"
 #include "output_stream.h"
+#include "ans_encoding_symbol.h"
 
 namespace iguana::ans {
 
@@ -26,22 +27,34 @@ namespace iguana::ans {
         class builder;
 
     public:
-        constexpr inline static std::size_t   word_M_bits = 12;
+        // The frequencies sum up to 1 << scale_bits() for any precision in between. The table fields are
+        // sized for the highest one.
+        constexpr inline static std::size_t   min_word_M_bits = 10;
+        constexpr inline static std::size_t   max_word_M_bits = 15;
+        constexpr inline static std::size_t   word_M_bits = max_word_M_bits;
         constexpr inline static std::size_t   word_L_bits = 16;
         constexpr inline static std::uint32_t word_L = std::uint32_t(1) << word_L_bits;
         constexpr inline static std::uint32_t word_M = std::uint32_t(1) << word_M_bits;
 
+        // See byte_statistics
+        constexpr inline static std::size_t compact_word_M_bits = 12;
+        constexpr inline static double      wide_scale_min_gain = 64;
+
+        // Above that many symbols, the tables are too small a part of the stream for a precision below the compact
+        // one to pay off
+        constexpr inline static std::size_t scale_selection_max_symbols = std::size_t(4) << compact_word_M_bits;
+
         //
 
-        constexpr inline static std::uint32_t frequency_bits = word_M_bits;
+        constexpr inline static std::uint32_t frequency_bits = 16;
         constexpr inline static std::uint32_t frequency_mask = (1 << frequency_bits) - 1;
-        constexpr inline static std::uint32_t cumulative_frequency_bits = word_M_bits;
+        constexpr inline static std::uint32_t cumulative_frequency_bits = 16;
         constexpr inline static std::uint32_t cumulative_frequency_mask = (1 << cumulative_frequency_bits) - 1;
 
         //
 
         constexpr inline static std::size_t ctrl_block_size         = 6;
-        constexpr inline static std::size_t nibble_block_max_length = 24; // 16 3-nibble groups
+        constexpr inline static std::size_t nibble_block_max_length = 24 + 16; // 16 3-nibble groups, 8 escapes
         constexpr inline static std::size_t dense_table_max_length  = ctrl_block_size + nibble_block_max_length;
 
         //
@@ -49,10 +62,23 @@ namespace iguana::ans {
         constexpr inline static std::size_t initial_buffer_size = 1 << 20;
 
     public:
-        using decoding_table = std::uint32_t[word_M];
+        // Only the first 1 << word_M_bits slots are used, see byte_statistics::decoding_table
+        struct decoding_table final {
+            std::uint32_t   word_M_bits;
+            std::uint32_t   bias_shift;
+            std::uint32_t   slots[word_M];
+            std::uint8_t    symbols[word_M + 3];
+
+            std::uint32_t operator [](std::size_t k) const noexcept {
+                return slots[k];
+            }
+        };
+
+        using encoding_table = encoding_symbol[16];
 
     private:
         std::array<std::uint32_t, 16> m_table;
+        std::uint32_t                 m_scale_bits = word_M_bits;
 
     public:
         nibble_statistics() noexcept {
@@ -83,20 +109,29 @@ namespace iguana::ans {
             return m_table[k];
         }
 
+        std::size_t scale_bits() const noexcept {
+            return m_scale_bits;
+        }
+
     public:
+        // Picks the precision: the lower ones are cheaper to decode and to store, which pays off on the small blocks,
+        // the higher ones on the very skewed data
         void compute(const std::uint8_t *p, std::size_t n) noexcept;
+        void compute(const std::uint8_t *p, std::size_t n, std::size_t scale_bits) noexcept;
 
         void compute(const_byte_span s) noexcept {
             return compute(s.data(), s.size());
         }
 
         void build_decoding_table(decoding_table& tab) const noexcept;
+        void build_encoding_table(encoding_table& tab) const noexcept;
 
     public:
         void serialize(output_stream& s) const;
         void deserialize(input_stream& s);
 
     private:
+        void store(const builder& bld) noexcept;
         static std::uint32_t fetch_nibble(input_stream& s, ssize_t& nibidx);
     };
 }
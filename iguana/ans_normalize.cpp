@@ -0,0 +1,152 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <limits>
+#include <algorithm>
+#include "ans_normalize.h"
+
+// The coded size is a sum of convex functions of the separate frequencies, so the frequencies are optimal as soon as
+// no single step of one symbol up and another one down makes it smaller. The scaled counts rounded to the nearest
+// frequency are at most half a step per symbol away from the total, plus the steps raising the rare symbols to 1,
+// which is made up for with a heap of the cheapest steps. The exchange pass that follows rarely moves anything.
+
+namespace iguana::ans {
+    namespace {
+        struct normalize_candidate final {
+            double          score;
+            std::uint32_t   index;
+
+            bool operator <(const normalize_candidate& v) const noexcept {
+                return score < v.score;
+            }
+        };
+
+        // ln(1 + 1/f) = 2 * atanh(1 / (2f + 1)), the code length saved in nats by raising a frequency from f to f+1.
+        // Five terms of the series are within 2e-6 of it at f = 1 and closer above, and every term decreases in f,
+        // so the steps keep getting cheaper as they are in the exact costs.
+        inline double normalize_step(std::uint64_t f) noexcept {
+            const double y = 1.0 / double(2 * f + 1);
+            const double y2 = y * y;
+            return y * (1.0 + y2 * (1.0 / 3.0 + y2 * (1.0 / 5.0 + y2 * (1.0 / 7.0 + y2 * (1.0 / 9.0)))));
+        }
+
+        // The code length saved by raising the frequency of a symbol occurring c times from f to f+1
+        inline double normalize_gain(std::uint64_t c, std::uint64_t f) noexcept {
+            return double(c) * normalize_step(f);
+        }
+
+        // The code length added by lowering it from f to f-1; an occurring symbol cannot go below 1
+        inline double normalize_loss(std::uint64_t c, std::uint64_t f) noexcept {
+            return (f > 1) ? double(c) * normalize_step(f - 1) : std::numeric_limits<double>::infinity();
+        }
+    }
+}
+
+void iguana::ans::normalize_frequencies(std::uint64_t* freqs, std::size_t n, std::uint64_t total) noexcept {
+    assert(n <= max_normalized_symbols);
+
+    // Only the occurring symbols take part, the others keep their zero frequency
+    std::uint32_t symbols[max_normalized_symbols];
+    std::uint64_t counts[max_normalized_symbols];
+    std::size_t k = 0;
+    std::uint64_t count_total = 0;
+    for(std::size_t i = 0; i != n; ++i) {
+        if (freqs[i] != 0) {
+            symbols[k] = std::uint32_t(i);
+            counts[k++] = freqs[i];
+            count_total += freqs[i];
+        }
+    }
+
+    // Scale the counts to the nearest frequencies, raising the rare symbols to the lowest codable one
+    const double scale = double(total) / double(count_total);
+    std::uint64_t f[max_normalized_symbols];
+    double gains[max_normalized_symbols];
+    double losses[max_normalized_symbols];
+    std::uint64_t sum = 0;
+    for(std::size_t j = 0; j != k; ++j) {
+        f[j] = std::max<std::uint64_t>(1, std::uint64_t(double(counts[j]) * scale + 0.5));
+        gains[j] = normalize_gain(counts[j], f[j]);
+        losses[j] = normalize_loss(counts[j], f[j]);
+        sum += f[j];
+    }
+
+    const auto step = [&](std::size_t j, std::int64_t d) {
+        f[j] += d;
+        gains[j] = normalize_gain(counts[j], f[j]);
+        losses[j] = normalize_loss(counts[j], f[j]);
+    };
+
+    normalize_candidate heap[max_normalized_symbols];
+    std::size_t heap_size = 0;
+
+    if (sum < total) {
+        // Hand out the missing steps to the symbols saving the most
+        for(std::size_t j = 0; j != k; ++j) {
+            heap[heap_size++] = { gains[j], std::uint32_t(j) };
+        }
+        std::make_heap(heap, heap + heap_size);
+
+        for(; sum != total; ++sum) {
+            std::pop_heap(heap, heap + heap_size);
+            auto& top = heap[heap_size - 1];
+            step(top.index, 1);
+            top.score = gains[top.index];
+            std::push_heap(heap, heap + heap_size);
+        }
+    } else if (sum > total) {
+        // Take the excess steps from the symbols losing the least. The heap keeps the greatest element on top.
+        for(std::size_t j = 0; j != k; ++j) {
+            if (f[j] > 1) {
+                heap[heap_size++] = { -losses[j], std::uint32_t(j) };
+            }
+        }
+        std::make_heap(heap, heap + heap_size);
+
+        for(; sum != total; --sum) {
+            std::pop_heap(heap, heap + heap_size);
+            auto& top = heap[heap_size - 1];
+            step(top.index, -1);
+            if (f[top.index] > 1) {
+                top.score = -losses[top.index];
+                std::push_heap(heap, heap + heap_size);
+            } else {
+                --heap_size;
+            }
+        }
+    }
+
+    // Move single steps from the symbols losing the least to the ones saving the most while that pays off
+    for(;;) {
+        std::size_t up = 0;
+        std::size_t down = 0;
+        for(std::size_t j = 1; j != k; ++j) {
+            up = (gains[j] > gains[up]) ? j : up;
+            down = (losses[j] < losses[down]) ? j : down;
+        }
+
+        // A symbol always loses more than it would gain, so up and down differ whenever a step pays off. The margin
+        // keeps the rounding errors from trading equal steps back and forth.
+        if (!(gains[up] > losses[down] * (1.0 + 1e-9))) {
+            break;
+        }
+
+        step(up, 1);
+        step(down, -1);
+    }
+
+    for(std::size_t j = 0; j != k; ++j) {
+        freqs[symbols[j]] = f[j];
+    }
+}
@@ -0,0 +1,26 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include "common.h"
+
+namespace iguana::ans {
+
+    constexpr const std::size_t max_normalized_symbols = 256;
+
+    // Replaces the symbol counts in freqs[0..n) with frequencies summing up to total, keeping every occurring
+    // symbol codable. Of all such frequencies, the ones picked minimize the coded size sum(c[s] * -log2(f[s] / total)).
+    // At least two symbols must occur, and there must be at most max_normalized_symbols <= total of them.
+    void normalize_frequencies(std::uint64_t* freqs, std::size_t n, std::uint64_t total) noexcept;
+}
@@ -0,0 +1,117 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "ans_tabled_statistics.h"
+#include "bitops.h"
+#include "error.h"
+
+// The tables follow Yann Collet's Finite State Entropy library: https://github.com/Cyan4973/FiniteStateEntropy
+// For the theoretical background, please refer to Jaroslaw Duda's paper: https://arxiv.org/pdf/1311.2540.pdf
+
+namespace iguana::ans {
+    namespace {
+        // Assigns the states to the symbols, symbols[u] being the symbol of the state word_M + u. The step is odd,
+        // so it visits every state of the table once, and it scatters the states of a symbol across the table.
+        void tabled_spread_symbols(std::uint8_t* symbols, std::uint32_t* freqs, std::uint32_t word_M_bits) noexcept {
+            const std::uint32_t word_M = std::uint32_t(1) << word_M_bits;
+
+            // The frequencies of a single repeated symbol leave a state out, see byte_statistics::builder::build.
+            // It goes to the most frequent symbol, so that the states of the symbols fill the table.
+            std::uint32_t sum = 0;
+            std::size_t top = 0;
+            for(std::size_t s = 0; s != 256; ++s) {
+                sum += freqs[s];
+                top = (freqs[s] > freqs[top]) ? s : top;
+            }
+            assert(sum + 1 >= word_M && sum <= word_M);
+            freqs[top] += word_M - sum;
+
+            const std::uint32_t step = (word_M >> 1) + (word_M >> 3) + 3;
+            std::uint32_t pos = 0;
+            for(std::size_t s = 0; s != 256; ++s) {
+                for(std::uint32_t i = 0; i != freqs[s]; ++i) {
+                    symbols[pos] = std::uint8_t(s);
+                    pos = (pos + step) & (word_M - 1);
+                }
+            }
+        }
+    }
+}
+
+void iguana::ans::tabled_statistics::build_decoding_table(decoding_table& tab) const noexcept {
+    const std::uint32_t table_bits = m_scale_bits;
+    const std::uint32_t size = std::uint32_t(1) << table_bits;
+
+    std::uint32_t freqs[256];
+    for(std::size_t s = 0; s != 256; ++s) {
+        freqs[s] = m_table[s];
+    }
+    std::uint8_t symbols[word_M];
+    tabled_spread_symbols(symbols, freqs, table_bits);
+
+    // The states of a symbol come in [freq, 2 * freq) to the decoder, and are scaled up to [size, 2 * size)
+    // with the bits that follow
+    tab.word_M_bits = table_bits;
+    for(std::uint32_t u = 0; u != size; ++u) {
+        const auto s = symbols[u];
+        const std::uint32_t x = freqs[s]++;
+        const std::uint32_t bits = table_bits - bit::find_last_set(x);
+        tab.entries[u] = { std::uint16_t((x << bits) - size), s, std::uint8_t(bits) };
+    }
+}
+
+void iguana::ans::tabled_statistics::build_encoding_table(encoding_table& tab) const noexcept {
+    const std::uint32_t table_bits = m_scale_bits;
+    const std::uint32_t size = std::uint32_t(1) << table_bits;
+
+    std::uint32_t freqs[256];
+    for(std::size_t s = 0; s != 256; ++s) {
+        freqs[s] = m_table[s] & frequency_mask;
+    }
+    std::uint8_t symbols[word_M];
+    tabled_spread_symbols(symbols, freqs, table_bits);
+
+    // The states of every symbol, in order
+    std::uint32_t starts[256];
+    std::uint32_t total = 0;
+    for(std::size_t s = 0; s != 256; ++s) {
+        starts[s] = total;
+        total += freqs[s];
+    }
+    for(std::uint32_t u = 0; u != size; ++u) {
+        tab.states[starts[symbols[u]]++] = std::uint16_t(size + u);
+    }
+
+    // A state emits bits until it is in [freq, 2 * freq), which takes max_bits - 1 or max_bits of them
+    tab.word_M_bits = table_bits;
+    total = 0;
+    for(std::size_t s = 0; s != 256; ++s) {
+        const auto f = freqs[s];
+        if (f == 0) {
+            tab.transforms[s] = { ((table_bits + 1) << 16) - size, 0 };
+            continue;
+        }
+
+        const std::uint32_t max_bits = table_bits - ((f > 1) ? bit::find_last_set(f - 1) : 0);
+        tab.transforms[s] = { (max_bits << 16) - (f << max_bits), std::int32_t(total) - std::int32_t(f) };
+        total += f;
+    }
+}
+
+void iguana::ans::tabled_statistics::deserialize(input_stream& s) {
+    byte_statistics::deserialize(s);
+    if (m_scale_bits > max_word_M_bits) {
+        throw corrupted_bitstream_exception("invalid ANS frequencies");
+    }
+}
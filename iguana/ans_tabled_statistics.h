@@ -0,0 +1,92 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include "common.h"
+#include "ans_byte_statistics.h"
+
+namespace iguana::ans {
+
+    // The byte statistics, serialized the same way, with the tables of tabled ANS (tANS) instead of those of rANS.
+    // The word_M states of the precision are spread over the symbols in proportion to their frequencies, and every
+    // transition between two states is precomputed, so that coding a symbol takes no multiplication or division.
+    class IGUANA_API tabled_statistics : public byte_statistics {
+    public:
+        // A round of the four tans states writes up to 4 * word_M_bits, and the last one the end mark on top of
+        // them, between two flushes of the 64-bit writer
+        constexpr inline static std::size_t   max_word_M_bits = 13;
+        constexpr inline static std::size_t   word_M_bits = max_word_M_bits;
+        constexpr inline static std::uint32_t word_M = std::uint32_t(1) << word_M_bits;
+
+    public:
+        // The state goes to base + the next bits read, its symbol is decoded along the way
+        struct decoding_entry final {
+            std::uint16_t   base;
+            std::uint8_t    symbol;
+            std::uint8_t    bits;
+        };
+
+        // Only the first 1 << word_M_bits entries are used
+        struct decoding_table final {
+            std::uint32_t   word_M_bits;
+            decoding_entry  entries[word_M];
+
+            const decoding_entry& operator [](std::size_t k) const noexcept {
+                return entries[k];
+            }
+        };
+
+        // A state x in [word_M, 2 * word_M) emits its (x + delta_bits) >> 16 lowest bits before moving on to
+        // states[(x >> bits) + delta_state], after FSE_symbolCompressionTransform of Yann Collet's FSE
+        struct encoding_transform final {
+            std::uint32_t   delta_bits;
+            std::int32_t    delta_state;
+        };
+
+        struct encoding_table final {
+            std::uint32_t       word_M_bits;
+            encoding_transform  transforms[256];
+            std::uint16_t       states[word_M];
+        };
+
+    public:
+        tabled_statistics() noexcept = default;
+
+        explicit tabled_statistics(const_byte_span s) noexcept
+          : tabled_statistics(s.data(), s.size()) {}
+
+        tabled_statistics(const std::uint8_t *p, std::size_t n) noexcept {
+            compute(p, n);
+        }
+
+        explicit tabled_statistics(input_stream& s) {
+            deserialize(s);
+        }
+
+    public:
+        void compute(const std::uint8_t *p, std::size_t n) noexcept {
+            compute_within(p, n, max_word_M_bits);
+        }
+
+        void compute(const_byte_span s) noexcept {
+            return compute(s.data(), s.size());
+        }
+
+        void build_decoding_table(decoding_table& tab) const noexcept;
+        void build_encoding_table(encoding_table& tab) const noexcept;
+
+    public:
+        void deserialize(input_stream& s);
+    };
+}
@@ -27,7 +27,8 @@ enum iguana_error_code {
     out_of_input_data,
     insufficient_target_capacity,
     unrecognized_command,
-    out_of_memory
+    out_of_memory,
+    dictionary_mismatch
 };
 
 //
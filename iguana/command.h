@@ -22,10 +22,23 @@ namespace iguana {
 	    decode_ans32 = 0x02,
 	    decode_ans1 = 0x03,
 	    decode_ans_nibble = 0x04,
+	    use_dictionary = 0x05,    // Followed by the dictionary id; the dictionary precedes the output
+	    decode_ans4 = 0x06,
+	    decode_ans8 = 0x07,
+	    decode_ans_nibble2 = 0x08,
+	    decode_ans_nibble64 = 0x09,
+	    decode_tans = 0x0a,
+	    decode_huffman = 0x0b,
+	    decode_iguana_block = 0x0c,    // decode_iguana preceded by the block flags and the size of the output of the block
     };
 
     //
 
 	static constexpr const std::uint8_t last_command_marker = 0x80;
 	static constexpr const std::uint8_t command_mask = std::uint8_t(~last_command_marker);
+
+	// The block flags of decode_iguana_block. The block references neither the output preceding it nor the dictionary,
+	// so that it can be decoded on its own.
+	static constexpr const std::uint64_t iguana_block_independent = 0x01;
+	static constexpr const std::uint64_t iguana_block_flags_mask = iguana_block_independent;
 }
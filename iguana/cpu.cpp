@@ -0,0 +1,208 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "cpu.h"
+#if defined(IGUANA_PROCESSOR_X64)
+  #if defined(IGUANA_COMPILER_MSVC)
+    #include <intrin.h>
+  #else
+    #include <cpuid.h>
+  #endif
+#endif
+
+namespace iguana::cpu {
+    namespace {
+    #if defined(IGUANA_PROCESSOR_X64)
+        struct cpuid_result final {
+            std::uint32_t eax = 0;
+            std::uint32_t ebx = 0;
+            std::uint32_t ecx = 0;
+            std::uint32_t edx = 0;
+        };
+
+        cpuid_result cpuid(std::uint32_t leaf, std::uint32_t subleaf) noexcept {
+            cpuid_result r;
+        #if defined(IGUANA_COMPILER_MSVC)
+            int regs[4] = {};
+            __cpuidex(regs, int(leaf), int(subleaf));
+            r.eax = std::uint32_t(regs[0]);
+            r.ebx = std::uint32_t(regs[1]);
+            r.ecx = std::uint32_t(regs[2]);
+            r.edx = std::uint32_t(regs[3]);
+        #else
+            __cpuid_count(leaf, subleaf, r.eax, r.ebx, r.ecx, r.edx);
+        #endif
+            return r;
+        }
+
+        // Only valid when CPUID reports OSXSAVE
+        std::uint64_t read_xcr0() noexcept {
+        #if defined(IGUANA_COMPILER_MSVC)
+            return _xgetbv(0);
+        #else
+            std::uint32_t lo = 0;
+            std::uint32_t hi = 0;
+            __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+            return (std::uint64_t(hi) << 32) | lo;
+        #endif
+        }
+
+        constexpr bool has_bit(std::uint32_t reg, unsigned int n) noexcept {
+            return ((reg >> n) & 1) != 0;
+        }
+
+        features detect() noexcept {
+            features f;
+
+            const auto max_leaf = cpuid(0, 0).eax;
+            if (max_leaf < 1) {
+                return f;
+            }
+
+            const auto leaf1 = cpuid(1, 0);
+            f.popcnt = has_bit(leaf1.ecx, 23);
+
+            if (cpuid(0x80000000u, 0).eax >= 0x80000001u) {
+                f.lzcnt = has_bit(cpuid(0x80000001u, 0).ecx, 5);
+            }
+
+            if (max_leaf < 7) {
+                return f;
+            }
+
+            const auto leaf7 = cpuid(7, 0);
+            f.bmi1 = has_bit(leaf7.ebx, 3);
+            f.bmi2 = has_bit(leaf7.ebx, 8);
+
+            // XMM, YMM, and for AVX-512 the opmask and both halves of the ZMM registers
+            const std::uint64_t xcr0 = has_bit(leaf1.ecx, 27) ? read_xcr0() : 0;
+            const bool os_avx = (xcr0 & 0x06) == 0x06;
+            const bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+
+            f.avx2 = os_avx && has_bit(leaf1.ecx, 28) && has_bit(leaf7.ebx, 5);
+            if (os_avx512) {
+                f.avx512f = has_bit(leaf7.ebx, 16);
+                f.avx512dq = has_bit(leaf7.ebx, 17);
+                f.avx512bw = has_bit(leaf7.ebx, 30);
+                f.avx512vl = has_bit(leaf7.ebx, 31);
+                f.avx512vbmi = has_bit(leaf7.ecx, 1);
+                f.avx512vbmi2 = has_bit(leaf7.ecx, 6);
+            }
+            return f;
+        }
+    #else
+        features detect() noexcept {
+            return {};
+        }
+    #endif
+
+        kernel read_kernel_limit() noexcept {
+            kernel limit = kernel::avx512_vbmi2;
+        #if defined(IGUANA_COMPILER_MSVC)
+            char* value = nullptr;
+            std::size_t len = 0;
+            if ((_dupenv_s(&value, &len, "IGUANA_KERNEL") == 0) && (value != nullptr)) {
+                try {
+                    limit = kernel_from_string(value);
+                } catch(const std::invalid_argument&) {}
+                std::free(value);
+            }
+        #else
+            if (const char* value = std::getenv("IGUANA_KERNEL"); value != nullptr) {
+                try {
+                    limit = kernel_from_string(value);
+                } catch(const std::invalid_argument&) {}
+            }
+        #endif
+            return limit;
+        }
+    }
+}
+
+//
+
+iguana::kernel iguana::kernel_from_string(const char* name) {
+    if (std::strcmp(name, "portable") == 0) {
+        return kernel::portable;
+    }
+
+    if (std::strcmp(name, "avx2") == 0) {
+        return kernel::avx2;
+    }
+
+    if (std::strcmp(name, "avx512") == 0) {
+        return kernel::avx512;
+    }
+
+    if (std::strcmp(name, "avx512_vbmi2") == 0) {
+        return kernel::avx512_vbmi2;
+    }
+
+    throw std::invalid_argument(std::string("unrecognized kernel '") + name + "'");
+}
+
+const char* iguana::to_string(kernel k) {
+    switch(k) {
+        case kernel::portable:
+            return "portable";
+
+        case kernel::avx2:
+            return "avx2";
+
+        case kernel::avx512:
+            return "avx512";
+
+        case kernel::avx512_vbmi2:
+            return "avx512_vbmi2";
+
+        default:
+            throw std::invalid_argument("unrecognized kernel value");
+    }
+}
+
+//
+
+const iguana::cpu::features& iguana::cpu::get_features() noexcept {
+    static const features f = detect();
+    return f;
+}
+
+bool iguana::cpu::is_supported(kernel k) noexcept {
+    const auto& f = get_features();
+    switch(k) {
+        case kernel::portable:
+            return true;
+
+        case kernel::avx2:
+            return f.has_avx2();
+
+        case kernel::avx512:
+            return f.has_avx512();
+
+        case kernel::avx512_vbmi2:
+            return f.has_avx512_vbmi2();
+
+        default:
+            return false;
+    }
+}
+
+iguana::kernel iguana::cpu::get_kernel_limit() noexcept {
+    static const kernel limit = read_kernel_limit();
+    return limit;
+}
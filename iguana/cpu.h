@@ -0,0 +1,143 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "common.h"
+
+namespace iguana {
+    // The implementations a codec can select from, ordered from the slowest to the fastest.
+    // Not every codec implements every kernel.
+    enum class kernel : std::uint8_t {
+        portable,
+        avx2,
+        avx512,
+        avx512_vbmi2
+    };
+
+    constexpr const std::size_t kernel_count = std::size_t(kernel::avx512_vbmi2) + 1;
+
+    kernel kernel_from_string(const char* name);
+    const char* to_string(kernel k);
+}
+
+namespace iguana::cpu {
+
+    // The instruction set extensions the SIMD kernels are built with. The extensions with a register state
+    // of their own are only reported when the operating system preserves that state across context switches.
+    struct features final {
+        bool popcnt      = false;
+        bool lzcnt       = false;
+        bool bmi1        = false;
+        bool bmi2        = false;
+        bool avx2        = false;
+        bool avx512f     = false;
+        bool avx512bw    = false;
+        bool avx512vl    = false;
+        bool avx512dq    = false;
+        bool avx512vbmi  = false;
+        bool avx512vbmi2 = false;
+
+        // IGUANA_TARGET_AVX2
+        bool has_avx2() const noexcept {
+            return avx2 && bmi1 && bmi2 && lzcnt && popcnt;
+        }
+
+        // IGUANA_TARGET_AVX512
+        bool has_avx512() const noexcept {
+            return has_avx2() && avx512f && avx512bw && avx512vl && avx512dq;
+        }
+
+        // IGUANA_TARGET_AVX512_VBMI2
+        bool has_avx512_vbmi2() const noexcept {
+            return has_avx512() && avx512vbmi && avx512vbmi2;
+        }
+    };
+
+    // Queries the processor on the first call, so it can be used by the static initializers
+    // of the codecs regardless of their construction order.
+    const features& get_features() noexcept;
+
+    // Whether the processor can run the kernel
+    bool is_supported(kernel k) noexcept;
+
+    // The fastest kernel the codecs select at start-up. The IGUANA_KERNEL environment variable lowers it,
+    // e.g. IGUANA_KERNEL=avx2 keeps the AVX-512 kernels from being selected; unrecognized values are ignored.
+    kernel get_kernel_limit() noexcept;
+
+    // The fastest kernel within the limit that the codec implements, which is at least the portable one
+    template <
+        typename F
+    > kernel select_kernel(F&& implements) {
+        auto k = get_kernel_limit();
+        while((k != kernel::portable) && !(is_supported(k) && implements(k))) {
+            k = kernel(std::uint8_t(k) - 1);
+        }
+        return k;
+    }
+
+    // The implementations of a codec function, indexed by the kernel; nullptr for the kernels it does not implement
+    template <
+        typename F
+    > using kernel_table = std::array<F, kernel_count>;
+
+    // Calls the implementation of the selected kernel. A codec keeps one per function as a static member, shared by
+    // all its instances, and selects the kernel at start-up. It is constant-initialized to the portable kernel,
+    // so it can be called before the selection too.
+    template <
+        typename F
+    > class kernel_dispatch final {
+        const char*             m_name;
+        const kernel_table<F>&  m_table;
+        kernel                  m_kernel = kernel::portable;
+
+    public:
+        constexpr kernel_dispatch(const char* name, const kernel_table<F>& table) noexcept
+          : m_name(name)
+          , m_table(table) {}
+
+        kernel_dispatch(const kernel_dispatch&) = delete;
+        kernel_dispatch& operator =(const kernel_dispatch&) = delete;
+
+    public:
+        template <
+            typename... T_ARGS
+        > decltype(auto) operator ()(T_ARGS&&... args) const {
+            return m_table[std::size_t(m_kernel)](std::forward<T_ARGS>(args)...);
+        }
+
+        kernel get() const noexcept {
+            return m_kernel;
+        }
+
+        bool has(kernel k) const noexcept {
+            return is_supported(k) && (m_table[std::size_t(k)] != nullptr);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        void set(kernel k) {
+            if (!has(k)) {
+                throw std::invalid_argument(std::string("the ") + m_name + " cannot run the " + to_string(k) + " kernel");
+            }
+            m_kernel = k;
+        }
+
+        void select() noexcept {
+            m_kernel = select_kernel([this](kernel k) { return has(k); });
+        }
+    };
+}
@@ -14,18 +14,38 @@
 
 #include <memory>
 #include <utility>
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
+#include <limits>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <string>
 #include "decoder.h"
+#include "cpu.h"
 #include "command.h"
 #include "entropy.h"
 #include "ans1.h"
 #include "ans32.h"
 #include "ans_nibble.h"
+#include "ans_nibble64.h"
+#include "tans.h"
+#include "huffman.h"
 
 //
 
 namespace iguana {
-    void (*decoder::g_Decompress)(context& ctx) = &decoder::decompress_portable;
+    const cpu::kernel_table<decoder::kernel_function> decoder::g_Kernels = {
+        &decoder::decompress_portable,
+#if defined(IGUANA_PROCESSOR_X64)
+        &decoder::decompress_avx2,
+        &decoder::decompress_avx512_generic,
+        &decoder::decompress_avx512_vbmi2
+#endif
+    };
+    cpu::kernel_dispatch<decoder::kernel_function> decoder::g_Decompress("decoder", g_Kernels);
     const internal::initializer<decoder> decoder::g_Initializer;
 
     //
@@ -42,6 +62,9 @@ namespace iguana {
     // for each of the streams, so we need (64 - 1) bytes of valid memory
     // past the end of the buffer.
     static constexpr const std::size_t pad_size = (64 - 1);
+
+    // The output size of a legacy decode_iguana command is only known once it is decoded
+    static constexpr const std::uint64_t unknown_output_size = std::numeric_limits<std::uint64_t>::max();
 }
 
 //
@@ -63,7 +86,23 @@ void iguana::decoder::decode(output_stream& dst, input_stream& src) {
 	}
 
     dst.reserve_more(uncompressed_len);
-    decompress(dst, p_data, uncompressed_len, cursor);
+    decompress(dst, p_data, cursor, uncompressed_len);
+}
+
+void iguana::decoder::set_threads(std::uint32_t n) {
+    m_threads = (n != 0) ? n : std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void iguana::decoder::register_dictionary(std::shared_ptr<const dictionary> dict) {
+    if (!dict) {
+        throw std::invalid_argument("null dictionary");
+    }
+    const auto id = dict->id();
+    m_dictionaries.insert_or_assign(id, std::move(dict));
+}
+
+void iguana::decoder::unregister_dictionary(dictionary::id_type id) noexcept {
+    m_dictionaries.erase(id);
 }
 
 std::uint64_t iguana::decoder::read_control_var_uint(const std::uint8_t* src, ssize_t& cursor) {
@@ -79,20 +118,56 @@ std::uint64_t iguana::decoder::read_control_var_uint(const std::uint8_t* src, ss
     throw out_of_input_data_exception();
 }
 
-void iguana::decoder::decompress(output_stream& dst, const std::uint8_t* const src, std::uint64_t uncompressed_len, ssize_t& ctrl_cursor) {
-    IGUANA_UNIMPLEMENTED
+void iguana::decoder::decompress(output_stream& dst, const std::uint8_t* const src, ssize_t& ctrl_cursor, std::uint64_t output_size) {
+    // The streams holding legacy decode_iguana commands are decoded serially
+    if (const auto n = scan(src, ctrl_cursor); n != unknown_output_size) {
+        if (n != output_size) {
+            throw corrupted_bitstream_exception("the commands do not add up to the stream size");
+        }
+
+        if ((m_threads > 1) && (m_tasks.size() > 1)) {
+            decompress_concurrently(dst, src, output_size);
+            return;
+        }
+    }
 
-/*TODO
-func (d *Decoder) decode(, dst []byte, src []byte) ([]byte, errorCode) {
-	d.reset()
-	var ec errorCode
-*/
+    const auto dst_origin = dst.size();
+    const auto dst_end = dst_origin + std::size_t(output_size);
+    for(const auto& t : m_tasks) {
+        decode_task(t, src, dst, dst_origin, dst_end);
+    }
 
-    context ctx{ .dst = dst, .last_offset = 0 };
+    if (dst.size() != dst_end) {
+        throw corrupted_bitstream_exception("the commands do not add up to the stream size");
+    }
+}
+
+std::uint64_t iguana::decoder::scan(const std::uint8_t* const src, ssize_t& ctrl_cursor) {
+    m_tasks.clear();
+    const dictionary* dict = nullptr;
 
-	// Fetch the header
+    // The outputs of the tasks follow each other
+    std::uint64_t output_size = 0;
+    bool sized = true;
+    const auto add_task = [&](task& t) {
+        if (t.output_size >= unknown_output_size - output_size) {
+            throw corrupted_bitstream_exception("the commands do not add up to the stream size");
+        }
+        t.output_offset = std::exchange(output_size, output_size + t.output_size);
+        sized = sized && (t.cmd != command::decode_iguana);
+        m_tasks.push_back(t);
+    };
+
+    // The data section precedes the control bytes, which are consumed from the end
+    std::uint64_t data_cursor = 0;
+    const auto fetch_data = [&](std::uint64_t n) {
+        if (data_cursor + n > std::uint64_t(ctrl_cursor + 1)) {
+            throw out_of_input_data_exception();
+        }
+        return std::exchange(data_cursor, data_cursor + n);
+    };
 
-	for(std::uint64_t data_cursor = 0;;) {
+	for(;;) {
 		if (ctrl_cursor < 0) {
             throw out_of_input_data_exception();
 		}
@@ -101,203 +176,419 @@ func (d *Decoder) decode(, dst []byte, src []byte) ([]byte, errorCode) {
 		switch (static_cast<command>(cmd & command_mask)) {
             case command::copy_raw: {
                 const std::uint64_t n = read_control_var_uint(src, ctrl_cursor);
-                dst.append(src + data_cursor, n);
-                data_cursor += n;
+                task t{ .cmd = command::copy_raw, .data_offset = fetch_data(n), .data_size = n, .output_size = n, .dict = dict };
+                add_task(t);
             } break;
 
-            case command::decode_ans32: {
+            case command::decode_ans32:
+            case command::decode_ans1:
+            case command::decode_ans_nibble:
+            case command::decode_ans4:
+            case command::decode_ans8:
+            case command::decode_ans_nibble2:
+            case command::decode_ans_nibble64:
+            case command::decode_tans:
+            case command::decode_huffman: {
                 const std::uint64_t len_uncompressed = read_control_var_uint(src, ctrl_cursor);
                 const std::uint64_t len_compressed = read_control_var_uint(src, ctrl_cursor);
+                task t{ .cmd = static_cast<command>(cmd & command_mask), .data_offset = fetch_data(len_compressed), .data_size = len_compressed, .output_size = len_uncompressed, .dict = dict };
+                add_task(t);
+            } break;
 
-                {   typename ans32::decoder::statistics::decoding_table ans_tab;
-                    input_stream is{src + data_cursor, std::size_t(len_compressed)};
-                    data_cursor += len_compressed;
-                    // Recover the ANS decoding table from the input stream                
-                    ans32::decoder::statistics{is}.build_decoding_table(ans_tab);
-
-                    // Decode the compressed content
-                    ans32::decoder{}.decode(dst, static_cast<std::size_t>(len_uncompressed), is, ans_tab);
+            case command::use_dictionary: {
+                const std::uint64_t id = read_control_var_uint(src, ctrl_cursor);
+                const auto it = m_dictionaries.find(dictionary::id_type(id));
+                if ((id > std::numeric_limits<dictionary::id_type>::max()) || (it == m_dictionaries.cend())) {
+                    throw dictionary_mismatch_exception();
                 }
+                dict = it->second.get();
             } break;
 
-		case command::decode_ans1: {
-                const std::uint64_t len_uncompressed = read_control_var_uint(src, ctrl_cursor);
-                const std::uint64_t len_compressed = read_control_var_uint(src, ctrl_cursor);
+            case command::decode_iguana:
+            case command::decode_iguana_block: {
+                task t{ .cmd = static_cast<command>(cmd & command_mask), .dict = dict };
+                if (t.cmd == command::decode_iguana_block) {
+                    const auto flags = read_control_var_uint(src, ctrl_cursor);
+                    if ((flags & ~iguana_block_flags_mask) != 0) {
+                        throw corrupted_bitstream_exception("unrecognized block flags");
+                    }
+                    t.independent = (flags & iguana_block_independent) != 0;
+                    t.output_size = read_control_var_uint(src, ctrl_cursor);
+                } else {
+                    t.independent = false;
+                }
+                t.header = read_control_var_uint(src, ctrl_cursor);
 
-                 {  ans1::decoder::statistics::decoding_table ans_tab;
-                    input_stream is{src + data_cursor, std::size_t(len_compressed)};
-                    data_cursor += len_compressed;
-                    // Recover the ANS decoding table from the input stream                
-                    ans1::decoder::statistics{is}.build_decoding_table(ans_tab);
+                // Fetch the uncompressed substreams' lengths, then the compressed lengths of the entropy-coded ones
+                for(std::size_t i = 0; i != substream::count; ++i) {
+                    t.lens[i] = read_control_var_uint(src, ctrl_cursor);
+                }
 
-                    // Decode the compressed content
-                    ans1::decoder{}.decode(dst, static_cast<std::size_t>(len_uncompressed), is, ans_tab);
+                std::uint64_t n = 0;
+                for(std::size_t i = 0; i != substream::count; ++i) {
+                    switch(static_cast<entropy_mode>((t.header >> (i * 4)) & 0x0f)) {
+                    case entropy_mode::none:
+                        n += t.lens[i];
+                        break;
+
+                    case entropy_mode::ans32:
+                    case entropy_mode::ans1:
+                    case entropy_mode::ans_nibble:
+                    case entropy_mode::ans4:
+                    case entropy_mode::ans8:
+                    case entropy_mode::ans_nibble2:
+                    case entropy_mode::ans_nibble64:
+                    case entropy_mode::tans:
+                    case entropy_mode::huffman:
+                        t.compressed_lens[i] = read_control_var_uint(src, ctrl_cursor);
+                        n += t.compressed_lens[i];
+                        break;
+
+                    default:
+                        throw corrupted_bitstream_exception("unrecognized entropy mode");
+                    }
                 }
+
+                t.data_offset = fetch_data(n);
+                t.data_size = n;
+                add_task(t);
             } break;
 
-		case command::decode_ans_nibble: {
-                const std::uint64_t len_uncompressed = read_control_var_uint(src, ctrl_cursor);
-                const std::uint64_t len_compressed = read_control_var_uint(src, ctrl_cursor);
+            default:
+                throw unrecognized_command_exception();
+		}
 
-                {   ans_nibble::decoder::statistics::decoding_table ans_tab;
-                    input_stream is{src + data_cursor, std::size_t(len_compressed)};
-                    data_cursor += len_compressed;
-                    // Recover the ANS decoding table from the input stream                
-                    ans_nibble::decoder::statistics{is}.build_decoding_table(ans_tab);
+		if ((cmd & last_command_marker) != 0) {
+			return sized ? output_size : unknown_output_size;
+		}
+	}
+}
 
-                    // Decode the compressed content
-                    ans_nibble::decoder{}.decode(dst, static_cast<std::size_t>(len_uncompressed), is, ans_tab);
-                }
+void iguana::decoder::decode_task(const task& t, const std::uint8_t* const src, output_stream& dst, std::size_t dst_origin, std::size_t dst_end) {
+    const auto* const p = src + t.data_offset;
+
+    switch(t.cmd) {
+    case command::copy_raw:
+        dst.append(p, std::size_t(t.data_size));
+        break;
+
+    case command::decode_iguana:
+    case command::decode_iguana_block: {
+            // The output of a legacy command is only bounded by the rest of the stream
+            const auto pos = dst.size();
+            const auto room = (t.cmd == command::decode_iguana_block) ? std::size_t(t.output_size) : (dst_end - std::min(pos, dst_end));
+            dst.resize(pos + room);
+            dst.resize(pos + decode_iguana(t, p, dst.data() + pos, room, pos - dst_origin, m_ent_buf, m_ent_tmp));
+        } break;
+
+    default:
+        decode_entropy_task(t, p, dst);
+    }
+}
 
-                
+void iguana::decoder::decode_task_detached(const task& t, const std::uint8_t* const src, std::uint8_t* out, entropy_buffer& buf, output_stream& tmp) {
+    const auto* const p = src + t.data_offset;
 
+    switch(t.cmd) {
+    case command::copy_raw:
+        std::copy_n(p, std::size_t(t.data_size), out);
+        break;
 
+    case command::decode_iguana_block:
+        decode_iguana(t, p, out, std::size_t(t.output_size), 0, buf, tmp);
+        break;
 
-IGUANA_UNIMPLEMENTED
-/*TODO			encoded, ec := ansNibbleDecodeTable(&d.ansnibtab, ans)
-			if ec != ecOK {
-				return dst, ec
-			}
-			dst, ec = ansNibbleDecodeExplicit(encoded, &d.ansnibtab, int(lenUncompressed), dst)
-			if ec != ecOK {
-				return dst, ec
-			}
-*/
-        } break;
+    default:
+        // The entropy decoders append to a stream, from which the output is moved into place
+        tmp.clear();
+        decode_entropy_task(t, p, tmp);
+        std::copy_n(tmp.data(), tmp.size(), out);
+    }
+}
 
-		case command::decode_iguana: {
-			// Fetch the header byte
-			if (ctrl_cursor < 0) {
-                throw out_of_input_data_exception();
-			}
+std::size_t iguana::decoder::decode_iguana(const task& t, const std::uint8_t* p, std::uint8_t* out, std::size_t out_size, std::size_t history, entropy_buffer& buf, output_stream& tmp) {
+    context ctx{ .dst = out, .dst_size = out_size, .last_offset = init_last_offset, .ec = error_code::ok };
 
-            const std::uint64_t hdr = read_control_var_uint(src, ctrl_cursor);
-        
-			// Fetch the uncompressed streams' lengths
-			if (hdr == 0) {
-				for(std::size_t i = 0; i != substream::count; ++i) {
-                    const std::uint64_t u_len = read_control_var_uint(src, ctrl_cursor);
-                    ctx.streams[i].set(src + data_cursor, std::size_t(u_len));
-                    data_cursor += u_len;
-				}
-			} else {
-				std::uint64_t u_lens[substream::count];
-				std::uint64_t entropy_buffer_size = 0;
-
-				for(std::size_t i = 0; i != substream::count; ++i) {
-                    const std::uint64_t u_len = read_control_var_uint(src, ctrl_cursor);
-					u_lens[i] = u_len;
-					if (const auto em = static_cast<entropy_mode>((hdr >> (i * 4)) & 0x0f); em != entropy_mode::none) {
-						entropy_buffer_size += u_len;
-					}
-				}
+    // An independent block is decoded as if it started the stream
+    if (!t.independent) {
+        ctx.history = history;
+        if (t.dict != nullptr) {
+            ctx.dict = t.dict->data();
+            ctx.dict_size = t.dict->size();
+        }
+    }
 
-                m_ent_buf.reset(entropy_buffer_size + pad_size);                
-				std::uint64_t ent_offs = 0;
-
-				for(std::size_t i = 0; i != substream::count; ++i) {
-					const auto u_len = u_lens[i];
-					if (const auto em = static_cast<entropy_mode>((hdr >> (i * 4)) & 0x0f); em == entropy_mode::none) {
-                        ctx.streams[i].set(src + data_cursor, std::size_t(u_len));
-                       
-
-IGUANA_UNIMPLEMENTED
-		//TODO				ctx.pack[i].set = d.padStream(i, src[dataCursor:dataCursor+uLen])
-						data_cursor += u_len;
-					} else {
-                        const std::uint64_t c_len = read_control_var_uint(src, ctrl_cursor);
-						switch(em) {
-						case entropy_mode::ans32: {
-
-                        // Recover the ANS decoding table from the input stream                
-                        ans32::decoder::statistics::decoding_table ans_tab;
-                        {   input_stream is{src + data_cursor, std::size_t(c_len)};
-                            data_cursor += c_len;
-                            ans32::decoder::statistics{is}.build_decoding_table(ans_tab);
-                        }
-                        
-                        
-                                          
-      
-IGUANA_UNIMPLEMENTED
-/*TODO
-							ans := src[dataCursor : dataCursor+cLen]
-							dataCursor += cLen
-
-							encoded, ec := ansDecodeTable(&d.anstab, ans)
-							if ec != ecOK {
-								return dst, ec
-							}
-
-							buf := d.entbuf[entOffs:entOffs]
-							d.pack[i].data, ec = ans32DecodeExplicit(encoded, &d.anstab, int(uLen), buf)
-							if ec != ecOK {
-								return dst, ec
-							}
-							entOffs += uLen*/
-                        } break;
-
-						case entropy_mode::ans1: {
-IGUANA_UNIMPLEMENTED /*TODO
-							ans := src[dataCursor : dataCursor+cLen]
-							dataCursor += cLen
-
-							encoded, ec := ansDecodeTable(&d.anstab, ans)
-							if ec != ecOK {
-								return dst, ec
-							}
-
-							buf := d.entbuf[entOffs:entOffs]
-							d.pack[i].data, ec = ans1DecodeExplicit(encoded, &d.anstab, int(uLen), buf)
-							if ec != ecOK {
-								return dst, ec
-							}
-							entOffs += uLen*/
-                        } break;
-
-						case entropy_mode::ans_nibble: {
-IGUANA_UNIMPLEMENTED
-/*TODO
-							ansNib := src[dataCursor : dataCursor+cLen]
-							dataCursor += cLen
-
-							encoded, ec := ansNibbleDecodeTable(&d.ansnibtab, ansNib)
-							if ec != ecOK {
-								return dst, ec
-							}
-
-							buf := d.entbuf[entOffs:entOffs]
-							d.pack[i].data, ec = ansNibbleDecodeExplicit(encoded, &d.ansnibtab, int(uLen), buf)
-							if ec != ecOK {
-								return dst, ec
-							}
-							entOffs += uLen
-*/          
-                        } break;
-
-						default:
-							throw corrupted_bitstream_exception("unrecognized entropy mode");
-						}
-					}
-				}
-			}
+    prepare_iguana(t, p, buf, tmp, ctx.streams);
+    g_Decompress(ctx);
+
+    if (ctx.ec != error_code::ok) {
+        exception::from_error(ctx.ec);
+    }
+    if ((t.cmd == command::decode_iguana_block) && (ctx.decoded_size != t.output_size)) {
+        throw corrupted_bitstream_exception("the block does not decode to its size");
+    }
+    return ctx.decoded_size;
+}
 
-			ctx.last_offset = init_last_offset;
-            g_Decompress(ctx);
+void iguana::decoder::decode_entropy_task(const task& t, const std::uint8_t* p, output_stream& dst) {
+    switch(t.cmd) {
+    case command::decode_ans32:
+        decode_entropy<ans32::decoder>(dst, p, t);
+        break;
 
-            if (ctx.ec != error_code::ok) {
-                exception::from_error(ctx.ec);
+    case command::decode_ans1:
+        decode_entropy<ans1::decoder>(dst, p, t);
+        break;
+
+    case command::decode_ans_nibble:
+        decode_entropy<ans_nibble::decoder>(dst, p, t);
+        break;
+
+    case command::decode_ans4:
+        decode_entropy<ans4::decoder>(dst, p, t);
+        break;
+
+    case command::decode_ans8:
+        decode_entropy<ans8::decoder>(dst, p, t);
+        break;
+
+    case command::decode_ans_nibble2:
+        decode_entropy<ans_nibble2::decoder>(dst, p, t);
+        break;
+
+    case command::decode_ans_nibble64:
+        decode_entropy<ans_nibble64::decoder>(dst, p, t);
+        break;
+
+    case command::decode_tans:
+        decode_entropy<tans::decoder>(dst, p, t);
+        break;
+
+    case command::decode_huffman:
+        decode_entropy<huffman::decoder>(dst, p, t);
+        break;
+
+    default:
+        throw unrecognized_command_exception();
+    }
+}
+
+void iguana::decoder::prepare_iguana(const task& t, const std::uint8_t* p, entropy_buffer& buf, output_stream& tmp, substream* streams) {
+    std::uint64_t entropy_buffer_size = 0;
+    for(std::size_t i = 0; i != substream::count; ++i) {
+        if (const auto em = static_cast<entropy_mode>((t.header >> (i * 4)) & 0x0f); em != entropy_mode::none) {
+            entropy_buffer_size += t.lens[i];
+        }
+    }
+
+    buf.reset(entropy_buffer_size + pad_size);
+
+    for(std::size_t i = 0; i != substream::count; ++i) {
+        const auto u_len = std::size_t(t.lens[i]);
+
+        switch(static_cast<entropy_mode>((t.header >> (i * 4)) & 0x0f)) {
+        case entropy_mode::none:
+            streams[i].set(p, u_len);
+            p += u_len;
+            break;
+
+        case entropy_mode::ans32: {
+                input_stream is{p, std::size_t(t.compressed_lens[i])};
+                p += t.compressed_lens[i];
+                streams[i].set(decode_entropy_substream<ans32::decoder>(is, u_len, buf, tmp), u_len);
+            } break;
+
+        case entropy_mode::ans1: {
+                input_stream is{p, std::size_t(t.compressed_lens[i])};
+                p += t.compressed_lens[i];
+                streams[i].set(decode_entropy_substream<ans1::decoder>(is, u_len, buf, tmp), u_len);
+            } break;
+
+        case entropy_mode::ans_nibble: {
+                input_stream is{p, std::size_t(t.compressed_lens[i])};
+                p += t.compressed_lens[i];
+                streams[i].set(decode_entropy_substream<ans_nibble::decoder>(is, u_len, buf, tmp), u_len);
+            } break;
+
+        case entropy_mode::ans4: {
+                input_stream is{p, std::size_t(t.compressed_lens[i])};
+                p += t.compressed_lens[i];
+                streams[i].set(decode_entropy_substream<ans4::decoder>(is, u_len, buf, tmp), u_len);
+            } break;
+
+        case entropy_mode::ans8: {
+                input_stream is{p, std::size_t(t.compressed_lens[i])};
+                p += t.compressed_lens[i];
+                streams[i].set(decode_entropy_substream<ans8::decoder>(is, u_len, buf, tmp), u_len);
+            } break;
+
+        case entropy_mode::ans_nibble2: {
+                input_stream is{p, std::size_t(t.compressed_lens[i])};
+                p += t.compressed_lens[i];
+                streams[i].set(decode_entropy_substream<ans_nibble2::decoder>(is, u_len, buf, tmp), u_len);
+            } break;
+
+        case entropy_mode::ans_nibble64: {
+                input_stream is{p, std::size_t(t.compressed_lens[i])};
+                p += t.compressed_lens[i];
+                streams[i].set(decode_entropy_substream<ans_nibble64::decoder>(is, u_len, buf, tmp), u_len);
+            } break;
+
+        case entropy_mode::tans: {
+                input_stream is{p, std::size_t(t.compressed_lens[i])};
+                p += t.compressed_lens[i];
+                streams[i].set(decode_entropy_substream<tans::decoder>(is, u_len, buf, tmp), u_len);
+            } break;
+
+        case entropy_mode::huffman: {
+                input_stream is{p, std::size_t(t.compressed_lens[i])};
+                p += t.compressed_lens[i];
+                streams[i].set(decode_entropy_substream<huffman::decoder>(is, u_len, buf, tmp), u_len);
+            } break;
+
+        default:
+            throw corrupted_bitstream_exception("unrecognized entropy mode");
+        }
+    }
+}
+
+template <
+    typename T_DECODER
+> void iguana::decoder::decode_entropy(output_stream& dst, const std::uint8_t* p, const task& t) {
+    typename T_DECODER::statistics::decoding_table ans_tab;
+    input_stream is{p, std::size_t(t.data_size)};
+
+    // Recover the ANS decoding table from the input stream
+    typename T_DECODER::statistics{is}.build_decoding_table(ans_tab);
+
+    // Decode the compressed content
+    T_DECODER{}.decode(dst, std::size_t(t.output_size), is, ans_tab);
+}
+
+template <
+    typename T_DECODER
+> const std::uint8_t* iguana::decoder::decode_entropy_substream(input_stream& src, std::size_t len, entropy_buffer& buf, output_stream& tmp) {
+    typename T_DECODER::statistics::decoding_table ans_tab;
+    // Recover the ANS decoding table from the input stream                
+    typename T_DECODER::statistics{src}.build_decoding_table(ans_tab);
+
+    // Decode the substream into the entropy buffer
+    tmp.clear();
+    T_DECODER{}.decode(tmp, len, src, ans_tab);
+    return buf.append(tmp.data(), tmp.size());
+}
+
+//
+
+struct iguana::decoder::job final {
+    enum : std::uint8_t {
+        pending,
+        decoded,
+        failed      // Or skipped after another task failed
+    };
+
+    std::atomic<std::uint8_t>   state = pending;
+};
+
+void iguana::decoder::decompress_concurrently(output_stream& dst, const std::uint8_t* const src, std::uint64_t output_size) {
+    // Every task decodes into its own slot of the output, which is laid out upfront. The worker threads take
+    // the independent tasks in order, while the calling thread decodes the dependent ones in place once everything
+    // preceding them is decoded, and helps the workers in the meantime.
+    const auto dst_origin = dst.size();
+    dst.resize(dst_origin + std::size_t(output_size));
+    auto* const out = dst.data() + dst_origin;
+
+    const auto n_tasks = m_tasks.size();
+    std::vector<std::size_t> independent;
+    for(std::size_t i = 0; i != n_tasks; ++i) {
+        if (m_tasks[i].independent) {
+            independent.push_back(i);
+        }
+    }
+
+    const auto jobs = std::make_unique<job[]>(n_tasks);
+    std::atomic<std::size_t> next_task = 0;
+    std::atomic<bool> cancelled = false;
+    std::exception_ptr failure;
+    std::mutex failure_mutex;
+
+    const auto fail = [&]() {
+        const std::lock_guard lock(failure_mutex);
+        if (!failure) {
+            failure = std::current_exception();
+        }
+        cancelled = true;
+    };
+
+    // Decodes the next independent task, or skips it once a task has failed, and returns false when none is left
+    const auto run_one = [&](entropy_buffer& buf, output_stream& tmp) {
+        const auto k = next_task++;
+        if (k >= independent.size()) {
+            return false;
+        }
+
+        const auto& t = m_tasks[independent[k]];
+        auto& j = jobs[independent[k]];
+        std::uint8_t state = job::failed;
+        if (!cancelled) {
+            try {
+                decode_task_detached(t, src, out + t.output_offset, buf, tmp);
+                state = job::decoded;
+            } catch(...) {
+                fail();
             }
-        } break;
+        }
+        j.state = state;
+        j.state.notify_all();
+        return true;
+    };
+
+    {   // The threads are joined when leaving the scope
+        const auto n_workers = std::min<std::size_t>(m_threads - 1, independent.size());
+        std::vector<std::jthread> threads;
+        threads.reserve(n_workers);
+
+        for(std::size_t i = 0; i != n_workers; ++i) {
+            threads.emplace_back([&]() {
+                entropy_buffer buf{0};
+                output_stream tmp;
+                while(run_one(buf, tmp)) {}
+            });
+        }
 
-		default:
-            throw unrecognized_command_exception();
-		}
+        std::size_t n_decoded = 0;
+        for(std::size_t i = 0; (i != n_tasks) && !cancelled; ++i) {
+            const auto& t = m_tasks[i];
+            if (t.independent) {
+                continue;
+            }
 
-		if ((cmd & last_command_marker) != 0) {
-			return;
-		}
-	}
+            for(; (n_decoded != i) && !cancelled; ++n_decoded) {
+                auto& j = jobs[n_decoded];
+                while(j.state == job::pending) {
+                    if (!run_one(m_ent_buf, m_ent_tmp)) {
+                        j.state.wait(job::pending);
+                    }
+                }
+            }
+            if (cancelled) {
+                break;
+            }
+
+            try {
+                decode_iguana(t, src + t.data_offset, out + t.output_offset, std::size_t(t.output_size), std::size_t(t.output_offset), m_ent_buf, m_ent_tmp);
+                jobs[i].state = job::decoded;
+            } catch(...) {
+                fail();
+            }
+        }
+
+        while(run_one(m_ent_buf, m_ent_tmp)) {}
+    }
+
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
 }
 
 void iguana::decoder::decompress_portable(context& ctx) {
@@ -307,6 +598,8 @@ void iguana::decoder::decompress_portable(context& ctx) {
 	// flag 0-30    - 24-bit offset,  31 match lengths (16-46),    no literal length
 
     auto last_offs = ctx.last_offset;
+    auto* const out = ctx.dst;
+    std::size_t pos = 0;
 
 	// Main Loop : decode sequences
 	while(!ctx.streams[substream::tokens].empty()) {
@@ -329,8 +622,12 @@ void iguana::decoder::decompress_portable(context& ctx) {
 			if (lit_len > 0) {
 				if (const auto seq = ctx.streams[substream::literals].fetch_sequence(lit_len, ctx.ec); ctx.ec != error_code::ok) {
 					return;
+				} else if (seq.size() > ctx.dst_size - pos) {
+                    ctx.ec = error_code::corrupted_bitstream;
+                    return;
 				} else {
-					ctx.dst.append(seq);
+                    std::memcpy(out + pos, seq.data(), seq.size());
+                    pos += seq.size();
 				}
 			}
 
@@ -374,8 +671,28 @@ void iguana::decoder::decompress_portable(context& ctx) {
 			}
 			last_offs = -std::int64_t(x);
 		}
-		const std::uint32_t match = ctx.dst.size() + last_offs;
-		wild_copy(ctx.dst, match, match_len);
+		if (match_len != 0) {
+            const auto offs = std::size_t(-last_offs);
+            const auto history = pos + ctx.history;
+
+            if ((offs == 0) || (offs > history + ctx.dict_size) || (match_len > ctx.dst_size - pos)) {
+                ctx.ec = error_code::corrupted_bitstream;
+                return;
+            }
+
+            if (offs > history) [[unlikely]] {
+                // The match starts within the dictionary, and may run into the output
+                const auto dict_len = std::min<std::size_t>(offs - history, match_len);
+                std::memcpy(out + pos, ctx.dict + (ctx.dict_size - (offs - history)), dict_len);
+                pos += dict_len;
+                match_len -= std::uint32_t(dict_len);
+            }
+
+            if (match_len != 0) {
+		        copy_match(out + pos, offs, match_len);
+                pos += match_len;
+            }
+        }
 	}
 
 	// last literals
@@ -383,43 +700,35 @@ void iguana::decoder::decompress_portable(context& ctx) {
         const auto seq = ctx.streams[substream::literals].fetch_sequence(remainder_len, ctx.ec);
         if (ctx.ec != error_code::ok) {
 			return;
+		} else if (seq.size() > ctx.dst_size - pos) {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
 		} else {
-			ctx.dst.append(seq);
+            std::memcpy(out + pos, seq.data(), seq.size());
+            pos += seq.size();
 		}
 	}
 
 	// end of decoding
+    ctx.decoded_size = pos;
 	ctx.last_offset = last_offs;
     ctx.ec = error_code::ok;
 }
 
-void iguana::decoder::wild_copy(output_stream& dst, std::size_t offs, std::size_t len) {
-IGUANA_UNIMPLEMENTED
-/*TODO
-// append dst[pos:pos+matchlen] to dst
-// taking care to obey overlapped copy semantics
-func iguanaWildCopy(dst []byte, pos, matchlen int) []byte {
-	if pos+matchlen <= len(dst) {
-		// non-overlapped match: just a regular copy
-		return append(dst, dst[pos:pos+matchlen]...)
-	}
-	// slow path: overlapped match;
-	// can't copy in units larger than offset distance
-	for matchlen > 0 {
-		dist := len(dst) - pos
-		if matchlen < dist {
-			dist = matchlen
-		}
-		dst = append(dst, dst[pos:pos+dist]...)
-		pos += dist
-		matchlen -= dist
-	}
-	return dst
-}
-*/
+void iguana::decoder::copy_match(std::uint8_t* dst, std::size_t offs, std::size_t len) noexcept {
+    // The match may overlap its own output. Any multiple of the offset reproduces the same bytes, so the distance
+    // doubles as the output grows, and every copy reads bytes that are already written.
+    for(auto dist = offs; len != 0; dist *= 2) {
+        const auto n = std::min(dist, len);
+        std::memcpy(dst, dst - dist, n);
+        dst += n;
+        len -= n;
+    }
 }
 
-void iguana::decoder::at_process_start() {}
+void iguana::decoder::at_process_start() {
+    g_Decompress.select();
+}
 
 void iguana::decoder::at_process_end() {}
 
@@ -581,6 +890,14 @@ iguana::decoder::entropy_buffer& iguana::decoder::entropy_buffer::operator =(ent
     return *this;
 }
 
+const std::uint8_t* iguana::decoder::entropy_buffer::append(const std::uint8_t* p, std::size_t n) noexcept {
+    assert(m_cursor + n <= m_capacity);
+    auto* const r = m_data + m_cursor;
+    std::memcpy(r, p, n);
+    m_cursor += n;
+    return r;
+}
+
 void iguana::decoder::entropy_buffer::reset(std::size_t n) {
     m_cursor = 0;
 
@@ -13,11 +13,17 @@
 //  limitations under the License.
 
 #pragma once
+#include <memory>
+#include <unordered_map>
+#include <vector>
 #include "common.h"
 #include "span.h"
 #include "error.h"
 #include "input_stream.h"
 #include "output_stream.h"
+#include "command.h"
+#include "dictionary.h"
+#include "cpu.h"
 
 namespace iguana {
     class IGUANA_API decoder {
@@ -26,6 +32,8 @@ namespace iguana {
     private:
         class substream;
         struct context;
+        struct task;
+        struct job;
     
         //
 
@@ -56,23 +64,37 @@ namespace iguana {
                 return m_capacity;
             }
 
+            std::uint8_t* data() noexcept {
+                return m_data;
+            }
+
             void reset() noexcept {
                 m_cursor = 0;
             }
 
             void reset(std::size_t n);
 
+            // Appends n bytes at the cursor and returns their location within the buffer
+            const std::uint8_t* append(const std::uint8_t* p, std::size_t n) noexcept;
+
         private:
             static std::pair<std::uint8_t*, std::size_t> acquire_memory(std::size_t n);
             static void release_memory(std::uint8_t* p);
         };
 
     private:
-        static void (*g_Decompress)(context& ctx);
+        using kernel_function = void (*)(context& ctx);
+
+        static const cpu::kernel_table<kernel_function> g_Kernels;
+        static cpu::kernel_dispatch<kernel_function> g_Decompress;
         static const internal::initializer<decoder> g_Initializer;
 
     private:
         entropy_buffer m_ent_buf;
+        output_stream  m_ent_tmp;
+        std::unordered_map<dictionary::id_type, std::shared_ptr<const dictionary>> m_dictionaries;
+        std::vector<task> m_tasks;
+        std::uint32_t  m_threads = 1;
 
     public:
         decoder() {}
@@ -87,11 +109,71 @@ namespace iguana {
     public:
         void decode(output_stream& dst, input_stream& src);
 
+        // Makes the dictionary available to the streams referring to its id. The dictionary is shared, not copied.
+        void register_dictionary(std::shared_ptr<const dictionary> dict);
+        void unregister_dictionary(dictionary::id_type id) noexcept;
+
+        // The commands of a stream are decoded by up to n threads, 0 stands for the number of hardware threads
+        void set_threads(std::uint32_t n);
+
+        std::uint32_t get_threads() const noexcept {
+            return m_threads;
+        }
+
+        // The kernel is shared by all the decoders, and must not be changed while any of them is decoding
+        static kernel get_kernel() noexcept {
+            return g_Decompress.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_Decompress.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_Decompress.set(k);
+        }
+
     private:
-        void decompress(output_stream& dst, const std::uint8_t* const src, std::uint64_t uncompressed_len, ssize_t& ctrl_cursor);
+        void decompress(output_stream& dst, const std::uint8_t* const src, ssize_t& ctrl_cursor, std::uint64_t output_size);
+        void decompress_concurrently(output_stream& dst, const std::uint8_t* const src, std::uint64_t output_size);
         static void decompress_portable(context& ctx);
+#if defined(IGUANA_PROCESSOR_X64)
+        static void decompress_avx2(context& ctx);
+        static void decompress_avx512_vbmi2(context& ctx);
+        static void decompress_avx512_generic(context& ctx);
+
+        template <
+            typename T_ISA
+        > static void decompress_avx512(context& ctx);
+#endif
+
+        // Reads the control stream into m_tasks, checking that the data sections are within the input, and
+        // returns the size of the output of the tasks, unless a decode_iguana command leaves it open
+        std::uint64_t scan(const std::uint8_t* const src, ssize_t& ctrl_cursor);
+
+        // Appends the output of the task to dst, where the output of the stream spans [dst_origin, dst_end)
+        void decode_task(const task& t, const std::uint8_t* const src, output_stream& dst, std::size_t dst_origin, std::size_t dst_end);
+
+        // Decodes an independent task into out, which has room for its output
+        static void decode_task_detached(const task& t, const std::uint8_t* const src, std::uint8_t* out, entropy_buffer& buf, output_stream& tmp);
+
+        // Decodes into out, which has room for out_size bytes, and returns the size of the output. The output of the stream
+        // preceding out is history bytes long, the matches of a dependent block may reference it.
+        static std::size_t decode_iguana(const task& t, const std::uint8_t* p, std::uint8_t* out, std::size_t out_size, std::size_t history, entropy_buffer& buf, output_stream& tmp);
+        static void decode_entropy_task(const task& t, const std::uint8_t* p, output_stream& dst);
+        static void prepare_iguana(const task& t, const std::uint8_t* p, entropy_buffer& buf, output_stream& tmp, substream* streams);
+
+        template <
+            typename T_DECODER
+        > static void decode_entropy(output_stream& dst, const std::uint8_t* p, const task& t);
+
+        template <
+            typename T_DECODER
+        > static const std::uint8_t* decode_entropy_substream(input_stream& src, std::size_t len, entropy_buffer& buf, output_stream& tmp);
+
         static std::uint64_t read_control_var_uint(const std::uint8_t* src, ssize_t& cursor);
-        static void wild_copy(output_stream& dst, std::size_t offs, std::size_t len);
+        static void copy_match(std::uint8_t* dst, std::size_t offs, std::size_t len) noexcept;
         static void at_process_start();
         static void at_process_end();
     };
@@ -142,6 +224,14 @@ namespace iguana {
             return std::size_t(m_end - m_cursor);
         }
 
+        const std::uint8_t* cursor() const noexcept {
+            return m_cursor;
+        }
+
+        const std::uint8_t* end() const noexcept {
+            return m_end;
+        }
+
         void set(const std::uint8_t* p, const std::uint8_t* e) noexcept {
             m_cursor = p;
             m_end = e;
@@ -165,10 +255,31 @@ namespace iguana {
 
     //
 
+    // A command of the stream, along with the location of its data section
+    struct decoder::task final {
+        command             cmd;
+        std::uint64_t       data_offset = 0;
+        std::uint64_t       data_size = 0;
+        std::uint64_t       output_size = 0;                        // Not known up front for decode_iguana
+        std::uint64_t       output_offset = 0;                      // The position of the output within the one of the stream
+        bool                independent = true;                     // Whether the output preceding the task is not referenced
+        std::uint64_t       header = 0;                             // decode_iguana(_block): the entropy modes of the substreams
+        std::uint64_t       lens[substream::count] = {};            // decode_iguana(_block): the uncompressed substream lengths
+        std::uint64_t       compressed_lens[substream::count] = {}; // decode_iguana(_block): the lengths of the entropy-coded substreams
+        const dictionary*   dict = nullptr;
+    };
+
+    //
+
     struct decoder::context final {
-        substream       streams[substream::count];
-        output_stream&  dst;
-        std::int64_t    last_offset;
-        error_code      ec;
+        substream           streams[substream::count];
+        std::uint8_t*       dst;                // Nothing is written past dst_size bytes
+        std::size_t         dst_size;
+        std::size_t         decoded_size = 0;   // The size of the output, set by the kernel
+        std::size_t         history = 0;        // The output preceding dst the matches may reference
+        const std::uint8_t* dict = nullptr;     // The dictionary immediately preceding the history, if any
+        std::size_t         dict_size = 0;
+        std::int64_t        last_offset;
+        error_code          ec;
     };
 }
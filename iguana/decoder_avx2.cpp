@@ -0,0 +1,267 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "common.h"
+
+#if defined(IGUANA_PROCESSOR_X64)
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+#include "decoder.h"
+#include "lz_common.h"
+
+// The AVX2 sequence decoder. AVX2 has neither the byte-granular masked loads nor the expansions the AVX-512 kernels
+// gather the token parameters with, so only the token classification is vectorized: every group of 32 tokens is
+// turned into bit masks telling which parameters each token needs, and the parameters are fetched one by one.
+// The literals and matches are copied 32 bytes at a time, as in COPY_SINGLE_ITEM.
+
+namespace iguana {
+    namespace {
+        constexpr const std::size_t avx2_copy_size = 32;
+        constexpr const std::size_t avx2_group_size = 32;
+
+        // A bit per token of the group
+        struct avx2_token_classes final {
+            std::uint32_t is_long;
+            std::uint32_t needs_offset16;
+            std::uint32_t needs_var_lit;
+            std::uint32_t needs_var_match;
+        };
+
+        IGUANA_TARGET_AVX2 inline avx2_token_classes avx2_classify_tokens(const std::uint8_t* p) noexcept {
+            const __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            const __m256i is_long = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(char(lz::last_long_offset))), t);
+            const __m256i lll = _mm256_and_si256(t, _mm256_set1_epi8(char(lz::max_short_lit_len)));
+            const __m256i mmmm = _mm256_and_si256(t, _mm256_set1_epi8(char(lz::max_short_match_len << lz::literal_len_bits)));
+
+            const __m256i var_lit = _mm256_andnot_si256(is_long, _mm256_cmpeq_epi8(lll, _mm256_set1_epi8(char(lz::max_short_lit_len))));
+            const __m256i var_match = _mm256_or_si256(
+                _mm256_andnot_si256(is_long, _mm256_cmpeq_epi8(mmmm, _mm256_set1_epi8(char(lz::max_short_match_len << lz::literal_len_bits)))),
+                _mm256_cmpeq_epi8(t, _mm256_set1_epi8(char(lz::last_long_offset))));
+
+            // The short tokens with the top bit clear carry a new 16-bit offset
+            const auto long_mask = std::uint32_t(_mm256_movemask_epi8(is_long));
+            return {
+                .is_long = long_mask,
+                .needs_offset16 = ~(long_mask | std::uint32_t(_mm256_movemask_epi8(t))),
+                .needs_var_lit = std::uint32_t(_mm256_movemask_epi8(var_lit)),
+                .needs_var_match = std::uint32_t(_mm256_movemask_epi8(var_match))
+            };
+        }
+
+        IGUANA_TARGET_AVX2 inline void avx2_copy32(std::uint8_t* dst, const std::uint8_t* src) noexcept {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+        }
+
+        // See avx512_copy_match
+        IGUANA_TARGET_AVX2 inline void avx2_copy_match(std::uint8_t* dst, std::size_t offs, std::size_t len) noexcept {
+            auto* const end = dst + len;
+            std::size_t dist = offs;
+
+            while(dst < end) {
+                avx2_copy32(dst, dst - dist);
+                if (dist < avx2_copy_size) {
+                    dst += dist;
+                    dist *= 2;
+                } else {
+                    dst += avx2_copy_size;
+                }
+            }
+        }
+
+        inline bool avx2_fetch_var_uint(const std::uint8_t*& p, const std::uint8_t* e, std::uint32_t& v) noexcept {
+            if (p == e) {
+                return false;
+            }
+
+            const std::uint32_t a = *p++;
+            if (a < 0xfe) [[likely]] {
+                v = a;
+                return true;
+            }
+
+            const std::size_t k = (a == 0xfe) ? 2 : 3;
+            if (std::size_t(e - p) < k) {
+                return false;
+            }
+
+            v = 0;
+            for(auto j = k; j != 0; --j) {
+                v = (v * 254) + p[j - 1];
+            }
+            p += k;
+            return true;
+        }
+    }
+}
+
+//
+
+IGUANA_TARGET_AVX2 void iguana::decoder::decompress_avx2(context& ctx) {
+    auto* const base = ctx.dst;
+    const auto size = ctx.dst_size;
+    const auto* tok = ctx.streams[substream::tokens].cursor();
+    const auto* const tok_end = ctx.streams[substream::tokens].end();
+    const auto* off16 = ctx.streams[substream::offset16].cursor();
+    const auto* const off16_end = ctx.streams[substream::offset16].end();
+    const auto* off24 = ctx.streams[substream::offset24].cursor();
+    const auto* const off24_end = ctx.streams[substream::offset24].end();
+    const auto* var_lit = ctx.streams[substream::var_lit_len].cursor();
+    const auto* const var_lit_end = ctx.streams[substream::var_lit_len].end();
+    const auto* var_match = ctx.streams[substream::var_match_len].cursor();
+    const auto* const var_match_end = ctx.streams[substream::var_match_len].end();
+    const auto* lit = ctx.streams[substream::literals].cursor();
+    const auto* const lit_end = ctx.streams[substream::literals].end();
+    const auto* const dict_end = ctx.dict + ctx.dict_size;
+
+    auto last_offs = std::size_t(-ctx.last_offset);
+    std::size_t pos = 0;
+    auto ec = error_code::ok;
+
+    alignas(32) std::uint8_t tail[avx2_group_size];
+
+    while((tok != tok_end) && (ec == error_code::ok)) {
+        const auto n = std::min<std::size_t>(std::size_t(tok_end - tok), avx2_group_size);
+        const auto* group = tok;
+        if (n != avx2_group_size) {
+            std::memset(tail, 0, sizeof(tail));
+            std::memcpy(tail, tok, n);
+            group = tail;
+        }
+        tok += n;
+
+        const auto classes = avx2_classify_tokens(group);
+
+        for(std::size_t i = 0; i != n; ++i) {
+            const std::uint32_t token = group[i];
+            const auto bit = std::uint32_t(1) << i;
+
+            std::uint32_t lit_len = 0;
+            std::uint32_t match_len = 0;
+            std::uint32_t v = 0;
+
+            if ((classes.is_long & bit) != 0) {
+                match_len = token + lz::mm_long_offsets;
+                if (std::size_t(off24_end - off24) < 3) {
+                    ec = error_code::out_of_input_data;
+                    break;
+                }
+                last_offs = std::uint32_t(off24[0]) | (std::uint32_t(off24[1]) << 8) | (std::uint32_t(off24[2]) << 16);
+                off24 += 3;
+            } else {
+                lit_len = token & lz::max_short_lit_len;
+                if ((classes.needs_var_lit & bit) != 0) {
+                    if (!avx2_fetch_var_uint(var_lit, var_lit_end, v)) {
+                        ec = error_code::out_of_input_data;
+                        break;
+                    }
+                    lit_len += v;
+                }
+
+                match_len = (token >> lz::literal_len_bits) & lz::max_short_match_len;
+                if ((classes.needs_offset16 & bit) != 0) {
+                    if (std::size_t(off16_end - off16) < 2) {
+                        ec = error_code::out_of_input_data;
+                        break;
+                    }
+                    last_offs = std::uint32_t(off16[0]) | (std::uint32_t(off16[1]) << 8);
+                    off16 += 2;
+                }
+            }
+
+            if ((classes.needs_var_match & bit) != 0) {
+                if (!avx2_fetch_var_uint(var_match, var_match_end, v)) {
+                    ec = error_code::out_of_input_data;
+                    break;
+                }
+                match_len += v;
+            }
+
+            if (lit_len > std::size_t(lit_end - lit)) {
+                ec = error_code::out_of_input_data;
+                break;
+            }
+
+            // The copies are done 32 bytes at a time where they cannot run past the literals or the output
+            const auto item_end = pos + lit_len + match_len;
+            if (item_end > size) {
+                ec = error_code::corrupted_bitstream;
+                break;
+            }
+            const bool wild = ((std::size_t(lit_end - lit) - lit_len) >= avx2_copy_size) && (item_end + avx2_copy_size <= size);
+
+            auto* out = base + pos;
+
+            if (wild) [[likely]] {
+                avx2_copy32(out, lit);
+                for(std::size_t k = avx2_copy_size; k < lit_len; k += avx2_copy_size) {
+                    avx2_copy32(out + k, lit + k);
+                }
+            } else {
+                std::memcpy(out, lit, lit_len);
+            }
+            out += lit_len;
+            lit += lit_len;
+
+            if (match_len != 0) {
+                if (const auto history = std::size_t(out - base) + ctx.history; last_offs - 1 >= history) [[unlikely]] {
+                    // The match starts within the dictionary, and may run into the output
+                    if ((last_offs == 0) || (last_offs > history + ctx.dict_size)) {
+                        pos = std::size_t(out - base);
+                        ec = error_code::corrupted_bitstream;
+                        break;
+                    }
+                    const auto dict_len = std::min<std::size_t>(last_offs - history, match_len);
+                    std::memcpy(out, dict_end - (last_offs - history), dict_len);
+                    out += dict_len;
+                    match_len -= std::uint32_t(dict_len);
+                }
+
+                if (wild) [[likely]] {
+                    avx2_copy_match(out, last_offs, match_len);
+                    out += match_len;
+                } else {
+                    for(auto* const end = out + match_len; out != end; ++out) {
+                        *out = *(out - last_offs);
+                    }
+                }
+            }
+            pos = std::size_t(out - base);
+        }
+    }
+
+    // last literals
+    if (ec == error_code::ok) {
+        const auto remainder_len = std::size_t(lit_end - lit);
+        if (remainder_len > size - pos) {
+            ec = error_code::corrupted_bitstream;
+        } else {
+            std::memcpy(base + pos, lit, remainder_len);
+            pos += remainder_len;
+            lit = lit_end;
+        }
+    }
+    ctx.decoded_size = pos;
+
+    ctx.streams[substream::tokens].set(tok, tok_end);
+    ctx.streams[substream::offset16].set(off16, off16_end);
+    ctx.streams[substream::offset24].set(off24, off24_end);
+    ctx.streams[substream::var_lit_len].set(var_lit, var_lit_end);
+    ctx.streams[substream::var_match_len].set(var_match, var_match_end);
+    ctx.streams[substream::literals].set(lit, lit_end);
+    ctx.last_offset = -std::int64_t(last_offs);
+    ctx.ec = ec;
+}
+
+#endif
@@ -0,0 +1,386 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "common.h"
+
+#if defined(IGUANA_PROCESSOR_X64)
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <immintrin.h>
+#include "decoder.h"
+#include "bitops.h"
+#include "lz_common.h"
+
+// The AVX-512 sequence decoders are ports of decompressIguanaAVX512VBMI2 and decompressIguanaAVX512Generic.
+// The tokens are classified 16 at a time, their parameters are fetched from the substreams with a single
+// load per substream and distributed to the requesting tokens with expansions. Every literal and match is then
+// copied in 32-byte units, which may write past its end, wherever that stays within the output.
+
+namespace iguana {
+    namespace {
+        constexpr const std::size_t avx512_copy_size = 32;
+        constexpr const std::size_t avx512_group_size = 16;
+
+        // Selects the bytes [3*i, 3*i + 3) for the lane i, the top byte is zeroed by the mask
+        alignas(64) constexpr const std::uint8_t avx512_uint24_expander_vbmi[64] = {
+             0,  1,  2, 0,  3,  4,  5, 0,  6,  7,  8, 0,  9, 10, 11, 0,
+            12, 13, 14, 0, 15, 16, 17, 0, 18, 19, 20, 0, 21, 22, 23, 0,
+            24, 25, 26, 0, 27, 28, 29, 0, 30, 31, 32, 0, 33, 34, 35, 0,
+            36, 37, 38, 0, 39, 40, 41, 0, 42, 43, 44, 0, 45, 46, 47, 0
+        };
+
+        // Without VBMI, the 12 bytes of every group of 4 values are first moved into their own 128-bit lane,
+        // where they are spread by a byte shuffle
+        alignas(64) constexpr const std::uint32_t avx512_uint24_lanes_generic[16] = {
+            0, 1, 2, 2, 3, 4, 5, 5, 6, 7, 8, 8, 9, 10, 11, 11
+        };
+
+        alignas(64) constexpr const std::uint8_t avx512_uint24_shuffle_generic[64] = {
+            0, 1, 2, 0x80, 3, 4, 5, 0x80, 6, 7, 8, 0x80, 9, 10, 11, 0x80,
+            0, 1, 2, 0x80, 3, 4, 5, 0x80, 6, 7, 8, 0x80, 9, 10, 11, 0x80,
+            0, 1, 2, 0x80, 3, 4, 5, 0x80, 6, 7, 8, 0x80, 9, 10, 11, 0x80,
+            0, 1, 2, 0x80, 3, 4, 5, 0x80, 6, 7, 8, 0x80, 9, 10, 11, 0x80
+        };
+
+        // Signals a var_uint sequence running past the end of its substream
+        constexpr const std::size_t avx512_var_uint_overrun = std::numeric_limits<std::size_t>::max();
+
+        //
+
+        IGUANA_TARGET_AVX512 inline __mmask64 avx512_load_mask(std::size_t n) noexcept {
+            return _bzhi_u64(~std::uint64_t(0), unsigned(std::min<std::size_t>(n, 64)));
+        }
+
+        IGUANA_TARGET_AVX512 inline void avx512_copy32(std::uint8_t* dst, const std::uint8_t* src) noexcept {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+        }
+
+        // Copies len bytes from (dst - offs), obeying the overlapped copy semantics. When the match overlaps itself,
+        // only the first (dist) bytes of every 32-byte copy are valid. Any multiple of the offset reproduces the same
+        // periodic content, so the distance doubles as the output grows instead of crawling at the offset.
+        IGUANA_TARGET_AVX512 inline void avx512_copy_match(std::uint8_t* dst, std::size_t offs, std::size_t len) noexcept {
+            auto* const end = dst + len;
+            std::size_t dist = offs;
+
+            while(dst < end) {
+                avx512_copy32(dst, dst - dist);
+                if (dist < avx512_copy_size) {
+                    dst += dist;
+                    dist *= 2;
+                } else {
+                    dst += avx512_copy_size;
+                }
+            }
+        }
+
+        // The sum of the lanes, taken in 64 bits so that no group of var_uint lengths can overflow it
+        IGUANA_TARGET_AVX512 inline std::size_t avx512_sum_lengths(__m512i v) noexcept {
+            const __m512i lo = _mm512_cvtepu32_epi64(_mm512_castsi512_si256(v));
+            const __m512i hi = _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(v, 1));
+            return std::size_t(_mm512_reduce_add_epi64(_mm512_add_epi64(lo, hi)));
+        }
+
+        //
+
+        // VBMI provides the byte permutation, VBMI2 the byte compression and expansion
+        struct avx512_vbmi2_isa final {
+            IGUANA_TARGET_AVX512_VBMI2 static __m512i expand_uint24(__m512i v) noexcept {
+                const __m512i expander = _mm512_load_si512(avx512_uint24_expander_vbmi);
+                return _mm512_maskz_permutexvar_epi8(0x7777777777777777ull, expander, v);
+            }
+
+            // Decodes the first n var_uints of the 64 bytes in v, some of which are above 0xfd, i.e. prefixes.
+            // A 0xfe prefix is followed by 2 payload bytes and 0xff by 3, and all the payload bytes are below 0xfe.
+            IGUANA_TARGET_AVX512_VBMI2 static __m512i decode_wide_var_uints(const std::uint8_t*, const std::uint8_t*, __m512i v, std::uint64_t plain, unsigned n, std::size_t& consumed) noexcept {
+                constexpr const std::uint64_t nibbles = 0x1111111111111111ull;
+
+                // The prefixes cover 3 or 4 bytes, the values start at the prefixes and at the uncovered plain bytes
+                const std::uint64_t prefixes = ~plain;
+                const std::uint64_t ff = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(-1));
+                const std::uint64_t starts = ((prefixes * 7) + (ff << 3)) ^ plain;
+
+                // A nibble per value: its payload bytes are 0b0001, 0b0011 or 0b0111, its whole bytes 0b0001, 0b1011 or 0b1111
+                const std::uint64_t is_prefixed = _pdep_u64(_pext_u64(prefixes, starts), nibbles);
+                const std::uint64_t is_ff = _pdep_u64(_pext_u64(ff, starts), nibbles);
+                const std::uint64_t payload_layout = nibbles + (is_prefixed << 1) + (is_ff << 2);
+                consumed = bit::count_set(_bzhi_u64(payload_layout + (is_prefixed << 3), n * 4));
+
+                // x := a0 + 256*a1 + 65536*a2, the value is a0 + 254*a1 + 254*254*a2
+                const __m512i x = _mm512_maskz_expand_epi8(payload_layout, _mm512_maskz_compress_epi8(plain, v));
+                const __m512i a1_a2 = _mm512_srli_epi32(x, 8);
+                const __m512i a2 = _mm512_srli_epi32(x, 16);
+                const __m512i r = _mm512_sub_epi32(x, _mm512_add_epi32(a1_a2, a1_a2));
+                return _mm512_add_epi32(_mm512_sub_epi32(r, _mm512_slli_epi32(a2, 9)), _mm512_slli_epi32(a2, 2));
+            }
+        };
+
+        struct avx512_generic_isa final {
+            IGUANA_TARGET_AVX512 static __m512i expand_uint24(__m512i v) noexcept {
+                const __m512i lanes = _mm512_permutexvar_epi32(_mm512_load_si512(avx512_uint24_lanes_generic), v);
+                return _mm512_shuffle_epi8(lanes, _mm512_load_si512(avx512_uint24_shuffle_generic));
+            }
+
+            // The values are rare enough not to justify emulating the byte compression without VBMI2
+            IGUANA_TARGET_AVX512 static __m512i decode_wide_var_uints(const std::uint8_t* p, const std::uint8_t* e, __m512i, std::uint64_t, unsigned n, std::size_t& consumed) noexcept {
+                alignas(64) std::uint32_t values[avx512_group_size] = {};
+                const auto* q = p;
+
+                for(unsigned i = 0; i != n; ++i) {
+                    if (q == e) {
+                        consumed = avx512_var_uint_overrun;
+                        return _mm512_setzero_si512();
+                    }
+
+                    const std::uint32_t a = *q++;
+                    if (a < 0xfe) {
+                        values[i] = a;
+                        continue;
+                    }
+
+                    const std::size_t k = (a == 0xfe) ? 2 : 3;
+                    if (std::size_t(e - q) < k) {
+                        consumed = avx512_var_uint_overrun;
+                        return _mm512_setzero_si512();
+                    }
+
+                    std::uint32_t x = 0;
+                    for(auto j = k; j != 0; --j) {
+                        x = (x * 254) + q[j - 1];
+                    }
+                    values[i] = x;
+                    q += k;
+                }
+
+                consumed = std::size_t(q - p);
+                return _mm512_load_si512(values);
+            }
+        };
+
+        // Returns the first n var_uints at p as 32-bit lanes. The consumed byte count is not checked against e.
+        template <
+            typename T_ISA
+        > IGUANA_TARGET_AVX512 inline __m512i avx512_decode_var_uints(const std::uint8_t* p, const std::uint8_t* e, unsigned n, std::size_t& consumed) noexcept {
+            const __m512i v = _mm512_maskz_loadu_epi8(avx512_load_mask(std::size_t(e - p)), p);
+            const std::uint64_t plain = _mm512_cmple_epu8_mask(v, _mm512_set1_epi8(char(0xfd)));
+
+            if (const auto requested = _bzhi_u64(~std::uint64_t(0), n); (plain & requested) == requested) [[likely]] {
+                consumed = n;
+                return _mm512_cvtepu8_epi32(_mm512_castsi512_si128(v));
+            }
+            return T_ISA::decode_wide_var_uints(p, e, v, plain, n, consumed);
+        }
+    }
+}
+
+//
+
+template <
+    typename T_ISA
+> IGUANA_TARGET_AVX512 void iguana::decoder::decompress_avx512(context& ctx) {
+    auto* const base = ctx.dst;
+    const auto size = ctx.dst_size;
+    const auto* tok = ctx.streams[substream::tokens].cursor();
+    const auto* const tok_end = ctx.streams[substream::tokens].end();
+    const auto* off16 = ctx.streams[substream::offset16].cursor();
+    const auto* const off16_end = ctx.streams[substream::offset16].end();
+    const auto* off24 = ctx.streams[substream::offset24].cursor();
+    const auto* const off24_end = ctx.streams[substream::offset24].end();
+    const auto* var_lit = ctx.streams[substream::var_lit_len].cursor();
+    const auto* const var_lit_end = ctx.streams[substream::var_lit_len].end();
+    const auto* var_match = ctx.streams[substream::var_match_len].cursor();
+    const auto* const var_match_end = ctx.streams[substream::var_match_len].end();
+    const auto* lit = ctx.streams[substream::literals].cursor();
+    const auto* const lit_end = ctx.streams[substream::literals].end();
+    const auto* const dict_end = ctx.dict + ctx.dict_size;
+
+    auto last_offs = std::size_t(-ctx.last_offset);
+    std::size_t pos = 0;
+    auto ec = error_code::ok;
+
+    alignas(64) std::uint32_t lit_lens[avx512_group_size];
+    alignas(64) std::uint32_t match_lens[avx512_group_size];
+    alignas(64) std::uint32_t offsets[avx512_group_size];
+
+    while(tok != tok_end) {
+        const auto n = unsigned(std::min<std::size_t>(std::size_t(tok_end - tok), avx512_group_size));
+        const auto valid = __mmask16(_bzhi_u32(0xffff, n));
+        const __m512i t = _mm512_cvtepu8_epi32(_mm_maskz_loadu_epi8(valid, tok));
+        tok += n;
+
+        // Classify the tokens, see decompress_portable for the layout
+        const __mmask16 is_long = _mm512_mask_cmplt_epu32_mask(valid, t, _mm512_set1_epi32(lz::last_long_offset + 1));
+        const __mmask16 is_short = valid & __mmask16(~is_long);
+        const __mmask16 needs_offset16 = _mm512_mask_cmplt_epu32_mask(is_short, t, _mm512_set1_epi32(lz::last_offset_flag));
+        const __mmask16 needs_offset24 = is_long;
+
+        const __m512i short_match = _mm512_maskz_and_epi32(is_short, _mm512_srli_epi32(t, lz::literal_len_bits), _mm512_set1_epi32(lz::max_short_match_len));
+        const __mmask16 needs_var_match = _mm512_mask_cmpeq_epi32_mask(is_short, short_match, _mm512_set1_epi32(lz::max_short_match_len))
+                                        | _mm512_mask_cmpeq_epi32_mask(is_long, t, _mm512_set1_epi32(lz::last_long_offset));
+        __m512i match = _mm512_mask_add_epi32(short_match, is_long, t, _mm512_set1_epi32(lz::mm_long_offsets));
+
+        __m512i lits = _mm512_maskz_and_epi32(is_short, t, _mm512_set1_epi32(lz::max_short_lit_len));
+        const __mmask16 needs_var_lit = _mm512_mask_cmpeq_epi32_mask(is_short, lits, _mm512_set1_epi32(lz::max_short_lit_len));
+
+        // Fetch the parameters and hand them to the requesting tokens
+        if (needs_var_lit != 0) {
+            std::size_t consumed = 0;
+            const auto v = avx512_decode_var_uints<T_ISA>(var_lit, var_lit_end, bit::count_set(unsigned(needs_var_lit)), consumed);
+            if (consumed > std::size_t(var_lit_end - var_lit)) {
+                ec = error_code::out_of_input_data;
+                break;
+            }
+            var_lit += consumed;
+            lits = _mm512_add_epi32(lits, _mm512_maskz_expand_epi32(needs_var_lit, v));
+        }
+
+        if (needs_var_match != 0) {
+            std::size_t consumed = 0;
+            const auto v = avx512_decode_var_uints<T_ISA>(var_match, var_match_end, bit::count_set(unsigned(needs_var_match)), consumed);
+            if (consumed > std::size_t(var_match_end - var_match)) {
+                ec = error_code::out_of_input_data;
+                break;
+            }
+            var_match += consumed;
+            match = _mm512_add_epi32(match, _mm512_maskz_expand_epi32(needs_var_match, v));
+        }
+
+        __m512i offs = _mm512_setzero_si512();
+        if (needs_offset16 != 0) {
+            const std::size_t len = bit::count_set(unsigned(needs_offset16)) * sizeof(std::uint16_t);
+            if (len > std::size_t(off16_end - off16)) {
+                ec = error_code::out_of_input_data;
+                break;
+            }
+            const __m256i v = _mm256_maskz_loadu_epi8(__mmask32(avx512_load_mask(len)), off16);
+            off16 += len;
+            offs = _mm512_maskz_expand_epi32(needs_offset16, _mm512_cvtepu16_epi32(v));
+        }
+
+        if (needs_offset24 != 0) {
+            const std::size_t len = bit::count_set(unsigned(needs_offset24)) * 3;
+            if (len > std::size_t(off24_end - off24)) {
+                ec = error_code::out_of_input_data;
+                break;
+            }
+            const __m512i v = _mm512_maskz_loadu_epi8(avx512_load_mask(len), off24);
+            off24 += len;
+            offs = _mm512_mask_expand_epi32(offs, needs_offset24, T_ISA::expand_uint24(v));
+        }
+
+        const std::size_t lit_total = avx512_sum_lengths(lits);
+        if (lit_total > std::size_t(lit_end - lit)) {
+            ec = error_code::out_of_input_data;
+            break;
+        }
+
+        // The group must fit within the output. The copies are done 32 bytes at a time only when that cannot
+        // run past the end of the literals or of the output.
+        const auto group_end = pos + lit_total + avx512_sum_lengths(match);
+        if (group_end > size) {
+            ec = error_code::corrupted_bitstream;
+            break;
+        }
+        const bool wild = ((std::size_t(lit_end - lit) - lit_total) >= avx512_copy_size) && (group_end + avx512_copy_size <= size);
+
+        _mm512_store_si512(lit_lens, lits);
+        _mm512_store_si512(match_lens, match);
+        _mm512_store_si512(offsets, offs);
+        const unsigned new_offsets = needs_offset16 | needs_offset24;
+
+        const auto* const history_begin = base - ctx.history;
+        auto* out = base + pos;
+
+        for(unsigned i = 0; i != n; ++i) {
+            const std::size_t lit_len = lit_lens[i];
+            if (wild) [[likely]] {
+                avx512_copy32(out, lit);
+                for(std::size_t k = avx512_copy_size; k < lit_len; k += avx512_copy_size) {
+                    avx512_copy32(out + k, lit + k);
+                }
+            } else {
+                std::memcpy(out, lit, lit_len);
+            }
+            out += lit_len;
+            lit += lit_len;
+
+            if (((new_offsets >> i) & 1) != 0) {
+                last_offs = offsets[i];
+            }
+
+            std::size_t match_len = match_lens[i];
+            if (match_len == 0) {
+                continue;
+            }
+
+            if (const auto history = std::size_t(out - history_begin); last_offs - 1 >= history) [[unlikely]] {
+                // The match starts within the dictionary, and may run into the output
+                if ((last_offs == 0) || (last_offs > history + ctx.dict_size)) {
+                    ec = error_code::corrupted_bitstream;
+                    break;
+                }
+                const auto dict_len = std::min(last_offs - history, match_len);
+                std::memcpy(out, dict_end - (last_offs - history), dict_len);
+                out += dict_len;
+                match_len -= dict_len;
+            }
+
+            if (wild) [[likely]] {
+                avx512_copy_match(out, last_offs, match_len);
+                out += match_len;
+            } else {
+                for(auto* const end = out + match_len; out != end; ++out) {
+                    *out = *(out - last_offs);
+                }
+            }
+        }
+
+        pos = std::size_t(out - base);
+        if (ec != error_code::ok) {
+            break;
+        }
+    }
+
+    // last literals
+    if (ec == error_code::ok) {
+        const auto remainder_len = std::size_t(lit_end - lit);
+        if (remainder_len > size - pos) {
+            ec = error_code::corrupted_bitstream;
+        } else {
+            std::memcpy(base + pos, lit, remainder_len);
+            pos += remainder_len;
+            lit = lit_end;
+        }
+    }
+    ctx.decoded_size = pos;
+
+    ctx.streams[substream::tokens].set(tok, tok_end);
+    ctx.streams[substream::offset16].set(off16, off16_end);
+    ctx.streams[substream::offset24].set(off24, off24_end);
+    ctx.streams[substream::var_lit_len].set(var_lit, var_lit_end);
+    ctx.streams[substream::var_match_len].set(var_match, var_match_end);
+    ctx.streams[substream::literals].set(lit, lit_end);
+    ctx.last_offset = -std::int64_t(last_offs);
+    ctx.ec = ec;
+}
+
+IGUANA_TARGET_AVX512_VBMI2 void iguana::decoder::decompress_avx512_vbmi2(context& ctx) {
+    decompress_avx512<avx512_vbmi2_isa>(ctx);
+}
+
+IGUANA_TARGET_AVX512 void iguana::decoder::decompress_avx512_generic(context& ctx) {
+    decompress_avx512<avx512_generic_isa>(ctx);
+}
+
+#endif
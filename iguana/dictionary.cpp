@@ -0,0 +1,88 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdexcept>
+#include "dictionary.h"
+#include "error.h"
+
+//
+
+iguana::dictionary::dictionary(const std::uint8_t* p, std::size_t n)
+  : dictionary(p, n, compute_id(p, n)) {}
+
+iguana::dictionary::dictionary(const std::uint8_t* p, std::size_t n, id_type id)
+  : m_content(p, p + n)
+  , m_id(id) {
+
+    if (n > max_size) {
+        throw std::invalid_argument("the dictionary exceeds the maximum size");
+    }
+}
+
+iguana::dictionary::dictionary(const std::uint8_t* p, std::size_t n, id_type id, const ans::byte_statistics& literal_statistics)
+  : dictionary(p, n, id) {
+    m_literal_statistics = literal_statistics;
+}
+
+iguana::dictionary::dictionary(input_stream& s) {
+    // [id: 4][size: 4][flags: 1][content][literal statistics]
+    const auto read_uint32 = [&s]() {
+        const auto* const p = s.data();
+        s.consume_from_start(sizeof(std::uint32_t));
+        return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8) | (std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24);
+    };
+
+    if (s.size() < header_size) {
+        throw wrong_source_size_exception();
+    }
+
+    m_id = read_uint32();
+    const auto n = read_uint32();
+    const auto flags = s[0];
+    s.consume_from_start(1);
+
+    if ((n > max_size) || (n > s.size()) || ((flags & ~flag_literal_statistics) != 0)) {
+        throw corrupted_bitstream_exception();
+    }
+
+    m_content.assign(s.data(), s.data() + n);
+    s.consume_from_start(n);
+
+    if ((flags & flag_literal_statistics) != 0) {
+        m_literal_statistics.emplace(s);
+    }
+}
+
+iguana::dictionary::~dictionary() noexcept {}
+
+void iguana::dictionary::serialize(output_stream& s) const {
+    s.append_little_endian(std::uint32_t(m_id));
+    s.append_little_endian(std::uint32_t(m_content.size()));
+    s.append(m_literal_statistics ? flag_literal_statistics : std::uint8_t(0));
+    s.append(m_content.data(), m_content.size());
+
+    // The statistics are decoded backwards from the end of the stream, so they must come last
+    if (m_literal_statistics) {
+        m_literal_statistics->serialize(s);
+    }
+}
+
+iguana::dictionary::id_type iguana::dictionary::compute_id(const std::uint8_t* p, std::size_t n) noexcept {
+    // 32-bit FNV-1a
+    std::uint32_t h = 0x811c9dc5;
+    for(std::size_t i = 0; i != n; ++i) {
+        h = (h ^ p[i]) * 0x01000193;
+    }
+    return h;
+}
@@ -0,0 +1,84 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include <vector>
+#include <optional>
+#include "common.h"
+#include "input_stream.h"
+#include "output_stream.h"
+#include "ans_byte_statistics.h"
+
+namespace iguana {
+
+    // dictionary is a prefix the LZ window is preloaded with, so that the matches of small payloads can reference
+    // the content they have in common. The encoder records the id of its dictionary in the stream, and the decoder
+    // looks it up among the dictionaries registered with it. Dictionaries are immutable, so that a single instance
+    // can be shared by any number of encoders and decoders. A trained dictionary also carries the statistics of
+    // the literals typical messages leave after the parse, which the encoder prices the literals of small blocks with.
+    class IGUANA_API dictionary final {
+    public:
+        using id_type = std::uint32_t;
+
+        // The content beyond the reach of the 24-bit offsets would be useless
+        static constexpr inline std::size_t max_size = 0xffffff;
+
+    private:
+        constexpr inline static std::size_t  header_size = 9;
+        constexpr inline static std::uint8_t flag_literal_statistics = 0x01;
+
+    private:
+        std::vector<std::uint8_t>   m_content;
+        id_type                     m_id;
+        std::optional<ans::byte_statistics> m_literal_statistics;
+
+    public:
+        // The id is derived from the content
+        dictionary(const std::uint8_t* p, std::size_t n);
+        dictionary(const std::uint8_t* p, std::size_t n, id_type id);
+        dictionary(const std::uint8_t* p, std::size_t n, id_type id, const ans::byte_statistics& literal_statistics);
+
+        // Reads the representation produced by serialize()
+        explicit dictionary(input_stream& s);
+        ~dictionary() noexcept;
+
+        dictionary(const dictionary&) = delete;
+        dictionary& operator =(const dictionary&) = delete;
+
+        dictionary(dictionary&&) = default;
+        dictionary& operator =(dictionary&&) = default;
+
+    public:
+        id_type id() const noexcept {
+            return m_id;
+        }
+
+        const std::uint8_t* data() const noexcept {
+            return m_content.data();
+        }
+
+        std::size_t size() const noexcept {
+            return m_content.size();
+        }
+
+        // nullptr if the dictionary has not been trained
+        const ans::byte_statistics* literal_statistics() const noexcept {
+            return m_literal_statistics ? &*m_literal_statistics : nullptr;
+        }
+
+        void serialize(output_stream& s) const;
+
+        static id_type compute_id(const std::uint8_t* p, std::size_t n) noexcept;
+    };
+}
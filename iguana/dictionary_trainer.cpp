@@ -0,0 +1,224 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "dictionary_trainer.h"
+
+//
+
+namespace iguana {
+    namespace {
+        // Marks the positions at which no d-mer starts, i.e. the last (dmer_length - 1) bytes of every sample
+        constexpr const std::uint32_t no_dmer = 0xffffffff;
+
+        // Parsing every sample against the dictionary is expensive, evenly spaced ones are representative enough
+        constexpr const std::size_t max_literal_samples = 1024;
+    }
+}
+
+//
+
+iguana::dictionary iguana::dictionary_trainer::train(const const_byte_span* first, const const_byte_span* last, const parameters& params) {
+    if ((params.dictionary_size == 0) || (params.dictionary_size > dictionary::max_size)) {
+        throw std::invalid_argument("the dictionary size is out of range");
+    }
+    if ((params.dmer_length < min_dmer_length) || (params.dmer_length > max_dmer_length)) {
+        throw std::invalid_argument("the d-mer length is out of range");
+    }
+    if (params.segment_length < params.dmer_length) {
+        throw std::invalid_argument("the segment length must not be smaller than the d-mer length");
+    }
+
+    m_corpus.clear();
+    m_sample_ends.clear();
+    for(const auto* i = first; i != last; ++i) {
+        m_corpus.insert(m_corpus.end(), i->cbegin(), i->cend());
+        m_sample_ends.push_back(m_corpus.size());
+    }
+
+    const auto corpus_size = m_corpus.size();
+    count_dmers(params);
+
+    // The corpus is split into epochs, each of which contributes its best segment in turn. This spreads
+    // the dictionary over the whole corpus rather than over the samples that happen to come first.
+    const auto n_epochs = std::max<std::size_t>(1, std::min(params.dictionary_size / params.segment_length, corpus_size / (std::size_t(params.segment_length) * 4)));
+    const auto epoch_size = corpus_size / n_epochs;
+
+    std::vector<segment> picked;
+    std::size_t picked_size = 0;
+
+    for(std::size_t epoch = 0, misses = 0; (picked_size < params.dictionary_size) && (misses < n_epochs); epoch = (epoch + 1) % n_epochs) {
+        const auto epoch_begin = epoch * epoch_size;
+        const auto epoch_end = (epoch == n_epochs - 1) ? corpus_size : epoch_begin + epoch_size;
+
+        const auto seg = select_segment(epoch_begin, epoch_end, params);
+        if (seg.score == 0) {
+            ++misses;
+            continue;
+        }
+        misses = 0;
+
+        // The covered d-mers are worthless for the subsequent segments
+        for(auto i = seg.begin; i + params.dmer_length <= seg.end; ++i) {
+            if (const auto h = m_hashes[i]; h != no_dmer) {
+                m_frequencies[h] = 0;
+            }
+        }
+
+        picked.push_back(seg);
+        picked_size += seg.end - seg.begin;
+    }
+
+    // The first segments picked are the most valuable ones, they go last so that the offsets to them are the shortest.
+    // The segment exceeding the budget loses its beginning.
+    std::vector<std::uint8_t> content;
+    content.reserve(std::min(picked_size, params.dictionary_size));
+
+    {   std::size_t n_picked = 0;
+        std::size_t budget = params.dictionary_size;
+        while((n_picked != picked.size()) && (budget != 0)) {
+            auto& seg = picked[n_picked++];
+            const auto len = std::min(seg.end - seg.begin, budget);
+            seg.begin = seg.end - len;
+            budget -= len;
+        }
+
+        for(auto i = n_picked; i != 0; --i) {
+            const auto& seg = picked[i - 1];
+            content.insert(content.end(), m_corpus.cbegin() + std::ptrdiff_t(seg.begin), m_corpus.cbegin() + std::ptrdiff_t(seg.end));
+        }
+    }
+
+    gather_literals(content, params);
+    const auto id = dictionary::compute_id(content.data(), content.size());
+
+    if (m_literals.empty()) {
+        return dictionary(content.data(), content.size(), id);
+    }
+    return dictionary(content.data(), content.size(), id, ans::byte_statistics(m_literals.data(), m_literals.size()));
+}
+
+void iguana::dictionary_trainer::count_dmers(const parameters& params) {
+    const auto corpus_size = m_corpus.size();
+    const auto d = params.dmer_length;
+    const auto mask = (d == sizeof(std::uint64_t)) ? ~std::uint64_t(0) : ((std::uint64_t(1) << (d * 8)) - 1);
+
+    m_hash_bits = std::clamp(bit::length(corpus_size), 12u, 22u);
+    m_frequencies.assign(std::size_t(1) << m_hash_bits, 0);
+    m_last_sample.assign(std::size_t(1) << m_hash_bits, 0);
+    m_active.assign(std::size_t(1) << m_hash_bits, 0);
+    m_hashes.assign(corpus_size, no_dmer);
+
+    // Every d-mer is counted once per sample containing it
+    std::size_t begin = 0;
+    for(std::size_t k = 0; k != m_sample_ends.size(); ++k) {
+        const auto end = m_sample_ends[k];
+        for(auto i = begin; i + d <= end; ++i) {
+            std::uint64_t v = 0;
+            std::memcpy(&v, m_corpus.data() + i, std::min<std::size_t>(sizeof(v), corpus_size - i));
+
+            const auto h = std::uint32_t(((v & mask) * 0x9e3779b185ebca87ull) >> (64 - m_hash_bits));
+            m_hashes[i] = h;
+            if (m_last_sample[h] != k + 1) {
+                m_last_sample[h] = std::uint32_t(k + 1);
+                ++m_frequencies[h];
+            }
+        }
+        begin = end;
+    }
+}
+
+iguana::dictionary_trainer::segment iguana::dictionary_trainer::select_segment(std::size_t begin, std::size_t end, const parameters& params) {
+    // A segment of segment_length bytes covers (segment_length - dmer_length + 1) d-mers. The window slides
+    // over the d-mer positions, and the score is the sum of the frequencies of the distinct d-mers within it.
+    const std::size_t d = params.dmer_length;
+    const std::size_t dmers_per_segment = params.segment_length - d + 1;
+
+    segment best = { .begin = begin, .end = begin, .score = 0 };
+    std::uint64_t score = 0;
+
+    const auto enter = [&](std::size_t pos) {
+        if (const auto h = m_hashes[pos]; (h != no_dmer) && (m_active[h]++ == 0)) {
+            score += m_frequencies[h];
+        }
+    };
+    const auto leave = [&](std::size_t pos) {
+        if (const auto h = m_hashes[pos]; (h != no_dmer) && (--m_active[h] == 0)) {
+            score -= m_frequencies[h];
+        }
+    };
+
+    for(auto i = begin; i != end; ++i) {
+        enter(i);
+        if (i - begin >= dmers_per_segment) {
+            leave(i - dmers_per_segment);
+        }
+        if (score > best.score) {
+            best = { .begin = (i - begin >= dmers_per_segment) ? i - dmers_per_segment + 1 : begin, .end = i + 1, .score = score };
+        }
+    }
+
+    // Leave m_active clean for the next call
+    for(auto i = (end - begin > dmers_per_segment) ? end - dmers_per_segment : begin; i != end; ++i) {
+        leave(i);
+    }
+
+    if (best.score == 0) {
+        return best;
+    }
+
+    // best.end is a d-mer position so far. Trim the d-mers that contribute nothing on both sides,
+    // then extend the segment to the end of its last d-mer.
+    const auto useful = [this](std::size_t pos) {
+        const auto h = m_hashes[pos];
+        return (h != no_dmer) && (m_frequencies[h] != 0);
+    };
+    while(!useful(best.begin)) {
+        ++best.begin;
+    }
+    while(!useful(best.end - 1)) {
+        --best.end;
+    }
+    best.end = std::min(best.end - 1 + d, m_corpus.size());
+    return best;
+}
+
+void iguana::dictionary_trainer::gather_literals(const std::vector<std::uint8_t>& content, const parameters& params) {
+    const auto& lz_params = lz::parameters_for_level(params.level);
+    const lz::price_model prices;
+    const auto n_samples = m_sample_ends.size();
+    const auto step = std::max<std::size_t>(1, n_samples / max_literal_samples);
+
+    // The content is matched against in place, ahead of every sample
+    const auto dict = content.empty() ? const_byte_span{} : const_byte_span(content.data(), content.size());
+
+    m_literals.clear();
+    for(std::size_t k = 0; k < n_samples; k += step) {
+        const auto sample_begin = (k == 0) ? 0 : m_sample_ends[k - 1];
+        const auto sample_end = m_sample_ends[k];
+
+        const auto* const p = m_corpus.data() + sample_begin;
+        const auto n = sample_end - sample_begin;
+        m_parser.parse(m_sequences, dict, (n != 0) ? const_byte_span(p, n) : const_byte_span{}, 0, lz_params, prices);
+
+        std::size_t anchor = 0;
+        for(const auto& seq : m_sequences) {
+            m_literals.insert(m_literals.end(), p + anchor, p + anchor + seq.lit_len);
+            anchor += std::size_t(seq.lit_len) + seq.match_len;
+        }
+        m_literals.insert(m_literals.end(), p + anchor, p + n);
+    }
+}
@@ -0,0 +1,83 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include <vector>
+#include "common.h"
+#include "span.h"
+#include "dictionary.h"
+#include "lz_parser.h"
+
+namespace iguana {
+
+    // dictionary_trainer builds a dictionary out of a set of sample messages. The content is assembled from
+    // the segments of the samples that cover the most frequent d-mers (short substrings counted once per sample,
+    // so that the content shared by many samples wins over the repeats within a single one). Every segment
+    // consumes the d-mers it covers, and the segments picked first end up closest to the input, where the
+    // offsets are the cheapest. The samples are then parsed against the dictionary to gather the statistics
+    // of the remaining literals.
+    class IGUANA_API dictionary_trainer final {
+    public:
+        struct parameters final {
+            std::size_t     dictionary_size = 64 * 1024;
+            std::uint32_t   segment_length  = 1024;
+            std::uint32_t   dmer_length     = 8;        // In the range [min_dmer_length, max_dmer_length]
+            std::uint32_t   level           = 3;        // The compression level the literal statistics are gathered at
+        };
+
+        constexpr inline static std::uint32_t min_dmer_length = 4;
+        constexpr inline static std::uint32_t max_dmer_length = 8;
+
+    private:
+        struct segment final {
+            std::size_t begin;
+            std::size_t end;
+            std::uint64_t score;
+        };
+
+    private:
+        std::vector<std::uint8_t>   m_corpus;
+        std::vector<std::size_t>    m_sample_ends;
+        std::vector<std::uint32_t>  m_frequencies;
+        std::vector<std::uint32_t>  m_last_sample;
+        std::vector<std::uint32_t>  m_active;
+        std::vector<std::uint32_t>  m_hashes;
+        std::uint32_t               m_hash_bits = 0;
+        lz::parser                  m_parser;
+        std::vector<lz::sequence>   m_sequences;
+        std::vector<std::uint8_t>   m_literals;
+
+    public:
+        dictionary_trainer() noexcept = default;
+        ~dictionary_trainer() noexcept = default;
+
+        dictionary_trainer(const dictionary_trainer&) = delete;
+        dictionary_trainer& operator =(const dictionary_trainer&) = delete;
+
+        dictionary_trainer(dictionary_trainer&&) = default;
+        dictionary_trainer& operator =(dictionary_trainer&&) = default;
+
+    public:
+        dictionary train(const const_byte_span* first, const const_byte_span* last, const parameters& params);
+
+        dictionary train(const const_byte_span* first, std::size_t n_samples, const parameters& params) {
+            return train(first, first + n_samples, params);
+        }
+
+    private:
+        void count_dmers(const parameters& params);
+        segment select_segment(std::size_t begin, std::size_t end, const parameters& params);
+        void gather_literals(const std::vector<std::uint8_t>& content, const parameters& params);
+    };
+}
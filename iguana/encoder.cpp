@@ -15,12 +15,21 @@
 #include <cstring>
 #include <stdexcept>
 #include <numeric>
+#include <algorithm>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
 #include "encoder.h"
 #include "bitops.h"
 #include "error.h"
 #include "ans32.h"
 #include "ans1.h"
 #include "ans_nibble.h"
+#include "ans_nibble64.h"
+#include "tans.h"
+#include "huffman.h"
 #include "utils.h"
 
 //
@@ -30,10 +39,12 @@ namespace iguana {
 
     //
 
-    template <typename T_ENCODER> command decoding_command = utils::invalid<T_ENCODER>::value; 
-    template <> command decoding_command<ans32::encoder> = command::decode_ans32; 
-    template <> command decoding_command<ans1::encoder> = command::decode_ans1; 
-    template <> command decoding_command<ans_nibble::encoder> = command::decode_ans_nibble; 
+    // Below that size, the statistics tables cost more than the automatic entropy mode selection could save
+    static constexpr const std::size_t   min_auto_entropy_size = 32;
+
+    // ans32 decodes 32 interleaved states at once, so the scalar modes are only picked by the automatic
+    // entropy mode selection when they compress noticeably better
+    static constexpr const double        scalar_entropy_penalty = 1.02;
 }
 
 //
@@ -79,109 +90,529 @@ void iguana::encoder::encode_entropy_raw(output_stream& dst, const part& p) {
     dst.append(p.m_data, p.m_size);
 }
 
-template <
-    typename T_ENCODER
-> void iguana::encoder::encode_entropy(output_stream& dst, const part& p) {
-    T_ENCODER{}.encode(m_entropy_data, p.m_data, p.m_size);
-
+void iguana::encoder::encode_entropy(output_stream& dst, const part& p) {
     const auto src_len = p.m_size;
-    const auto entropy_len = m_entropy_data.size();
 
-    if (const auto ratio = double(entropy_len) / double(src_len); ratio >= p.m_rejection_threshold) {
+    if (const auto em = encode_entropy_data(p.m_data, src_len, p.m_entropy_mode, p.m_rejection_threshold); em == entropy_mode::none) {
         encode_entropy_raw(dst, p);
     } else {
-        append_control_command(decoding_command<T_ENCODER>);
+        append_control_command(decoding_command(em));
         append_control_var_uint(src_len);
-        append_control_var_uint(entropy_len);
+        append_control_var_uint(m_entropy_data.size());
         dst.append(m_entropy_data);
     }
 
     m_entropy_data.clear();
 }
 
-void iguana::encoder::encode_iguana(output_stream& dst, const part& p) {
-    IGUANA_UNIMPLEMENTED
+template <
+    typename T_ENCODER
+> double iguana::encoder::encode_entropy_data(output_stream& dst, const std::uint8_t* p, std::size_t n) {
+    dst.clear();
+    T_ENCODER{}.encode(dst, p, n);
+    return double(dst.size()) / double(n);
+}
+
+iguana::entropy_mode iguana::encoder::encode_entropy_data(const std::uint8_t* p, std::size_t n, entropy_mode em, double rejection_threshold) {
+    if (n == 0) {
+        return entropy_mode::none;
+    }
+
+    switch(em) {
+    case entropy_mode::none:
+        return entropy_mode::none;
+
+    case entropy_mode::ans32:
+        return (encode_entropy_data<ans32::encoder>(m_entropy_data, p, n) < rejection_threshold) ? em : entropy_mode::none;
+
+    case entropy_mode::ans1:
+        return (encode_entropy_data<ans1::encoder>(m_entropy_data, p, n) < rejection_threshold) ? em : entropy_mode::none;
+
+    case entropy_mode::ans_nibble:
+        return (encode_entropy_data<ans_nibble::encoder>(m_entropy_data, p, n) < rejection_threshold) ? em : entropy_mode::none;
+
+    case entropy_mode::ans4:
+        return (encode_entropy_data<ans4::encoder>(m_entropy_data, p, n) < rejection_threshold) ? em : entropy_mode::none;
+
+    case entropy_mode::ans8:
+        return (encode_entropy_data<ans8::encoder>(m_entropy_data, p, n) < rejection_threshold) ? em : entropy_mode::none;
+
+    case entropy_mode::ans_nibble2:
+        return (encode_entropy_data<ans_nibble2::encoder>(m_entropy_data, p, n) < rejection_threshold) ? em : entropy_mode::none;
+
+    case entropy_mode::ans_nibble64:
+        return (encode_entropy_data<ans_nibble64::encoder>(m_entropy_data, p, n) < rejection_threshold) ? em : entropy_mode::none;
+
+    case entropy_mode::tans:
+        return (encode_entropy_data<tans::encoder>(m_entropy_data, p, n) < rejection_threshold) ? em : entropy_mode::none;
+
+    case entropy_mode::huffman:
+        return (encode_entropy_data<huffman::encoder>(m_entropy_data, p, n) < rejection_threshold) ? em : entropy_mode::none;
+
+    case entropy_mode::automatic:
+        return select_entropy_mode(p, n, rejection_threshold);
+
+    default:
+        throw std::invalid_argument(std::string("unrecognized entropy mode '") + to_string(em) + "'");
+    }
+}
+
+iguana::entropy_mode iguana::encoder::select_entropy_mode(const std::uint8_t* p, std::size_t n, double rejection_threshold) {
+    if (n < min_auto_entropy_size) {
+        return entropy_mode::none;
+    }
+
+    auto best = entropy_mode::none;
+    auto best_score = rejection_threshold;
+
+    // Every mode is tried, the best result so far is kept in m_entropy_data
+    const auto consider = [&](entropy_mode em, double ratio, double penalty) {
+        if ((ratio < rejection_threshold) && (ratio * penalty < best_score)) {
+            best = em;
+            best_score = ratio * penalty;
+            std::swap(m_entropy_data, m_entropy_candidate);
+        }
+    };
+
+    consider(entropy_mode::ans32, encode_entropy_data<ans32::encoder>(m_entropy_candidate, p, n), 1.0);
+    consider(entropy_mode::ans_nibble64, encode_entropy_data<ans_nibble64::encoder>(m_entropy_candidate, p, n), 1.0);
+    // Huffman decodes several times faster than the scalar ANS modes without any vector unit. It is picked when its
+    // code lengths cost no more than its smaller tables save, which is mostly on the small or flat blocks.
+    consider(entropy_mode::huffman, encode_entropy_data<huffman::encoder>(m_entropy_candidate, p, n), 1.0);
+    // The interleaved scalar modes cost a few bytes of states more than the one-way ones, but decode much faster.
+    // tANS comes first, so that it is kept over rANS at the same size: it decodes without any multiplication.
+    consider(entropy_mode::tans, encode_entropy_data<tans::encoder>(m_entropy_candidate, p, n), scalar_entropy_penalty);
+    consider(entropy_mode::ans4, encode_entropy_data<ans4::encoder>(m_entropy_candidate, p, n), scalar_entropy_penalty);
+    consider(entropy_mode::ans_nibble2, encode_entropy_data<ans_nibble2::encoder>(m_entropy_candidate, p, n), scalar_entropy_penalty);
+
+    m_entropy_candidate.clear();
+    return best;
+}
+
+iguana::command iguana::encoder::decoding_command(entropy_mode em) {
+    switch(em) {
+    case entropy_mode::ans32:
+        return command::decode_ans32;
+
+    case entropy_mode::ans1:
+        return command::decode_ans1;
+
+    case entropy_mode::ans_nibble:
+        return command::decode_ans_nibble;
+
+    case entropy_mode::ans4:
+        return command::decode_ans4;
+
+    case entropy_mode::ans8:
+        return command::decode_ans8;
+
+    case entropy_mode::ans_nibble2:
+        return command::decode_ans_nibble2;
+
+    case entropy_mode::ans_nibble64:
+        return command::decode_ans_nibble64;
+
+    case entropy_mode::tans:
+        return command::decode_tans;
+
+    case entropy_mode::huffman:
+        return command::decode_huffman;
+
+    default:
+        throw std::invalid_argument(std::string("no decoding command for entropy mode '") + to_string(em) + "'");
+    }
+}
+
+void iguana::encoder::encode_iguana(output_stream& dst, const part& p, std::size_t prefix_size) {
+    const auto* const src = p.m_data;
+    const auto n = p.m_size;
+    const auto& params = lz::parameters_for_level(p.m_level);
+
+    // The matches may reference the prefix and the dictionary preceding it, which the parser reads in place
+    const auto dict = m_dictionary_in_reach ? const_byte_span(m_dictionary->data(), m_dictionary->size()) : const_byte_span{};
+    const auto window = (prefix_size + n != 0) ? const_byte_span(src - prefix_size, prefix_size + n) : const_byte_span{};
+
+    m_prices.reset();
+    seed_literal_prices();
+
+    if ((params.parsing == lz::strategy::optimal) && (p.m_entropy_mode != entropy_mode::none)) {
+        // Bootstrap the price model with the statistics of a cheaper parse, then refine it
+        // with the statistics of each optimal parse.
+        auto bootstrap = params;
+        bootstrap.parsing = lz::strategy::lazy2;
+
+        m_parser.parse(m_sequences, dict, window, prefix_size, bootstrap, m_prices);
+        append_sequences(src, n);
+
+        for(std::uint32_t pass = 0; pass != params.optimal_passes; ++pass) {
+            update_prices();
+            m_parser.parse(m_sequences, dict, window, prefix_size, params, m_prices);
+            append_sequences(src, n);
+        }
+    } else {
+        m_parser.parse(m_sequences, dict, window, prefix_size, params, m_prices);
+        append_sequences(src, n);
+    }
+
+    // Apply the entropy compression to the substreams that benefit from it
+    std::uint64_t hdr = 0;
+    std::uint64_t c_lens[substream::count] = {};
+    m_iguana_data.clear();
+
+    for(std::size_t i = 0; i != substream::count; ++i) {
+        const auto& s = m_streams[i];
+
+        if (const auto em = encode_entropy_data(s.data(), s.size(), p.m_entropy_mode, p.m_rejection_threshold); em != entropy_mode::none) {
+            hdr |= std::uint64_t(em) << (i * 4);
+            c_lens[i] = m_entropy_data.size();
+            m_iguana_data.append(m_entropy_data);
+        } else {
+            m_iguana_data.append(m_streams[i]);
+        }
+    }
+    m_entropy_data.clear();
+
+    if (const auto ratio = double(m_iguana_data.size()) / double(n); ratio >= p.m_rejection_threshold) {
+        // Structural compression did not pay off, fall back to the plain entropy compression
+        encode_entropy(dst, p);
+        return;
+    }
+
+    const std::uint64_t flags = ((prefix_size == 0) && !m_dictionary_in_reach) ? iguana_block_independent : 0;
+
+    append_control_command(command::decode_iguana_block);
+    append_control_var_uint(flags);
+    append_control_var_uint(n);
+    append_control_var_uint(hdr);
+
+    for(std::size_t i = 0; i != substream::count; ++i) {
+        append_control_var_uint(m_streams[i].size());
+    }
+
+    for(std::size_t i = 0; i != substream::count; ++i) {
+        if (((hdr >> (i * 4)) & 0x0f) != 0) {
+            append_control_var_uint(c_lens[i]);
+        }
+    }
+
+    dst.append(m_iguana_data);
+}
+
+void iguana::encoder::append_sequences(const std::uint8_t* src, std::size_t n) {
+    for(auto& s : m_streams) {
+        s.clear();
+    }
+    m_last_offset = 0;
+
+    std::size_t anchor = 0;
+    for(const auto& seq : m_sequences) {
+        append_sequence(src + anchor, seq.lit_len, { .length = seq.match_len, .offset = seq.offset });
+        anchor += std::size_t(seq.lit_len) + seq.match_len;
+    }
+
+    // The trailing literals do not need a token
+    m_streams[substream::literals].append(src + anchor, n - anchor);
+}
+
+void iguana::encoder::update_prices() {
+    const auto compute = [this](lz::price_model::table& t, std::size_t id) {
+        const auto& s = m_streams[id];
+        lz::price_model::compute(t, s.data(), s.size());
+    };
+
+    compute(m_prices.tokens, substream::tokens);
+    compute(m_prices.offset16, substream::offset16);
+    compute(m_prices.offset24, substream::offset24);
+    compute(m_prices.var_lit_len, substream::var_lit_len);
+    compute(m_prices.var_match_len, substream::var_match_len);
+    compute(m_prices.literals, substream::literals);
+    seed_literal_prices();
+}
+
+void iguana::encoder::seed_literal_prices() {
+    // The literals of a small block are too few to be representative, the statistics
+    // gathered over the training samples of the dictionary are a better estimate.
+    if (m_dictionary_in_reach) {
+        if (const auto* const stats = m_dictionary->literal_statistics(); stats != nullptr) {
+            lz::price_model::compute(m_prices.literals, *stats);
+        }
+    }
+}
+
+void iguana::encoder::append_sequence(const std::uint8_t* lit, std::size_t lit_len, lz::match m) {
+	// [0_MMMM_LLL] - 16-bit offset, 4-bit match length (4-15+), 3-bit literal length (0-7+)
+	// [1_MMMM_LLL] -   last offset, 4-bit match length (0-15+), 3-bit literal length (0-7+)
+	// flag 31      - 24-bit offset,        match length (47+),    no literal length
+	// flag 0-30    - 24-bit offset,  31 match lengths (16-46),    no literal length
+
+    constexpr std::size_t max_lit_len = lz::max_short_lit_len + lz::max_var_uint;
+    constexpr std::uint32_t max_match_len = lz::max_short_match_len + lz::max_var_uint;
+
+    // Split the literal runs and matches exceeding the var_uint range. The continuation
+    // of a split match is encoded with the last offset token.
+    while(lit_len > max_lit_len) {
+        append_literals_only(lit, max_lit_len);
+        lit += max_lit_len;
+        lit_len -= max_lit_len;
+    }
+
+    while(m.length > max_match_len) {
+        append_sequence(lit, lit_len, { .length = max_match_len, .offset = m.offset });
+        lit += lit_len;
+        lit_len = 0;
+        m.length -= max_match_len;
+    }
+
+    if ((m.offset != m_last_offset) && (m.offset > lz::max_short_offset)) {
+        assert(m.length >= lz::min_long_match_length);
+
+        // Long offsets carry no literals, so emit them separately
+        if (lit_len > 0) {
+            append_literals_only(lit, lit_len);
+        }
+
+        if (const auto len = m.length - lz::mm_long_offsets; len < lz::last_long_offset) {
+            m_streams[substream::tokens].append(static_cast<std::uint8_t>(len));
+        } else {
+            m_streams[substream::tokens].append(static_cast<std::uint8_t>(lz::last_long_offset));
+            append_var_uint(m_streams[substream::var_match_len], len - lz::last_long_offset);
+        }
+
+        auto& offs = m_streams[substream::offset24];
+        offs.append(static_cast<std::uint8_t>(m.offset));
+        offs.append(static_cast<std::uint8_t>(m.offset >> 8));
+        offs.append(static_cast<std::uint8_t>(m.offset >> 16));
+        m_last_offset = m.offset;
+        return;
+    }
+
+    const auto ll = std::uint32_t(std::min<std::size_t>(lit_len, lz::max_short_lit_len));
+    const auto mm = std::min(m.length, lz::max_short_match_len);
+    std::uint8_t token = static_cast<std::uint8_t>((mm << lz::literal_len_bits) | ll);
+
+    if (m.offset == m_last_offset) {
+        token |= lz::last_offset_flag;
+    } else {
+        assert(m.length >= lz::min_match_length);
+    }
+
+    m_streams[substream::tokens].append(token);
+
+    if (ll == lz::max_short_lit_len) {
+        append_var_uint(m_streams[substream::var_lit_len], std::uint32_t(lit_len - lz::max_short_lit_len));
+    }
+    m_streams[substream::literals].append(lit, lit_len);
+
+    if ((token & lz::last_offset_flag) == 0) {
+        m_streams[substream::offset16].append_little_endian(static_cast<std::uint16_t>(m.offset));
+        m_last_offset = m.offset;
+    }
+
+    if (mm == lz::max_short_match_len) {
+        append_var_uint(m_streams[substream::var_match_len], m.length - lz::max_short_match_len);
+    }
+}
+
+void iguana::encoder::append_literals_only(const std::uint8_t* lit, std::size_t lit_len) {
+    // A zero-length match with the last offset
+    const auto ll = std::uint32_t(std::min<std::size_t>(lit_len, lz::max_short_lit_len));
+    m_streams[substream::tokens].append(static_cast<std::uint8_t>(lz::last_offset_flag | ll));
+
+    if (ll == lz::max_short_lit_len) {
+        append_var_uint(m_streams[substream::var_lit_len], std::uint32_t(lit_len - lz::max_short_lit_len));
+    }
+    m_streams[substream::literals].append(lit, lit_len);
+}
+
+void iguana::encoder::append_var_uint(output_stream& s, std::uint32_t v) {
+    // The inverse of decoder::substream::fetch_var_uint
+    assert(v <= lz::max_var_uint);
+
+    if (v < 0xfe) {
+        s.append(static_cast<std::uint8_t>(v));
+    } else if (const auto x = v / 254; x <= 0xff) {
+        s.append(0xfe);
+        s.append(static_cast<std::uint8_t>(v % 254));
+        s.append(static_cast<std::uint8_t>(x));
+    } else {
+        s.append(0xff);
+        s.append(static_cast<std::uint8_t>(v % 254));
+        s.append(static_cast<std::uint8_t>(x % 254));
+        s.append(static_cast<std::uint8_t>(x / 254));
+    }
 }
 
 void iguana::encoder::encode(output_stream& dst, const std::uint8_t* p, std::size_t n) {
     const part prt = {
-        .m_entropy_mode = iguana::entropy_mode::ans32,
+        .m_data = p,
+        .m_size = n,
+        .m_entropy_mode = iguana::entropy_mode::automatic,
         .m_encoding = iguana::encoding::iguana,
-        .m_rejection_threshold = default_rejection_threshold
+        .m_rejection_threshold = default_rejection_threshold,
+        .m_level = default_level
     };
     encode(dst, prt);   
 }
 
-void iguana::encoder::encode(output_stream& dst, const part& p) {
-    m_last_command_offset = -1;
-    append_control_var_uint(p.m_size);
-    encode_part(dst, p);
+void iguana::encoder::set_dictionary(std::shared_ptr<const dictionary> dict) noexcept {
+    m_dictionary = std::move(dict);
+}
 
-	// Append the control bytes in reverse order
-    dst.append_reverse(m_control.data(), m_control.size());
-    m_control.clear();
+void iguana::encoder::set_threads(std::uint32_t n) {
+    m_threads = (n != 0) ? n : std::max(std::thread::hardware_concurrency(), 1u);
 }
 
-void iguana::encoder::encode(output_stream& dst, const part* first, const part* last) {
+void iguana::encoder::set_block_size(std::size_t n) {
+    if ((n < min_block_size) || (n > max_block_size)) {
+        throw std::invalid_argument("the block size is out of range");
+    }
+    m_block_size = n;
+}
+
+void iguana::encoder::set_block_prefix_size(std::size_t n) {
+    if (n > max_block_prefix_size) {
+        throw std::invalid_argument("the block prefix size is out of range");
+    }
+    m_block_prefix_size = n;
+}
+
+void iguana::encoder::begin_stream(std::uint64_t total_input_size) {
     m_last_command_offset = -1;
+    append_control_var_uint(total_input_size);
 
-    // Compute the total input size
-    {   const auto total_input_size = std::accumulate(
-            first,
-            last,
-            std::uint64_t(0),
-            [](std::uint64_t lhs, const part& rhs) {
-                return lhs + rhs.m_size;
-            }
-        );
-        append_control_var_uint(total_input_size);
+    if (m_dictionary && (total_input_size != 0)) {
+        append_control_command(command::use_dictionary);
+        append_control_var_uint(m_dictionary->id());
     }
+}
+
+void iguana::encoder::encode(output_stream& dst, const part& p) {
+    encode(dst, &p, &p + 1);
+}
+
+void iguana::encoder::encode(output_stream& dst, const part* first, const part* last) {
+    // Split the parts into blocks. The split does not depend on the number of threads, so neither does the output.
+    m_jobs.clear();
+    std::uint64_t total_input_size = 0;
 
     for(const auto* i = first; i != last; ++i) {
-        encode_part(dst, *i);
+        total_input_size += i->m_size;
+
+        for(std::size_t offs = 0; offs < i->m_size; offs += m_block_size) {
+            auto& j = m_jobs.emplace_back();
+            j.m_part = *i;
+            j.m_part.m_data = i->m_data + offs;
+            j.m_part.m_size = std::min(i->m_size - offs, m_block_size);
+            j.m_prefix_size = std::min(offs, m_block_prefix_size);
+        }
+    }
+
+    // Only the first block directly follows the dictionary, the later ones do not reference it
+    if (m_dictionary && !m_jobs.empty()) {
+        m_jobs.front().m_dictionary_in_reach = true;
     }
 
+    begin_stream(total_input_size);
+
+    if ((m_threads > 1) && (m_jobs.size() > 1)) {
+        encode_jobs_concurrently(dst);
+    } else {
+        for(auto& j : m_jobs) {
+            encode_job(j, dst);
+            append_job_control(j);
+        }
+    }
+    m_jobs.clear();
+
 	// Append the control bytes in reverse order
     dst.append_reverse(m_control.data(), m_control.size());
     m_control.clear();
 }
 
-void iguana::encoder::encode_part(output_stream& dst, const part& p) {
-    if (p.m_size == 0) [[unlikely]] { 
-        return;
+void iguana::encoder::encode_jobs_concurrently(output_stream& dst) {
+    const auto n_workers = std::min<std::size_t>(m_threads, m_jobs.size());
+    while(m_workers.size() < n_workers - 1) {
+        m_workers.push_back(std::make_unique<encoder>());
     }
 
-    switch(p.m_encoding) {
-    case encoding::raw:
-        switch(p.m_entropy_mode) {
-        case entropy_mode::none:
-            encode_entropy_raw(dst, p);
-            break;
-
-        case entropy_mode::ans32:
-            encode_entropy<ans32::encoder>(dst, p);
-            break;
+    std::atomic<std::size_t> next_job = 0;
+    std::exception_ptr failure;
+    std::mutex failure_mutex;
 
-        case entropy_mode::ans1:
-            encode_entropy<ans1::encoder>(dst, p);
-            break;
+    const auto run = [&](encoder& worker) {
+        try {
+            for(auto i = next_job++; i < m_jobs.size(); i = next_job++) {
+                auto& j = m_jobs[i];
+                worker.encode_job(j, j.m_data);
+            }
+        } catch(...) {
+            const std::lock_guard lock(failure_mutex);
+            if (!failure) {
+                failure = std::current_exception();
+            }
+            next_job = m_jobs.size();
+        }
+    };
 
-        case entropy_mode::ans_nibble:
-            encode_entropy<ans_nibble::encoder>(dst, p);
-            break;
+    {   // The calling thread is a worker too; the threads are joined when leaving the scope
+        std::vector<std::jthread> threads;
+        threads.reserve(n_workers - 1);
 
-        default:
-            throw std::invalid_argument(std::string("unrecognized entropy mode '") + to_string(p.m_entropy_mode) + "'");              
+        for(std::size_t i = 0; i != n_workers - 1; ++i) {
+            m_workers[i]->m_dictionary = m_dictionary;
+            threads.emplace_back(run, std::ref(*m_workers[i]));
         }
+        run(*this);
+    }
+
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+
+    // Stitch the data sections and the commands in the order of the blocks
+    for(auto& j : m_jobs) {
+        dst.append(j.m_data);
+        append_job_control(j);
+    }
+}
+
+void iguana::encoder::encode_job(job& j, output_stream& dst) {
+    // The commands of the block are collected apart from the ones of the stream, so that the blocks
+    // can be encoded in any order
+    std::swap(m_control, j.m_control);
+    const auto last_command_offset = std::exchange(m_last_command_offset, -1);
+    m_control.clear();
+    m_dictionary_in_reach = j.m_dictionary_in_reach;
+
+    switch(j.m_part.m_encoding) {
+    case encoding::raw:
+        encode_entropy(dst, j.m_part);
         break;
 
     case encoding::iguana:
-        encode_iguana(dst, p);
+        encode_iguana(dst, j.m_part, j.m_prefix_size);
         break;
 
     default:
-        throw std::invalid_argument(std::string("unrecognized encoding '") + to_string(p.m_encoding) + "'");
+        throw std::invalid_argument(std::string("unrecognized encoding '") + to_string(j.m_part.m_encoding) + "'");
+    }
+
+    m_dictionary_in_reach = false;
+    std::swap(m_control, j.m_control);
+    j.m_last_command_offset = std::exchange(m_last_command_offset, last_command_offset);
+}
+
+void iguana::encoder::append_job_control(const job& j) {
+    if (j.m_control.empty()) {
+        return;
     }
+
+    if (m_last_command_offset >= 0) {
+		m_control[m_last_command_offset] &= command_mask;
+	}
+
+    m_last_command_offset = std::ptrdiff_t(m_control.size()) + j.m_last_command_offset;
+    m_control.insert(m_control.end(), j.m_control.cbegin(), j.m_control.cend());
 }
 
 void iguana::encoder::append_control_var_uint(std::uint64_t v) {
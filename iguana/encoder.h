@@ -21,6 +21,8 @@
 #include "entropy.h"
 #include "output_stream.h"
 #include "command.h"
+#include "dictionary.h"
+#include "lz_parser.h"
 
 //
 
@@ -38,6 +40,21 @@ namespace iguana {
     class IGUANA_API encoder {
         friend internal::initializer<encoder>;
 
+    private:
+        // The identifiers of the iguana substreams, in the order expected by decoder::substream
+        struct substream final {
+            enum : unsigned {
+                tokens = 0,
+                offset16,
+                offset24,
+                var_lit_len,
+                var_match_len,
+                literals,
+                //
+                count
+            };
+        };
+
     public:
 
         struct part final {
@@ -46,10 +63,32 @@ namespace iguana {
             entropy_mode        m_entropy_mode;
             encoding            m_encoding;
             double              m_rejection_threshold;
+            std::uint32_t       m_level = default_level;    // Trades the encoding speed for the compression ratio, see lz::parameters_for_level
         };
 
     public:
         static constexpr inline double default_rejection_threshold = 1.0;
+        static constexpr inline std::uint32_t min_level = 1;
+        static constexpr inline std::uint32_t max_level = 9;
+        static constexpr inline std::uint32_t default_level = 3;
+
+        // The parts are split into blocks, which several threads can encode at once. The match finder works with 32-bit positions.
+        static constexpr inline std::size_t min_block_size = std::size_t(1) << 16;
+        static constexpr inline std::size_t max_block_size = std::size_t(1) << 30;
+        static constexpr inline std::size_t default_block_size = std::size_t(1) << 24;
+        static constexpr inline std::size_t max_block_prefix_size = std::size_t(1) << 20;
+        static constexpr inline std::size_t default_block_prefix_size = 0;
+
+    private:
+        // A block of a part, along with the data and the commands encoding it
+        struct job final {
+            part                        m_part;
+            std::size_t                 m_prefix_size = 0;      // The number of bytes preceding the block its matches may reference
+            bool                        m_dictionary_in_reach = false;
+            output_stream               m_data;
+            std::vector<std::uint8_t>   m_control;
+            std::ptrdiff_t              m_last_command_offset = -1;
+        };
 
     private:
         static const internal::initializer<encoder> g_Initializer;
@@ -58,6 +97,20 @@ namespace iguana {
         std::vector<std::uint8_t>   m_control;
         std::ptrdiff_t              m_last_command_offset = -1;
         output_stream               m_entropy_data;
+        output_stream               m_entropy_candidate;
+        output_stream               m_iguana_data;
+        output_stream               m_streams[substream::count];
+        std::uint32_t               m_last_offset = 0;
+        lz::parser                  m_parser;
+        lz::price_model             m_prices;
+        std::vector<lz::sequence>   m_sequences;
+        std::shared_ptr<const dictionary> m_dictionary;
+        bool                        m_dictionary_in_reach = false;
+        std::uint32_t               m_threads = 1;
+        std::size_t                 m_block_size = default_block_size;
+        std::size_t                 m_block_prefix_size = default_block_prefix_size;
+        std::vector<job>            m_jobs;
+        std::vector<std::unique_ptr<encoder>> m_workers;
 
     public:
         encoder();
@@ -79,19 +132,69 @@ namespace iguana {
 
         void encode(output_stream& dst, const std::uint8_t* p, std::size_t n);
 
+        // The dictionary applies to the streams encoded afterwards, nullptr disables it. The decoder
+        // must have the same dictionary registered.
+        void set_dictionary(std::shared_ptr<const dictionary> dict) noexcept;
+
+        const std::shared_ptr<const dictionary>& get_dictionary() const noexcept {
+            return m_dictionary;
+        }
+
+        // The blocks are encoded by up to n threads, 0 stands for the number of hardware threads.
+        // The output does not depend on the number of threads.
+        void set_threads(std::uint32_t n);
+
+        std::uint32_t get_threads() const noexcept {
+            return m_threads;
+        }
+
+        void set_block_size(std::size_t n);
+
+        std::size_t get_block_size() const noexcept {
+            return m_block_size;
+        }
+
+        // The matches of every block but the first of a part may reference up to n bytes preceding it. That improves
+        // the ratio, the more so the smaller the blocks, but the decoder has to decode such a block after the ones it
+        // references. With 0, the default, the blocks are independent and the decoder spreads them over its threads.
+        void set_block_prefix_size(std::size_t n);
+
+        std::size_t get_block_prefix_size() const noexcept {
+            return m_block_prefix_size;
+        }
+
     private:
         static void at_process_start();
         static void at_process_end();
 
         //
         
-        void encode_part(output_stream& dst, const part& p);
-        void encode_iguana(output_stream& dst, const part& p);
+        void begin_stream(std::uint64_t total_input_size);
+        void encode_jobs_concurrently(output_stream& dst);
+        void encode_job(job& j, output_stream& dst);
+        void append_job_control(const job& j);
+        void encode_iguana(output_stream& dst, const part& p, std::size_t prefix_size);
         void encode_entropy_raw(output_stream& dst, const part& p);
+        void encode_entropy(output_stream& dst, const part& p);
+
+        // Compresses [p, p + n) into m_entropy_data and returns the applied mode, or entropy_mode::none if compression does not pay off
+        entropy_mode encode_entropy_data(const std::uint8_t* p, std::size_t n, entropy_mode em, double rejection_threshold);
+        entropy_mode select_entropy_mode(const std::uint8_t* p, std::size_t n, double rejection_threshold);
 
         template <
             typename T_ENCODER
-        > void encode_entropy(output_stream& dst, const part& p);
+        > static double encode_entropy_data(output_stream& dst, const std::uint8_t* p, std::size_t n);
+
+        static command decoding_command(entropy_mode em);
+
+        //
+
+        void append_sequences(const std::uint8_t* src, std::size_t n);
+        void update_prices();
+        void seed_literal_prices();
+        void append_sequence(const std::uint8_t* lit, std::size_t lit_len, lz::match m);
+        void append_literals_only(const std::uint8_t* lit, std::size_t lit_len);
+        static void append_var_uint(output_stream& s, std::uint32_t v);
 
         //
 
@@ -31,10 +31,38 @@ iguana::entropy_mode iguana::entropy_mode_from_string(const char* name) {
         return entropy_mode::ans_nibble;
     }
 
+    if (std::strcmp(name, "ans4") == 0) {
+        return entropy_mode::ans4;
+    }
+
+    if (std::strcmp(name, "ans8") == 0) {
+        return entropy_mode::ans8;
+    }
+
+    if (std::strcmp(name, "ans_nibble2") == 0) {
+        return entropy_mode::ans_nibble2;
+    }
+
+    if (std::strcmp(name, "ans_nibble64") == 0) {
+        return entropy_mode::ans_nibble64;
+    }
+
+    if (std::strcmp(name, "tans") == 0) {
+        return entropy_mode::tans;
+    }
+
+    if (std::strcmp(name, "huffman") == 0) {
+        return entropy_mode::huffman;
+    }
+
     if (std::strcmp(name, "none") == 0) {
         return entropy_mode::none;
     }
 
+    if (std::strcmp(name, "auto") == 0) {
+        return entropy_mode::automatic;
+    }
+
     throw std::invalid_argument(std::string("unrecognized entropy mode '") + name + "'");
 }
 
@@ -49,9 +77,30 @@ const char* iguana::to_string(entropy_mode m) {
         case entropy_mode::ans_nibble:
             return "ans_nibble";
 
+        case entropy_mode::ans4:
+            return "ans4";
+
+        case entropy_mode::ans8:
+            return "ans8";
+
+        case entropy_mode::ans_nibble2:
+            return "ans_nibble2";
+
+        case entropy_mode::ans_nibble64:
+            return "ans_nibble64";
+
+        case entropy_mode::tans:
+            return "tans";
+
+        case entropy_mode::huffman:
+            return "huffman";
+
         case entropy_mode::none:
             return "none";
 
+        case entropy_mode::automatic:
+            return "auto";
+
         default:
             throw std::invalid_argument("unrecognized entropy mode value");        
     }
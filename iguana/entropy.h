@@ -22,7 +22,14 @@ namespace iguana {
         none    = 0x00,     // No entropy compression is applied
         ans32   = 0x01,     // Vectorized, 32-way interleaved 8-bit rANS entropy compression should be applied
         ans1    = 0x02,     // Scalar, one-way 8-bit rANS entropy compression should be applied
-        ans_nibble = 0x03   // Scalar, one-way 4-bit rANS entropy compression should be applied
+        ans_nibble = 0x03,  // Scalar, one-way 4-bit rANS entropy compression should be applied
+        ans4    = 0x04,     // Scalar, 4-way interleaved 8-bit rANS entropy compression should be applied
+        ans8    = 0x05,     // Scalar, 8-way interleaved 8-bit rANS entropy compression should be applied
+        ans_nibble2 = 0x06, // Scalar, 2-way interleaved 4-bit rANS entropy compression should be applied
+        ans_nibble64 = 0x07, // Vectorized, 64-way interleaved 4-bit rANS entropy compression should be applied
+        tans    = 0x08,     // Scalar, 4-way interleaved 8-bit tabled ANS (tANS) entropy compression should be applied
+        huffman = 0x09,     // Scalar, 4-stream canonical Huffman entropy compression should be applied
+        automatic = 0xff    // Encoder only: the mode is picked for every stream separately, based on its size and the measured gain
     };
 
     //
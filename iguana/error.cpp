@@ -18,14 +18,15 @@
 
 namespace iguana {
     namespace {
-        const std::array<const char*, 7> g_ErrorDescription = {
+        const std::array<const char*, 8> g_ErrorDescription = {
             "success",
             "bitstream corruption detected",
             "wrong source size",
             "out of input bytes",
             "unrecognized command",
             "insufficient target capacity",
-            "out of memory"
+            "out of memory",
+            "dictionary mismatch"
         };
     }
 }
@@ -58,6 +59,9 @@ void iguana::exception::from_error(error_code ec) {
         case error_code::out_of_memory:
             throw out_of_memory_exception();
 
+        case error_code::dictionary_mismatch:
+            throw dictionary_mismatch_exception();
+
         case error_code::ok:
             throw std::invalid_argument("unrecognized error code");
     }
@@ -98,3 +102,9 @@ iguana::out_of_memory_exception::~out_of_memory_exception() {}
 iguana::error_code iguana::out_of_memory_exception::get_error_code() const noexcept {
     return error_code::out_of_memory;
 }
+
+iguana::dictionary_mismatch_exception::~dictionary_mismatch_exception() {}
+
+iguana::error_code iguana::dictionary_mismatch_exception::get_error_code() const noexcept {
+    return error_code::dictionary_mismatch;
+}
@@ -25,7 +25,8 @@ namespace iguana {
         out_of_input_data,
         insufficient_target_capacity,
         unrecognized_command,
-        out_of_memory
+        out_of_memory,
+        dictionary_mismatch
     };
 
     //
@@ -150,4 +151,21 @@ namespace iguana {
     public:
         virtual error_code get_error_code() const noexcept override final;
     };
+
+    //
+
+    class IGUANA_API dictionary_mismatch_exception : public exception {
+        using super = exception;
+
+    public:
+        template <
+            typename... TA
+        > explicit dictionary_mismatch_exception(TA&&... args)
+          : super(std::forward<TA>(args)...) {}
+
+        virtual ~dictionary_mismatch_exception();
+
+    public:
+        virtual error_code get_error_code() const noexcept override final;
+    };
 }
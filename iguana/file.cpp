@@ -76,3 +76,9 @@ void iguana::file::read(void* p, std::uint64_t n) {
         throw std::runtime_error(std::string("std::fread() failed"));
     }
 }
+
+void iguana::file::write(const void* p, std::uint64_t n) {
+    if (std::fwrite(p, 1, static_cast<std::size_t>(n), m_file) != n) [[unlikely]] {
+        throw std::runtime_error(std::string("std::fwrite() failed"));
+    }
+}
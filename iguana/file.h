@@ -52,6 +52,7 @@ namespace iguana {
         void reset(std::FILE* p, bool should_close) noexcept;
         void open(const std::string& name, const std::string& mode);   
         void read(void* p, std::uint64_t n);
+        void write(const void* p, std::uint64_t n);
         std::uint64_t size() const;
 
         constexpr std::FILE* get() const noexcept {
@@ -0,0 +1,279 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include "huffman.h"
+#include "utils.h"
+
+namespace iguana::huffman {
+    const cpu::kernel_table<encoder::kernel_function> encoder::g_Kernels = { &encoder::compress_portable };
+    cpu::kernel_dispatch<encoder::kernel_function> encoder::g_Compress("huffman encoder", g_Kernels);
+    const internal::initializer<encoder> encoder::g_Initializer;
+
+    const cpu::kernel_table<decoder::kernel_function> decoder::g_Kernels = { &decoder::decompress_portable };
+    cpu::kernel_dispatch<decoder::kernel_function> decoder::g_Decompress("huffman decoder", g_Kernels);
+    const internal::initializer<decoder> decoder::g_Initializer;
+
+    namespace {
+        constexpr const std::size_t huffman_header_size = (streams - 1) * sizeof(std::uint32_t);
+
+        // Up to that many codes fit within the 57 bits read at once, whatever the position of the first one
+        constexpr const std::size_t huffman_codes_per_read = 56 / statistics::max_code_length;
+
+        // Collects the bits in the order they are written, the first ones at the lowest positions, and stores
+        // them in 8-byte words. Up to 56 bits may be put between two flushes.
+        struct huffman_bit_writer final {
+            std::uint8_t*   out;
+            std::uint64_t   bits = 0;
+            std::uint32_t   n_bits = 0;
+
+            void put(std::uint32_t v, std::uint32_t n) noexcept {
+                bits |= std::uint64_t(v) << n_bits;
+                n_bits += n;
+            }
+
+            void flush() noexcept {
+                utils::write_little_endian<std::uint64_t>(out, bits);
+                out += n_bits >> 3;
+                bits >>= n_bits & ~7u;
+                n_bits &= 7;
+            }
+        };
+
+        // Reads a stream from the lowest bit of every byte up, together with the symbols it decodes to
+        struct huffman_bit_reader final {
+            const std::uint8_t* p;
+            std::size_t         size;
+            std::size_t         pos;
+            std::uint8_t*       out;
+            std::uint8_t*       out_end;
+
+            // Whether 8 bytes can be read at the position, which may be past the end of the stream
+            bool readable(const std::uint8_t* src_end) const noexcept {
+                return std::size_t(src_end - p) >= (pos >> 3) + sizeof(std::uint64_t);
+            }
+
+            // 57 bits at least from the position on
+            std::uint64_t peek() const noexcept {
+                return utils::read_little_endian<std::uint64_t>(p + (pos >> 3)) >> (pos & 7);
+            }
+
+            // The same, reading no further than the end of the stream
+            std::uint64_t peek_tail() const noexcept {
+                const auto k = pos >> 3;
+                if (k + sizeof(std::uint64_t) <= size) {
+                    return peek();
+                }
+
+                std::uint8_t tail[sizeof(std::uint64_t)] = {};
+                if (k < size) {
+                    std::memcpy(tail, p + k, size - k);
+                }
+                return utils::read_little_endian<std::uint64_t>(tail) >> (pos & 7);
+            }
+
+            // The stream must end within its last byte
+            bool at_end() const noexcept {
+                return (pos <= size * 8) && (pos + 8 > size * 8);
+            }
+        };
+    }
+}
+
+//
+
+iguana::huffman::encoder::~encoder() noexcept {}
+
+void iguana::huffman::encoder::encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len) {
+    statistics::encoding_table tab;
+    stats.build_encoding_table(tab);
+    context ctx { .dst = dst, .tab = tab, .src = src, .src_len = src_len };
+    g_Compress(ctx);
+
+    if (ctx.ec != error_code::ok) {
+        exception::from_error(ctx.ec);
+    }
+    dst.reserve_more(statistics::dense_table_max_length);
+    stats.serialize(dst);
+}
+
+void iguana::huffman::encoder::compress_portable(context& ctx) {
+    const auto& tab = ctx.tab;
+    const std::size_t run = (ctx.src_len + streams - 1) / streams;
+
+    // A symbol takes max_code_length bits at most, and the writer stores whole words
+    const auto max_stream_size = (run * statistics::max_code_length + 7) / 8 + sizeof(std::uint64_t);
+    if (max_stream_size > std::numeric_limits<std::uint32_t>::max()) {
+        ctx.ec = error_code::wrong_source_size;
+        return;
+    }
+
+    const auto origin = ctx.dst.size();
+    ctx.dst.resize(origin + huffman_header_size + streams * max_stream_size);
+    auto* const header = ctx.dst.data() + origin;
+    auto* out = header + huffman_header_size;
+
+    const auto put = [&](huffman_bit_writer& w, std::uint8_t v) {
+        w.put(tab.codes[v], tab.lengths[v]);
+    };
+
+    for(std::size_t j = 0; j != streams; ++j) {
+        const auto* p = ctx.src + std::min(ctx.src_len, j * run);
+        const auto* const end = ctx.src + std::min(ctx.src_len, (j + 1) * run);
+        huffman_bit_writer w{ .out = out };
+
+        for(; std::size_t(end - p) >= huffman_codes_per_read; p += huffman_codes_per_read) {
+            for(std::size_t i = 0; i != huffman_codes_per_read; ++i) {
+                put(w, p[i]);
+            }
+            w.flush();
+        }
+        for(; p != end; ++p) {
+            put(w, *p);
+        }
+        w.flush();
+
+        // The next stream overwrites the bytes past the last one
+        auto* const stream_end = w.out + ((w.n_bits + 7) >> 3);
+        if (j != streams - 1) {
+            utils::write_little_endian<std::uint32_t>(header + j * sizeof(std::uint32_t), std::uint32_t(stream_end - out));
+        }
+        out = stream_end;
+    }
+
+    ctx.dst.resize(std::size_t(out - ctx.dst.data()));
+    ctx.ec = error_code::ok;
+}
+
+void iguana::huffman::encoder::at_process_start() {
+    g_Compress.select();
+}
+
+void iguana::huffman::encoder::at_process_end() {}
+
+//
+
+iguana::huffman::decoder::~decoder() noexcept {}
+
+void iguana::huffman::decoder::decode(output_stream& dst, std::size_t result_size, input_stream& src, const statistics::decoding_table& tab) {
+    dst.reserve_more(result_size);
+    context ctx{ .dst = dst, .result_size = result_size, .src = src, .tab = tab };
+    g_Decompress(ctx);
+
+    if (ctx.ec != error_code::ok) {
+        exception::from_error(ctx.ec);
+    }
+}
+
+void iguana::huffman::decoder::decompress_portable(context& ctx) {
+    const std::size_t src_len = ctx.src.size();
+    if (src_len < huffman_header_size) {
+        ctx.ec = error_code::corrupted_bitstream;
+        return;
+    }
+
+    // The streams, the last one taking what the others leave
+    std::size_t sizes[streams];
+    std::size_t total = huffman_header_size;
+    for(std::size_t j = 0; j != streams - 1; ++j) {
+        sizes[j] = utils::read_little_endian<std::uint32_t>(ctx.src.data() + j * sizeof(std::uint32_t));
+        total += sizes[j];
+    }
+    if (total > src_len) {
+        ctx.ec = error_code::corrupted_bitstream;
+        return;
+    }
+    sizes[streams - 1] = src_len - total;
+
+    const auto origin = ctx.dst.size();
+    ctx.dst.resize(origin + ctx.result_size);
+    auto* const dst = ctx.dst.data() + origin;
+
+    // The readers are kept apart rather than in an array, so that they stay in registers
+    const std::size_t run = (ctx.result_size + streams - 1) / streams;
+    const std::uint8_t* p = ctx.src.data() + huffman_header_size;
+    const auto reader = [&](std::size_t j) {
+        huffman_bit_reader r{ .p = p, .size = sizes[j], .pos = 0 };
+        r.out = dst + std::min(ctx.result_size, j * run);
+        r.out_end = dst + std::min(ctx.result_size, (j + 1) * run);
+        p += sizes[j];
+        return r;
+    };
+    auto r0 = reader(0);
+    auto r1 = reader(1);
+    auto r2 = reader(2);
+    auto r3 = reader(3);
+
+    const auto* const tab = ctx.tab.entries;
+    const std::uint64_t mask = (std::uint64_t(1) << ctx.tab.table_bits) - 1;
+    const auto get = [&](huffman_bit_reader& r, std::uint64_t& v) {
+        const auto e = tab[v & mask];
+        v >>= (e >> 8);
+        r.pos += (e >> 8);
+        return std::uint8_t(e);
+    };
+
+    // The streams are decoded side by side for as long as the last, shortest one lasts and every read stays
+    // within the source. A stream may read into the following one, it is checked at the end.
+    const std::uint8_t* const src_end = ctx.src.data() + src_len;
+    for(std::size_t rounds = std::size_t(r3.out_end - r3.out) / huffman_codes_per_read; rounds != 0; --rounds) {
+        if (!r0.readable(src_end) || !r1.readable(src_end) || !r2.readable(src_end) || !r3.readable(src_end)) {
+            break;
+        }
+
+        auto v0 = r0.peek();
+        auto v1 = r1.peek();
+        auto v2 = r2.peek();
+        auto v3 = r3.peek();
+        for(std::size_t i = 0; i != huffman_codes_per_read; ++i) {
+            r0.out[i] = get(r0, v0);
+            r1.out[i] = get(r1, v1);
+            r2.out[i] = get(r2, v2);
+            r3.out[i] = get(r3, v3);
+        }
+        r0.out += huffman_codes_per_read;
+        r1.out += huffman_codes_per_read;
+        r2.out += huffman_codes_per_read;
+        r3.out += huffman_codes_per_read;
+    }
+
+    // The rest of every stream
+    const auto finish = [&](huffman_bit_reader& r) {
+        while(r.out != r.out_end) {
+            auto v = r.peek_tail();
+            const auto n = std::min<std::size_t>(r.out_end - r.out, huffman_codes_per_read);
+            for(std::size_t i = 0; i != n; ++i) {
+                r.out[i] = get(r, v);
+            }
+            r.out += n;
+        }
+        return r.at_end();
+    };
+    if (!finish(r0) || !finish(r1) || !finish(r2) || !finish(r3)) {
+        ctx.ec = error_code::corrupted_bitstream;
+        return;
+    }
+
+    ctx.ec = error_code::ok;
+}
+
+void iguana::huffman::decoder::at_process_start() {
+    g_Decompress.select();
+}
+
+void iguana::huffman::decoder::at_process_end() {}
@@ -0,0 +1,146 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include "common.h"
+#include "error.h"
+#include "ans_encoder.h"
+#include "ans_decoder.h"
+#include "cpu.h"
+#include "huffman_statistics.h"
+
+// The multi-stream Huffman format. The symbols are cut into 4 runs of the same length, the last one shorter, which
+// are coded into separate streams so that they can be decoded side by side. The codes are written from the lowest
+// bit of every byte up. The lengths of the first 3 streams come first, 4 bytes each, and the statistics follow the
+// last one.
+
+namespace iguana::huffman {
+    constexpr const std::size_t streams = 4;
+
+    //
+
+    class IGUANA_API encoder final : public ans::basic_encoder<encoder, statistics> {
+        using super = ans::basic_encoder<encoder, statistics>;
+        friend internal::initializer<encoder>;
+        struct context;
+
+    private:
+       using kernel_function = void (*)(context& ctx);
+
+       static const cpu::kernel_table<kernel_function> g_Kernels;
+       static cpu::kernel_dispatch<kernel_function> g_Compress;
+       static const internal::initializer<encoder> g_Initializer;
+
+    public:
+        encoder() noexcept = default;
+        ~encoder() noexcept;
+
+        encoder(const encoder&) = delete;
+        encoder& operator =(const encoder&) = delete;
+
+        encoder(encoder&& v) = default;
+        encoder& operator =(encoder&& v) = default;
+
+    public:
+        void encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len);
+        using super::encode;
+
+        // The kernel is shared by all the encoders, and must not be changed while any of them is running
+        static kernel get_kernel() noexcept {
+            return g_Compress.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_Compress.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_Compress.set(k);
+        }
+
+    private:
+        static void compress_portable(context& ctx);
+        static void at_process_start();
+        static void at_process_end();
+    };
+
+    //
+
+    struct encoder::context final {
+        output_stream&      dst;
+        const statistics::encoding_table& tab;
+        const std::uint8_t  *src;
+        std::size_t         src_len;
+        error_code          ec;
+    };
+
+    //
+
+    class IGUANA_API decoder final : public ans::basic_decoder<decoder, statistics> {
+        using super = ans::basic_decoder<decoder, statistics>;
+        friend internal::initializer<decoder>;
+        struct context;
+
+    private:
+        using kernel_function = void (*)(context& ctx);
+
+        static const cpu::kernel_table<kernel_function> g_Kernels;
+        static cpu::kernel_dispatch<kernel_function> g_Decompress;
+        static const internal::initializer<decoder> g_Initializer;
+
+    public:
+        decoder() {}
+        ~decoder() noexcept;
+
+        decoder(const decoder&) = delete;
+        decoder& operator =(const decoder&) = delete;
+
+        decoder(decoder&& v) = default;
+        decoder& operator =(decoder&& v) = default;
+
+    public:
+        void decode(output_stream& dst, std::size_t result_size, input_stream& src, const statistics::decoding_table& tab);
+        using super::decode;
+
+        // The kernel is shared by all the decoders, and must not be changed while any of them is running
+        static kernel get_kernel() noexcept {
+            return g_Decompress.get();
+        }
+
+        static bool has_kernel(kernel k) noexcept {
+            return g_Decompress.has(k);
+        }
+
+        // Throws std::invalid_argument if the kernel is not implemented or the processor cannot run it
+        static void set_kernel(kernel k) {
+            g_Decompress.set(k);
+        }
+
+    private:
+        static void decompress_portable(context& ctx);
+        static void at_process_start();
+        static void at_process_end();
+    };
+
+    //
+
+    struct decoder::context final {
+        output_stream&                      dst;
+        std::size_t                         result_size;
+        input_stream&                       src;
+        const statistics::decoding_table&   tab;
+        error_code                          ec;
+    };
+}
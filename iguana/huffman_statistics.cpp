@@ -0,0 +1,219 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include "huffman_statistics.h"
+#include "ans_histogram.h"
+#include "error.h"
+
+namespace iguana::huffman {
+    namespace {
+        inline std::uint32_t huffman_reverse_bits(std::uint32_t code, std::uint32_t length) noexcept {
+            std::uint32_t v = 0;
+            for(std::uint32_t i = 0; i != length; ++i) {
+                v = (v << 1) | (code & 1);
+                code >>= 1;
+            }
+            return v;
+        }
+    }
+}
+
+void iguana::huffman::statistics::compute(const std::uint8_t *p, std::size_t n) noexcept {
+    memory::zero(m_table);
+
+    // No data is coded as a single symbol
+    if (n == 0) {
+        m_table[0] = 1;
+        return;
+    }
+
+    ans::histogram::byte_counts counts;
+    ans::histogram::count_bytes(counts, p, n);
+
+    // The occurring symbols, the rarest first
+    std::uint32_t symbols[256];
+    std::size_t k = 0;
+    for(std::uint32_t s = 0; s != 256; ++s) {
+        if (counts[s] != 0) {
+            symbols[k++] = s;
+        }
+    }
+    std::stable_sort(symbols, symbols + k, [&](std::uint32_t a, std::uint32_t b) {
+        return counts[a] < counts[b];
+    });
+
+    if (k == 1) {
+        m_table[symbols[0]] = 1;
+        return;
+    }
+
+    // The leaves come sorted, so the tree is built with two queues: the leaves, and the inner nodes in the order
+    // they are made, whose weights do not decrease either
+    std::uint64_t weights[2 * 256];
+    std::uint32_t parents[2 * 256];
+    for(std::size_t i = 0; i != k; ++i) {
+        weights[i] = counts[symbols[i]];
+    }
+
+    std::size_t leaf = 0;
+    std::size_t inner = k;
+    const auto lightest = [&](std::size_t end) {
+        return ((leaf != k) && ((inner == end) || (weights[leaf] <= weights[inner]))) ? leaf++ : inner++;
+    };
+    for(std::size_t node = k; node != 2 * k - 1; ++node) {
+        const auto a = lightest(node);
+        const auto b = lightest(node);
+        weights[node] = weights[a] + weights[b];
+        parents[a] = parents[b] = std::uint32_t(node);
+    }
+
+    // The depths of the nodes, the root being the last one. The weights are not needed any more.
+    auto* const depths = weights;
+    depths[2 * k - 2] = 0;
+    std::uint32_t lengths[max_code_length + 1] = {};
+    for(std::size_t node = 2 * k - 2; node-- != 0;) {
+        depths[node] = depths[parents[node]] + 1;
+        if (node < k) {
+            ++lengths[std::min<std::size_t>(depths[node], max_code_length)];
+        }
+    }
+
+    // The codes cut down to max_code_length overflow the code space. Every step moves a code to the longest length
+    // and splits the longest shorter one into two, which takes one code off the overflow.
+    std::uint32_t total = 0;
+    for(std::size_t l = 1; l <= max_code_length; ++l) {
+        total += lengths[l] << (max_code_length - l);
+    }
+    for(; total != (std::uint32_t(1) << max_code_length); --total) {
+        --lengths[max_code_length];
+        for(std::size_t l = max_code_length - 1; l != 0; --l) {
+            if (lengths[l] != 0) {
+                --lengths[l];
+                lengths[l + 1] += 2;
+                break;
+            }
+        }
+    }
+
+    // The rarest symbols get the longest codes
+    std::size_t i = 0;
+    for(std::size_t l = max_code_length; l != 0; --l) {
+        for(std::uint32_t j = 0; j != lengths[l]; ++j) {
+            m_table[symbols[i++]] = std::uint8_t(l + 1);
+        }
+    }
+}
+
+void iguana::huffman::statistics::assign_codes(std::uint16_t* codes) const noexcept {
+    // The codes of every length follow the ones of the shorter lengths, in the order of the symbols
+    std::uint32_t lengths[max_code_length + 1] = {};
+    for(const auto v : m_table) {
+        if (v > 1) {
+            ++lengths[v - 1];
+        }
+    }
+    std::uint32_t next_codes[max_code_length + 1] = {};
+    std::uint32_t code = 0;
+    for(std::size_t l = 1; l <= max_code_length; ++l) {
+        code = (code + lengths[l - 1]) << 1;
+        next_codes[l] = code;
+    }
+
+    for(std::size_t s = 0; s != 256; ++s) {
+        const std::uint32_t v = m_table[s];
+        codes[s] = (v > 1) ? std::uint16_t(huffman_reverse_bits(next_codes[v - 1]++, v - 1)) : 0;
+    }
+}
+
+void iguana::huffman::statistics::build_decoding_table(decoding_table& tab) const noexcept {
+    std::uint16_t codes[256];
+    assign_codes(codes);
+
+    std::uint32_t table_bits = 0;
+    for(const auto v : m_table) {
+        table_bits = (v > table_bits + 1) ? (v - 1) : table_bits;
+    }
+
+    // A code of l bits fills every entry whose lowest l bits it matches
+    tab.table_bits = table_bits;
+    const std::uint32_t size = std::uint32_t(1) << table_bits;
+    for(std::uint32_t s = 0; s != 256; ++s) {
+        if (m_table[s] == 0) {
+            continue;
+        }
+
+        const std::uint32_t length = m_table[s] - 1;
+        const auto entry = std::uint16_t(s | (length << 8));
+        for(std::uint32_t k = codes[s]; k < size; k += std::uint32_t(1) << length) {
+            tab.entries[k] = entry;
+        }
+    }
+}
+
+void iguana::huffman::statistics::build_encoding_table(encoding_table& tab) const noexcept {
+    assign_codes(tab.codes);
+    for(std::size_t s = 0; s != 256; ++s) {
+        tab.lengths[s] = (m_table[s] != 0) ? std::uint8_t(m_table[s] - 1) : 0;
+    }
+}
+
+void iguana::huffman::statistics::serialize(output_stream& s) const {
+    std::size_t last = 255;
+    while(m_table[last] == 0) {
+        --last;
+    }
+
+    // Two symbols per byte, the first one in the low nibble, then the last symbol
+    const std::size_t n = (last + 2) / 2;
+    s.reserve_more(n + 1);
+    for(std::size_t i = 0; i != n; ++i) {
+        s.append(std::uint8_t(m_table[2 * i] | (m_table[2 * i + 1] << 4)));
+    }
+    s.append(std::uint8_t(last));
+}
+
+void iguana::huffman::statistics::deserialize(input_stream& s) {
+    const auto src_len = s.size();
+    if (src_len == 0) {
+        throw wrong_source_size_exception();
+    }
+
+    const std::size_t n = (std::size_t(s[src_len - 1]) + 2) / 2;
+    if (src_len < n + 1) {
+        throw wrong_source_size_exception();
+    }
+
+    const std::uint8_t* const p = s.data() + src_len - 1 - n;
+    memory::zero(m_table);
+    for(std::size_t i = 0; i != n; ++i) {
+        m_table[2 * i] = p[i] & 0x0f;
+        m_table[2 * i + 1] = p[i] >> 4;
+    }
+    s.set_end(p);
+
+    // The codes must fill the code space exactly, or a single symbol must be coded with no bits
+    std::uint32_t total = 0;
+    for(const auto v : m_table) {
+        if (v > max_code_length + 1) {
+            throw corrupted_bitstream_exception("invalid Huffman code lengths");
+        }
+        if (v != 0) {
+            total += std::uint32_t(1) << (max_code_length + 1 - v);
+        }
+    }
+    if (total != (std::uint32_t(1) << max_code_length)) {
+        throw corrupted_bitstream_exception("invalid Huffman code lengths");
+    }
+}
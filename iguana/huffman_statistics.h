@@ -0,0 +1,103 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include <array>
+#include "common.h"
+#include "span.h"
+#include "memops.h"
+#include "input_stream.h"
+#include "output_stream.h"
+
+namespace iguana::huffman {
+
+    // The code lengths of a canonical Huffman code over the bytes, limited so that a single lookup into a table of
+    // 1 << max_code_length entries decodes any symbol. A single occurring symbol is coded with no bits at all.
+    class IGUANA_API statistics {
+    public:
+        constexpr inline static std::size_t max_code_length = 11;
+        constexpr inline static std::size_t max_table_size = std::size_t(1) << max_code_length;
+
+        // The code lengths of the symbols up to the last occurring one, one nibble each, and their count
+        constexpr inline static std::size_t dense_table_max_length = 128 + 1;
+
+    public:
+        // The lowest bits of the stream index the entry, which holds the symbol in its low byte and the length of
+        // its code in the high one. Only the first 1 << table_bits entries are used.
+        struct decoding_table final {
+            std::uint32_t   table_bits;
+            std::uint16_t   entries[max_table_size];
+
+            std::uint16_t operator [](std::size_t k) const noexcept {
+                return entries[k];
+            }
+        };
+
+        // The codes are bit-reversed, so that they can be written from the lowest bit up
+        struct encoding_table final {
+            std::uint16_t   codes[256];
+            std::uint8_t    lengths[256];
+        };
+
+    public:
+        // The code length of every symbol plus one, 0 for the symbols that do not occur
+        std::array<std::uint8_t, 256> m_table;
+
+    public:
+        statistics() noexcept {
+            memory::zero(m_table);
+        }
+
+        explicit statistics(const_byte_span s) noexcept
+          : statistics(s.data(), s.size()) {}
+
+        statistics(const std::uint8_t *p, std::size_t n) noexcept
+          : statistics() {
+            compute(p, n);
+        }
+
+        explicit statistics(input_stream& s) {
+            deserialize(s);
+        }
+
+        ~statistics() = default;
+        statistics(const statistics&) = default;
+        statistics& operator =(const statistics&) = default;
+        statistics(statistics&&) = default;
+        statistics& operator =(statistics&&) = default;
+
+    public:
+        std::uint32_t operator [](std::size_t k) const noexcept {
+            assert(k < m_table.size());
+            return m_table[k];
+        }
+
+    public:
+        void compute(const std::uint8_t *p, std::size_t n) noexcept;
+
+        void compute(const_byte_span s) noexcept {
+            return compute(s.data(), s.size());
+        }
+
+        void build_decoding_table(decoding_table& tab) const noexcept;
+        void build_encoding_table(encoding_table& tab) const noexcept;
+
+    public:
+        void serialize(output_stream& s) const;
+        void deserialize(input_stream& s);
+
+    private:
+        void assign_codes(std::uint16_t* codes) const noexcept;
+    };
+}
@@ -0,0 +1,149 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <cassert>
+#include "lz_binary_tree.h"
+
+//
+
+void iguana::lz::binary_tree::reset(const window& w, const parameters& params) {
+    const auto n = w.size();
+    m_window = w;
+    m_size = n;
+    m_next = 0;
+    m_params = params;
+
+    // The tree spans the offset window, but there is no point in making it larger than the input
+    std::size_t window_size = 1;
+    while((window_size < n) && (window_size <= max_long_offset)) {
+        window_size <<= 1;
+    }
+    m_window_mask = std::uint32_t(window_size - 1);
+
+    // The tables store (pos + 1), so that 0 denotes an empty slot
+    m_head.assign(std::size_t(1) << params.hash_bits, 0);
+    m_tree.resize(window_size * 2);
+
+    for(auto& e : m_cache) {
+        e.pos = std::size_t(-1);
+        e.matches.clear();
+    }
+}
+
+template <
+    typename T_CALLBACK
+> void iguana::lz::binary_tree::update(std::size_t pos, T_CALLBACK&& on_match) {
+    const auto limit = std::min<std::size_t>(m_params.nice_length, m_size - pos);
+    const auto window = std::min<std::size_t>(max_long_offset, m_window_mask);
+
+    // pos becomes the root of its tree; the old tree is split into the subtrees of the sequences
+    // smaller and larger than the one at pos while walking down from the old root.
+    auto& head = m_head[hash(pos)];
+    auto ref = head;
+    head = std::uint32_t(pos + 1);
+
+    auto* ptr_smaller = &m_tree[(pos & m_window_mask) * 2];
+    auto* ptr_larger = ptr_smaller + 1;
+    std::size_t len_smaller = 0;
+    std::size_t len_larger = 0;
+    std::uint32_t best = 0;
+
+    for(auto depth = m_params.search_depth; (ref != 0) && (depth != 0); --depth) {
+        const std::size_t cand = ref - 1;
+        const auto dist = pos - cand;
+
+        // The children are always older than their parent, so the rest of the tree is out of reach too
+        if (dist > window) {
+            break;
+        }
+
+        auto* const pair = &m_tree[(cand & m_window_mask) * 2];
+
+        // Both subtrees bound the common prefix length of everything below them
+        auto len = std::min(len_smaller, len_larger);
+        if (m_window[cand + len] == m_window[pos + len]) {
+            len += m_window.common_length(pos + len, cand + len, pos + limit);
+
+            const auto min_len = (dist > max_short_offset) ? min_long_match_length : min_match_length;
+            if ((len >= min_len) && (len > best)) {
+                // The tree only orders the sequences up to nice_length, but the match itself may go on
+                const auto full_len = (len == limit) ? len + m_window.common_length(pos + len, cand + len, m_size) : len;
+                best = std::uint32_t(full_len);
+                on_match(match{ .length = best, .offset = std::uint32_t(dist) });
+            }
+
+            if (len == limit) {
+                // The candidate is as good as pos for all future lookups, pos takes over its children
+                ptr_smaller[0] = pair[0];
+                ptr_larger[0] = pair[1];
+                return;
+            }
+        }
+
+        if (m_window[cand + len] < m_window[pos + len]) {
+            *ptr_smaller = ref;
+            ptr_smaller = pair + 1;
+            ref = *ptr_smaller;
+            len_smaller = len;
+        } else {
+            *ptr_larger = ref;
+            ptr_larger = pair;
+            ref = *ptr_larger;
+            len_larger = len;
+        }
+    }
+
+    *ptr_smaller = 0;
+    *ptr_larger = 0;
+}
+
+const std::vector<iguana::lz::match>& iguana::lz::binary_tree::lookup(std::size_t pos) {
+    auto& e = m_cache[pos % cache_size];
+    if (e.pos == pos) {
+        return e.matches;
+    }
+
+    e.pos = pos;
+    e.matches.clear();
+
+    if (pos < m_next) [[unlikely]] {
+        // The tree no longer describes the state at pos
+        assert(false);
+        return e.matches;
+    }
+
+    // Hashing requires 4 readable bytes
+    const auto limit = (m_size >= sizeof(std::uint32_t)) ? (m_size - sizeof(std::uint32_t) + 1) : 0;
+
+    for(const auto last = std::min(pos, limit); m_next < last; ++m_next) {
+        update(m_next, [](const match&) {});
+    }
+
+    if (pos < limit) {
+        update(pos, [&e](const match& m) { e.matches.push_back(m); });
+        m_next = pos + 1;
+    }
+    return e.matches;
+}
+
+iguana::lz::match iguana::lz::binary_tree::find(std::size_t pos) {
+    const auto& matches = lookup(pos);
+    return matches.empty() ? match{} : matches.back();
+}
+
+void iguana::lz::binary_tree::find_all(std::size_t pos, std::vector<match>& dst) {
+    const auto& matches = lookup(pos);
+    dst.assign(matches.cbegin(), matches.cend());
+}
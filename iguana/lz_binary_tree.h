@@ -0,0 +1,90 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include <vector>
+#include "common.h"
+#include "lz_common.h"
+
+namespace iguana::lz {
+
+    // binary_tree is a BT4-style match finder: a head table indexed by the hash of the next 4 bytes
+    // points at the most recent position with that hash, which is the root of a binary search tree
+    // of all the older positions with the same hash, ordered by the sequences starting there. Every
+    // lookup walks down a single path of the tree, so the cost per position stays bounded even on
+    // highly repetitive data where hash chains degenerate, and the whole 24-bit offset window can
+    // be searched.
+    //
+    // The tree is restructured on every lookup, so every position has to be visited exactly once.
+    // The positions skipped by the caller are inserted on the next lookup, and the results of the
+    // last few lookups are kept so that the lazy parser can look at a position again.
+    class binary_tree final {
+    public:
+        struct parameters final {
+            std::uint32_t hash_bits;        // log2 of the number of head table entries
+            std::uint32_t search_depth;     // the maximum number of tree nodes visited per position
+            std::uint32_t nice_length;      // matches at least that long are not extended any further
+        };
+
+    private:
+        constexpr inline static std::size_t cache_size = 4;
+
+        struct cache_entry final {
+            std::size_t         pos = std::size_t(-1);
+            std::vector<match>  matches;
+        };
+
+    private:
+        std::vector<std::uint32_t>  m_head;
+        std::vector<std::uint32_t>  m_tree;     // The (smaller, larger) child pair of every position in the window
+        window                      m_window;
+        std::size_t                 m_size = 0;
+        std::size_t                 m_next = 0; // The first position not inserted yet
+        std::uint32_t               m_window_mask = 0;
+        parameters                  m_params = {};
+        cache_entry                 m_cache[cache_size];
+
+    public:
+        binary_tree() noexcept = default;
+        ~binary_tree() noexcept = default;
+
+        binary_tree(const binary_tree&) = delete;
+        binary_tree& operator =(const binary_tree&) = delete;
+
+        binary_tree(binary_tree&&) = default;
+        binary_tree& operator =(binary_tree&&) = default;
+
+    public:
+        void reset(const window& w, const parameters& params);
+
+        // Finds the best match for the sequence starting at pos. Positions may be skipped,
+        // but only the most recent lookups can be repeated.
+        match find(std::size_t pos);
+
+        // Same as find, but reports every match longer than the ones found before it,
+        // so dst ends up sorted by increasing length.
+        void find_all(std::size_t pos, std::vector<match>& dst);
+
+    private:
+        const std::vector<match>& lookup(std::size_t pos);
+
+        template <
+            typename T_CALLBACK
+        > void update(std::size_t pos, T_CALLBACK&& on_match);
+
+        std::uint32_t hash(std::size_t pos) const noexcept {
+            return (m_window.read32(pos) * 2654435761u) >> (32 - m_params.hash_bits);
+        }
+    };
+}
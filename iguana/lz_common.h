@@ -0,0 +1,175 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include <cstring>
+#include <algorithm>
+#include "common.h"
+#include "span.h"
+#include "bitops.h"
+
+namespace iguana::lz {
+
+    // The limits of the iguana sequence format, see decoder::decompress_portable for the token layout.
+
+    constexpr inline static std::uint32_t min_match_length      = 4;        // The shortest match encodable with a 16-bit offset
+    constexpr inline static std::uint32_t min_long_match_length = 16;       // The shortest match encodable with a 24-bit offset
+    constexpr inline static std::uint32_t max_short_offset      = 0xffff;
+    constexpr inline static std::uint32_t max_long_offset       = 0xffffff;
+    constexpr inline static std::uint32_t max_var_uint          = ((255 * 254) + 253) * 254 + 253;
+
+    constexpr inline static std::uint32_t literal_len_bits      = 3;
+    constexpr inline static std::uint32_t mm_long_offsets       = 16;
+    constexpr inline static std::uint32_t max_short_lit_len     = 7;
+    constexpr inline static std::uint32_t max_short_match_len   = 15;
+    constexpr inline static std::uint32_t last_long_offset      = 31;
+    constexpr inline static std::uint8_t  last_offset_flag      = 0x80;
+
+    //
+
+    struct match final {
+        std::uint32_t length = 0;
+        std::uint32_t offset = 0;
+
+        bool empty() const noexcept {
+            return length == 0;
+        }
+    };
+
+    //
+
+    inline std::uint32_t read32(const std::uint8_t* p) noexcept {
+        std::uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline std::uint64_t read64(const std::uint8_t* p) noexcept {
+        std::uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    // Returns the length of the common prefix of the sequences starting at a and b, with b < a and the comparison limited to [a, end).
+    inline std::size_t common_length(const std::uint8_t* a, const std::uint8_t* b, const std::uint8_t* const end) noexcept {
+        const auto* const start = a;
+
+        while(a + sizeof(std::uint64_t) <= end) {
+            if (const auto x = read64(a) ^ read64(b); x != 0) {
+            #if IGUANA_PROCESSOR_LITTLE_ENDIAN
+                return std::size_t(a - start) + (bit::count_trailing_zeros(x) >> 3);
+            #else
+                return std::size_t(a - start) + (bit::count_leading_zeros(x) >> 3);
+            #endif
+            }
+            a += sizeof(std::uint64_t);
+            b += sizeof(std::uint64_t);
+        }
+
+        while((a != end) && (*a == *b)) {
+            ++a;
+            ++b;
+        }
+        return std::size_t(a - start);
+    }
+
+    //
+
+    // The bytes the matches may reference: a dictionary, followed by the data being parsed. Both stay where they
+    // are, the positions count from the start of the dictionary as they do for the decoder, whose output follows
+    // the dictionary.
+    class window final {
+        const std::uint8_t* m_dict = nullptr;
+        std::size_t         m_dict_size = 0;
+        const std::uint8_t* m_data = nullptr;
+        std::size_t         m_size = 0;
+
+    public:
+        window() noexcept = default;
+
+        window(const_byte_span dict, const_byte_span data) noexcept
+          : m_dict(dict.data())
+          , m_dict_size(dict.size())
+          , m_data(data.data())
+          , m_size(dict.size() + data.size()) {}
+
+    public:
+        // The dictionary size plus the data size
+        std::size_t size() const noexcept {
+            return m_size;
+        }
+
+        std::size_t dictionary_size() const noexcept {
+            return m_dict_size;
+        }
+
+        // Only the positions of the data are contiguous up to the end of the window
+        const std::uint8_t* data(std::size_t pos) const noexcept {
+            assert((pos >= m_dict_size) && (pos <= m_size));
+            return m_data + (pos - m_dict_size);
+        }
+
+        std::uint8_t operator [](std::size_t pos) const noexcept {
+            assert(pos < m_size);
+            return (pos < m_dict_size) ? m_dict[pos] : m_data[pos - m_dict_size];
+        }
+
+        std::uint32_t read32(std::size_t pos) const noexcept {
+            if (pos >= m_dict_size) [[likely]] {
+                return lz::read32(m_data + (pos - m_dict_size));
+            }
+            if (pos + sizeof(std::uint32_t) <= m_dict_size) {
+                return lz::read32(m_dict + pos);
+            }
+
+            // The 4 bytes straddle the end of the dictionary
+            std::uint8_t v[sizeof(std::uint32_t)];
+            for(std::size_t i = 0; i != sizeof(v); ++i) {
+                v[i] = (*this)[pos + i];
+            }
+            return lz::read32(v);
+        }
+
+        // Returns the length of the common prefix of the sequences starting at a and b, with b < a and the comparison
+        // limited to [a, end). A sequence in the dictionary goes on with the data.
+        std::size_t common_length(std::size_t a, std::size_t b, std::size_t end) const noexcept {
+            if (b >= m_dict_size) [[likely]] {
+                return lz::common_length(data(a), data(b), data(end));
+            }
+
+            std::size_t len = 0;
+            while(a < end) {
+                const auto n = std::min({ end - a, segment_end(a) - a, segment_end(b) - b });
+                const auto* const pa = segment(a);
+                const auto l = lz::common_length(pa, segment(b), pa + n);
+                len += l;
+                if (l != n) {
+                    break;
+                }
+                a += n;
+                b += n;
+            }
+            return len;
+        }
+
+    private:
+        std::size_t segment_end(std::size_t pos) const noexcept {
+            return (pos < m_dict_size) ? m_dict_size : m_size;
+        }
+
+        const std::uint8_t* segment(std::size_t pos) const noexcept {
+            return (pos < m_dict_size) ? (m_dict + pos) : (m_data + (pos - m_dict_size));
+        }
+    };
+}
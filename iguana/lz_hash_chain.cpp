@@ -0,0 +1,96 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include "lz_hash_chain.h"
+
+//
+
+void iguana::lz::hash_chain::reset(const window& w, const parameters& params) {
+    const auto n = w.size();
+    m_window = w;
+    m_size = n;
+    m_next = 0;
+    m_params = params;
+
+    // The chain is a ring buffer spanning the offset window, but there is no point in making it larger than the input
+    std::size_t chain_size = 1;
+    while((chain_size < n) && (chain_size <= max_long_offset)) {
+        chain_size <<= 1;
+    }
+    m_chain_mask = std::uint32_t(chain_size - 1);
+
+    // The tables store (pos + 1), so that 0 denotes an empty slot
+    m_head.assign(std::size_t(1) << params.hash_bits, 0);
+    m_chain.resize(chain_size);
+}
+
+void iguana::lz::hash_chain::insert_up_to(std::size_t pos) noexcept {
+    // Hashing requires 4 readable bytes
+    const auto limit = std::min(pos, (m_size >= sizeof(std::uint32_t)) ? (m_size - sizeof(std::uint32_t) + 1) : 0);
+
+    for(; m_next < limit; ++m_next) {
+        auto& head = m_head[hash(m_next)];
+        m_chain[m_next & m_chain_mask] = head;
+        head = std::uint32_t(m_next + 1);
+    }
+}
+
+template <
+    typename T_CALLBACK
+> iguana::lz::match iguana::lz::hash_chain::search(std::size_t pos, T_CALLBACK&& on_match) {
+    insert_up_to(pos);
+    match best;
+
+    if (pos + min_match_length > m_size) [[unlikely]] {
+        return best;
+    }
+
+    const auto window = std::min<std::size_t>(max_long_offset, m_chain_mask);
+    auto ref = m_head[hash(pos)];
+
+    for(auto depth = m_params.search_depth; (ref != 0) && (depth != 0); --depth) {
+        const std::size_t cand = ref - 1;
+        const auto dist = pos - cand;
+        if ((cand >= pos) || (dist > window)) {
+            break;
+        }
+
+        // Check the byte that would extend the current best match first, it is the most likely to differ
+        if ((m_window[cand + best.length] == m_window[pos + best.length]) && (m_window.read32(cand) == m_window.read32(pos))) {
+            const auto len = std::uint32_t(m_window.common_length(pos, cand, m_size));
+            const auto min_len = (dist > max_short_offset) ? min_long_match_length : min_match_length;
+            if ((len >= min_len) && (len > best.length)) {
+                best.length = len;
+                best.offset = std::uint32_t(dist);
+                on_match(best);
+                if ((len >= m_params.nice_length) || (pos + len == m_size)) {
+                    break;
+                }
+            }
+        }
+        ref = m_chain[cand & m_chain_mask];
+    }
+
+    return best;
+}
+
+iguana::lz::match iguana::lz::hash_chain::find(std::size_t pos) noexcept {
+    return search(pos, [](const match&) {});
+}
+
+void iguana::lz::hash_chain::find_all(std::size_t pos, std::vector<match>& dst) {
+    dst.clear();
+    search(pos, [&dst](const match& m) { dst.push_back(m); });
+}
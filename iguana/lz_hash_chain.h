@@ -0,0 +1,74 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include <vector>
+#include "common.h"
+#include "lz_common.h"
+
+namespace iguana::lz {
+
+    // hash_chain is a classic LZ77 match finder: a head table indexed by the hash of the next 4 bytes
+    // points at the most recent position with that hash, and every position links to its predecessor
+    // in a chain covering the whole 24-bit offset window.
+    class hash_chain final {
+    public:
+        struct parameters final {
+            std::uint32_t hash_bits;        // log2 of the number of head table entries
+            std::uint32_t search_depth;     // the maximum number of chain links followed per position
+            std::uint32_t nice_length;      // the search stops as soon as a match at least that long is found
+        };
+
+    private:
+        std::vector<std::uint32_t>  m_head;
+        std::vector<std::uint32_t>  m_chain;
+        window                      m_window;
+        std::size_t                 m_size = 0;
+        std::size_t                 m_next = 0;  // The first position not inserted yet
+        std::uint32_t               m_chain_mask = 0;
+        parameters                  m_params = {};
+
+    public:
+        hash_chain() noexcept = default;
+        ~hash_chain() noexcept = default;
+
+        hash_chain(const hash_chain&) = delete;
+        hash_chain& operator =(const hash_chain&) = delete;
+
+        hash_chain(hash_chain&&) = default;
+        hash_chain& operator =(hash_chain&&) = default;
+
+    public:
+        void reset(const window& w, const parameters& params);
+
+        // Finds the best match for the sequence starting at pos. All the positions preceding pos are
+        // inserted into the chains first, so the caller is free to skip over the matched bytes.
+        match find(std::size_t pos) noexcept;
+
+        // Same as find, but reports every match longer than the ones found before it,
+        // so dst ends up sorted by increasing length.
+        void find_all(std::size_t pos, std::vector<match>& dst);
+
+    private:
+        void insert_up_to(std::size_t pos) noexcept;
+
+        template <
+            typename T_CALLBACK
+        > match search(std::size_t pos, T_CALLBACK&& on_match);
+
+        std::uint32_t hash(std::size_t pos) const noexcept {
+            return (m_window.read32(pos) * 2654435761u) >> (32 - m_params.hash_bits);
+        }
+    };
+}
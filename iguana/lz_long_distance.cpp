@@ -0,0 +1,114 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include "lz_long_distance.h"
+
+//
+
+namespace iguana::lz {
+    namespace {
+        // A Rabin-Karp polynomial hash over the rolling window, modulo 2^64
+        constexpr const std::uint64_t roll_prime = 0x9e3779b185ebca87ull;
+
+        constexpr std::uint64_t roll_prime_power() noexcept {
+            std::uint64_t r = 1;
+            for(std::uint32_t i = 1; i < long_distance_matcher::window_length; ++i) {
+                r *= roll_prime;
+            }
+            return r;
+        }
+
+        constexpr const std::uint64_t roll_out_factor = roll_prime_power();
+
+        // Keeps runs of zero bytes from hashing to 0
+        inline std::uint64_t roll_char(std::uint8_t c) noexcept {
+            return std::uint64_t(c) + 1;
+        }
+
+        inline std::uint64_t roll_init(const window& w, std::size_t pos) noexcept {
+            std::uint64_t h = 0;
+            for(std::uint32_t i = 0; i != long_distance_matcher::window_length; ++i) {
+                h = (h * roll_prime) + roll_char(w[pos + i]);
+            }
+            return h;
+        }
+
+        inline std::uint64_t roll_update(std::uint64_t h, std::uint8_t out, std::uint8_t in) noexcept {
+            return ((h - (roll_char(out) * roll_out_factor)) * roll_prime) + roll_char(in);
+        }
+    }
+}
+
+//
+
+void iguana::lz::long_distance_matcher::find(std::vector<seed>& dst, const window& w, std::size_t begin) {
+    const auto n = w.size();
+    dst.clear();
+    if (n < begin + min_length) {
+        return;
+    }
+
+    m_table_bits = std::clamp(bit::length(n >> sample_bits), 10u, 24u);
+    m_table.assign(std::size_t(1) << m_table_bits, 0);
+
+    // The table stores (pos + 1), so that 0 denotes an empty slot. The positions are those of the window ends.
+    constexpr std::uint64_t sample_mask = (std::uint64_t(1) << sample_bits) - 1;
+    std::size_t anchor = begin;
+    std::size_t pos = window_length;
+    auto h = roll_init(w, 0);
+
+    for(;;) {
+        const auto slot_bits = 64 - m_table_bits;
+        if (((h >> (slot_bits - sample_bits)) & sample_mask) == 0) {
+            auto& slot = m_table[h >> slot_bits];
+            const std::size_t ref = slot;
+            slot = std::uint32_t(pos + 1);
+
+            if ((ref != 0) && (pos >= anchor + window_length) && (pos - (ref - 1) <= max_long_offset)) {
+                const auto dist = pos - (ref - 1);
+                const auto start = pos - window_length;
+                const auto cand = start - dist;
+
+                // Verify the hit and extend it in both directions
+                if (auto len = w.common_length(start, cand, n); len >= window_length) {
+                    std::size_t back = 0;
+                    while((start - back > anchor) && (cand - back > 0) && (w[start - back - 1] == w[cand - back - 1])) {
+                        ++back;
+                    }
+                    len += back;
+
+                    if (len >= min_length) {
+                        dst.push_back({ .pos = start - back, .m = { .length = std::uint32_t(std::min<std::size_t>(len, max_var_uint)), .offset = std::uint32_t(dist) } });
+                        anchor = dst.back().pos + dst.back().m.length;
+
+                        // Resume right after the repeat
+                        if (anchor + window_length > n) {
+                            break;
+                        }
+                        pos = anchor + window_length;
+                        h = roll_init(w, anchor);
+                        continue;
+                    }
+                }
+            }
+        }
+
+        if (pos == n) {
+            break;
+        }
+        h = roll_update(h, w[pos - window_length], w[pos]);
+        ++pos;
+    }
+}
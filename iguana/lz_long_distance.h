@@ -0,0 +1,58 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include <vector>
+#include "common.h"
+#include "lz_common.h"
+
+namespace iguana::lz {
+
+    // long_distance_matcher finds very long repeats anywhere in the 24-bit offset window, regardless of
+    // the search limits of the regular match finders. A rolling hash of the last window_length bytes is
+    // maintained over the whole input, and a content-defined subset of the positions (roughly one in
+    // 2^sample_bits) is recorded in a table, so that the same positions are picked in every copy of a
+    // repeated region. Every hit is verified and extended in both directions.
+    class long_distance_matcher final {
+    public:
+        // A repeat found at position pos
+        struct seed final {
+            std::size_t pos;
+            match       m;
+        };
+
+        constexpr inline static std::uint32_t window_length = 64;
+        constexpr inline static std::uint32_t sample_bits = 3;
+        constexpr inline static std::uint32_t min_length = 256;
+
+    private:
+        std::vector<std::uint32_t>  m_table;
+        std::uint32_t               m_table_bits = 0;
+
+    public:
+        long_distance_matcher() noexcept = default;
+        ~long_distance_matcher() noexcept = default;
+
+        long_distance_matcher(const long_distance_matcher&) = delete;
+        long_distance_matcher& operator =(const long_distance_matcher&) = delete;
+
+        long_distance_matcher(long_distance_matcher&&) = default;
+        long_distance_matcher& operator =(long_distance_matcher&&) = default;
+
+    public:
+        // Stores the non-overlapping repeats of at least min_length bytes found in [begin, w.size()) in dst, by increasing
+        // position. The content of [0, begin) is only referenced.
+        void find(std::vector<seed>& dst, const window& w, std::size_t begin);
+    };
+}
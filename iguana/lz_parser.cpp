@@ -0,0 +1,442 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "lz_parser.h"
+#include "ans_byte_statistics.h"
+
+//
+
+namespace iguana::lz {
+    namespace {
+        const parameters g_Levels[] = {
+            //   parsing             finder                      hash_bits  search_depth  nice_length  optimal_passes  long_distance
+            { strategy::greedy,    match_finder::hash_chain,   16,        4,            32,          0,              false },  // 1
+            { strategy::greedy,    match_finder::hash_chain,   17,        16,           128,         0,              false },  // 2
+            { strategy::lazy,      match_finder::hash_chain,   17,        16,           128,         0,              false },  // 3
+            { strategy::lazy,      match_finder::hash_chain,   18,        32,           128,         0,              false },  // 4
+            { strategy::lazy2,     match_finder::hash_chain,   18,        64,           256,         0,              true  },  // 5
+            { strategy::lazy2,     match_finder::hash_chain,   19,        128,          256,         0,              true  },  // 6
+            { strategy::optimal,   match_finder::hash_chain,   19,        64,           256,         1,              true  },  // 7
+            { strategy::optimal,   match_finder::binary_tree,  20,        48,           256,         2,              true  },  // 8
+            { strategy::optimal,   match_finder::binary_tree,  20,        128,          512,         2,              true  },  // 9
+        };
+
+        // The number of positions the optimal parser considers before committing to a path
+        constexpr const std::size_t optimal_window = 1 << 12;
+        constexpr const std::uint32_t infinite_price = std::numeric_limits<std::uint32_t>::max();
+
+        // Shortens a match so that it does not run past end, or drops it if it becomes too short
+        inline match clip(match m, std::size_t pos, std::size_t end) noexcept {
+            if (pos + m.length > end) {
+                m.length = std::uint32_t(end - pos);
+                if (m.length < ((m.offset > max_short_offset) ? min_long_match_length : min_match_length)) {
+                    return {};
+                }
+            }
+            return m;
+        }
+
+        // A rough estimate of the value of a match used by the lazy parser, in quarter bytes.
+        // Matches with the last offset need no offset bytes at all.
+        inline std::int64_t gain(const match& m, std::uint32_t last_offset) noexcept {
+            const auto cost = (m.offset == last_offset) ? 0 : std::int64_t(bit::length(m.offset));
+            return std::int64_t(m.length) * 4 - cost;
+        }
+
+        // Returns the match with the last offset at pos, if any
+        inline match repeat_match(const window& w, std::size_t pos, std::size_t end, std::uint32_t last_offset) noexcept {
+            if ((last_offset == 0) || (last_offset > pos)) {
+                return {};
+            }
+            const auto len = w.common_length(pos, pos - last_offset, end);
+            return { .length = std::uint32_t(len), .offset = last_offset };
+        }
+
+        // The shortest match with the last offset the greedy and lazy parsers take, as it ends the literal run
+        constexpr const std::uint32_t min_repeat_length = 3;
+
+        // Checks the last offset first, and only searches for other matches if it does not yield a nice one
+        template <
+            typename T_MATCHER
+        > match find_best(T_MATCHER& matcher, const window& w, std::size_t pos, std::size_t end, std::uint32_t last_offset, std::uint32_t nice_length) {
+            const auto rep = repeat_match(w, pos, end, last_offset);
+            if (rep.length >= nice_length) {
+                return rep;
+            }
+
+            const auto m = clip(matcher.find(pos), pos, end);
+            if ((rep.length >= min_repeat_length) && (m.empty() || (gain(rep, last_offset) >= gain(m, last_offset)))) {
+                return rep;
+            }
+            return m;
+        }
+    }
+}
+
+//
+
+const iguana::lz::parameters& iguana::lz::parameters_for_level(std::uint32_t level) {
+    constexpr std::uint32_t n_levels = sizeof(g_Levels) / sizeof(g_Levels[0]);
+    return g_Levels[std::clamp(level, std::uint32_t(1), n_levels) - 1];
+}
+
+//
+
+void iguana::lz::price_model::reset() noexcept {
+    for(auto* t : { &tokens, &offset16, &offset24, &var_lit_len, &var_match_len, &literals }) {
+        t->fill(8 * price_scale);
+    }
+}
+
+void iguana::lz::price_model::compute(table& t, const std::uint8_t* p, std::size_t n) noexcept {
+    t.fill(8 * price_scale);
+    if (n == 0) {
+        return;
+    }
+
+    table prices;
+    compute(prices, ans::byte_statistics(p, n));
+    double total = double(ans::byte_statistics::dense_table_max_length) * 8;
+
+    for(std::size_t i = 0; i != n; ++i) {
+        total += double(prices[p[i]]) / price_scale;
+    }
+
+    // Keep the flat prices if the entropy compression is unlikely to pay off
+    if (total < double(n) * 8) {
+        t = prices;
+    }
+}
+
+void iguana::lz::price_model::compute(table& t, const ans::byte_statistics& stats) noexcept {
+    using statistics = ans::byte_statistics;
+
+    const auto word_M = double(std::uint32_t(1) << stats.scale_bits());
+    for(std::size_t i = 0; i != 256; ++i) {
+        if (const auto freq = stats[i] & statistics::frequency_mask; freq != 0) {
+            const auto bits = std::log2(word_M / double(freq));
+            t[i] = std::uint32_t(bits * price_scale + 0.5);
+        } else {
+            // Unseen symbols may still show up after reparsing, make them expensive rather than impossible
+            t[i] = std::uint32_t(stats.scale_bits() + 1) * price_scale;
+        }
+    }
+}
+
+std::uint32_t iguana::lz::price_model::var_uint(const table& t, std::uint32_t v) noexcept {
+    // See encoder::append_var_uint
+    if (v < 0xfe) {
+        return t[v];
+    } else if (const auto x = v / 254; x <= 0xff) {
+        return t[0xfe] + t[v % 254] + t[x];
+    } else {
+        return t[0xff] + t[v % 254] + t[x % 254] + t[x / 254];
+    }
+}
+
+std::uint32_t iguana::lz::price_model::sequence(std::uint32_t lit_len, std::uint32_t match_len, std::uint32_t offset, std::uint32_t last_offset) const noexcept {
+    const auto ll = std::min(lit_len, max_short_lit_len);
+    std::uint32_t price = (ll == max_short_lit_len) ? var_uint(var_lit_len, lit_len - max_short_lit_len) : 0;
+
+    if ((offset != last_offset) && (offset > max_short_offset)) {
+        // Long offsets carry no literals, so they need a separate token
+        if (lit_len > 0) {
+            price += tokens[last_offset_flag | ll];
+        }
+
+        if (const auto len = match_len - mm_long_offsets; len < last_long_offset) {
+            price += tokens[len];
+        } else {
+            price += tokens[last_long_offset] + var_uint(var_match_len, len - last_long_offset);
+        }
+        return price + offset24[offset & 0xff] + offset24[(offset >> 8) & 0xff] + offset24[offset >> 16];
+    }
+
+    const auto mm = std::min(match_len, max_short_match_len);
+    auto token = (mm << literal_len_bits) | ll;
+
+    if (offset == last_offset) {
+        token |= last_offset_flag;
+    } else {
+        price += offset16[offset & 0xff] + offset16[offset >> 8];
+    }
+
+    if (mm == max_short_match_len) {
+        price += var_uint(var_match_len, match_len - max_short_match_len);
+    }
+    return price + tokens[token];
+}
+
+//
+
+iguana::lz::parser::parser() {}
+
+iguana::lz::parser::~parser() noexcept {}
+
+void iguana::lz::parser::parse(std::vector<sequence>& dst, const_byte_span dict, const_byte_span src, std::size_t begin, const parameters& params, const price_model& prices) {
+    dst.clear();
+    const window w(dict, src);
+    const auto n = w.size();
+
+    // There is no point in a head table much larger than the input
+    const auto hash_bits = std::clamp(bit::length(n), 10u, params.hash_bits);
+
+    switch(params.finder) {
+    case match_finder::hash_chain:
+        m_hash_chain.reset(w, { .hash_bits = hash_bits, .search_depth = params.search_depth, .nice_length = params.nice_length });
+        parse_seeded(dst, m_hash_chain, w, dict.size() + begin, params, prices);
+        break;
+
+    case match_finder::binary_tree:
+        m_binary_tree.reset(w, { .hash_bits = hash_bits, .search_depth = params.search_depth, .nice_length = params.nice_length });
+        parse_seeded(dst, m_binary_tree, w, dict.size() + begin, params, prices);
+        break;
+    }
+}
+
+template <
+    typename T_MATCHER
+> void iguana::lz::parser::parse_seeded(std::vector<sequence>& dst, T_MATCHER& matcher, const window& w, std::size_t begin, const parameters& params, const price_model& prices) {
+    const auto n = w.size();
+
+    // The long repeats beyond the reach of the head table are found up front and taken
+    // unconditionally; the regular parser only covers the gaps between them.
+    m_seeds.clear();
+    if (params.long_distance && (n > (std::size_t(1) << params.hash_bits))) {
+        m_long_distance.find(m_seeds, w, begin);
+    }
+
+    std::size_t anchor = begin;
+    for(const auto& s : m_seeds) {
+        anchor = parse_range(dst, matcher, w, anchor, s.pos, params, prices);
+        dst.push_back({ .lit_len = std::uint32_t(s.pos - anchor), .match_len = s.m.length, .offset = s.m.offset });
+        anchor = s.pos + s.m.length;
+    }
+    parse_range(dst, matcher, w, anchor, n, params, prices);
+}
+
+template <
+    typename T_MATCHER
+> std::size_t iguana::lz::parser::parse_range(std::vector<sequence>& dst, T_MATCHER& matcher, const window& w, std::size_t begin, std::size_t end, const parameters& params, const price_model& prices) {
+    switch(params.parsing) {
+    case strategy::greedy:
+        return parse_greedy(dst, matcher, w, begin, end, params);
+
+    case strategy::lazy:
+        return parse_lazy(dst, matcher, w, begin, end, params, 1);
+
+    case strategy::lazy2:
+        return parse_lazy(dst, matcher, w, begin, end, params, 2);
+
+    case strategy::optimal:
+        return parse_optimal(dst, matcher, w, begin, end, params, prices);
+
+    default:
+        return begin;
+    }
+}
+
+template <
+    typename T_MATCHER
+> std::size_t iguana::lz::parser::parse_greedy(std::vector<sequence>& dst, T_MATCHER& matcher, const window& w, std::size_t begin, std::size_t end, const parameters& params) {
+    std::size_t anchor = begin;
+    std::size_t misses = 0;
+    std::uint32_t last_offset = dst.empty() ? 0 : dst.back().offset;
+
+    for(std::size_t pos = begin; pos + min_match_length <= end;) {
+        if (const auto m = find_best(matcher, w, pos, end, last_offset, params.nice_length); !m.empty()) {
+            dst.push_back({ .lit_len = std::uint32_t(pos - anchor), .match_len = m.length, .offset = m.offset });
+            pos += m.length;
+            anchor = pos;
+            last_offset = m.offset;
+            misses = 0;
+        } else {
+            // Accelerate through incompressible regions
+            pos += 1 + (misses++ >> 6);
+        }
+    }
+    return anchor;
+}
+
+template <
+    typename T_MATCHER
+> std::size_t iguana::lz::parser::parse_lazy(std::vector<sequence>& dst, T_MATCHER& matcher, const window& w, std::size_t begin, std::size_t end, const parameters& params, std::uint32_t max_lazy) {
+    std::size_t anchor = begin;
+    std::size_t misses = 0;
+    std::uint32_t last_offset = dst.empty() ? 0 : dst.back().offset;
+
+    for(std::size_t pos = begin; pos + min_match_length <= end;) {
+        auto m = find_best(matcher, w, pos, end, last_offset, params.nice_length);
+        if (m.empty()) {
+            pos += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+
+        // Keep deferring the match for as long as one of the following positions yields a better one
+        while(m.length < params.nice_length) {
+            if (pos + 1 + min_match_length <= end) {
+                if (const auto m1 = find_best(matcher, w, pos + 1, end, last_offset, params.nice_length); !m1.empty() && (gain(m1, last_offset) > gain(m, last_offset) + 4)) {
+                    pos += 1;
+                    m = m1;
+                    continue;
+                }
+            }
+            if ((max_lazy >= 2) && (pos + 2 + min_match_length <= end)) {
+                if (const auto m2 = find_best(matcher, w, pos + 2, end, last_offset, params.nice_length); !m2.empty() && (gain(m2, last_offset) > gain(m, last_offset) + 8)) {
+                    pos += 2;
+                    m = m2;
+                    continue;
+                }
+            }
+            break;
+        }
+
+        dst.push_back({ .lit_len = std::uint32_t(pos - anchor), .match_len = m.length, .offset = m.offset });
+        pos += m.length;
+        anchor = pos;
+        last_offset = m.offset;
+    }
+    return anchor;
+}
+
+template <
+    typename T_MATCHER
+> std::size_t iguana::lz::parser::parse_optimal(std::vector<sequence>& dst, T_MATCHER& matcher, const window& w, std::size_t begin, std::size_t end, const parameters& params, const price_model& prices) {
+    // A forward dynamic programming pass: every node holds the cheapest known way of reaching its
+    // position. A segment ends at the first position no pending match extends past, as every path
+    // has to go through it, or when a match long enough to be taken unconditionally shows up.
+    m_nodes.resize(optimal_window + params.nice_length + 1);
+    std::size_t anchor = begin;
+    std::uint32_t last_offset = dst.empty() ? 0 : dst.back().offset;
+
+    for(std::size_t pos = begin; pos + min_match_length <= end;) {
+        auto* const nodes = m_nodes.data();
+        nodes[0] = { .price = 0, .lit_len = std::uint32_t(pos - anchor), .match_len = 0, .offset = 0, .last_offset = last_offset };
+        std::size_t last = 0;
+        std::size_t segment_end = 0;
+        match forced;
+
+        for(std::size_t cur = 0;; ++cur) {
+            if ((cur == last) && (cur != 0)) {
+                segment_end = cur;
+                break;
+            }
+
+            const auto& nd = nodes[cur];
+
+            if ((cur < optimal_window) && (pos + cur + min_match_length <= end)) {
+                // The last offset of the path reaching cur costs no offset bytes, so even short matches may pay off
+                if (const auto rep = repeat_match(w, pos + cur, end, nd.last_offset); !rep.empty()) {
+                    if (rep.length >= params.nice_length) {
+                        forced = rep;
+                        segment_end = cur;
+                        break;
+                    }
+
+                    for(std::uint32_t len = 1; len <= rep.length; ++len) {
+                        const auto price = nd.price + prices.sequence(nd.lit_len, len, rep.offset, nd.last_offset);
+                        const auto target = cur + len;
+
+                        for(; last < target; ) {
+                            nodes[++last].price = infinite_price;
+                        }
+
+                        if (auto& t = nodes[target]; price < t.price) {
+                            t = { .price = price, .lit_len = 0, .match_len = len, .offset = rep.offset, .last_offset = rep.offset };
+                        }
+                    }
+                }
+
+                matcher.find_all(pos + cur, m_candidates);
+
+                // Candidates may run past the end of the range; they stay sorted after clipping
+                std::erase_if(m_candidates, [&](match& c) {
+                    c = clip(c, pos + cur, end);
+                    return c.empty();
+                });
+
+                if (!m_candidates.empty() && (m_candidates.back().length >= params.nice_length)) {
+                    forced = m_candidates.back();
+                    segment_end = cur;
+                    break;
+                }
+
+                std::uint32_t len = 0;
+                for(const auto& c : m_candidates) {
+                    const auto min_len = (c.offset > max_short_offset) ? min_long_match_length : min_match_length;
+
+                    for(len = std::max(len + 1, min_len); len <= c.length; ++len) {
+                        const auto price = nd.price + prices.sequence(nd.lit_len, len, c.offset, nd.last_offset);
+                        const auto target = cur + len;
+
+                        for(; last < target; ) {
+                            nodes[++last].price = infinite_price;
+                        }
+
+                        if (auto& t = nodes[target]; price < t.price) {
+                            t = { .price = price, .lit_len = 0, .match_len = len, .offset = c.offset, .last_offset = c.offset };
+                        }
+                    }
+                    len = c.length;
+                }
+            }
+
+            if (last == 0) {
+                // No match at the segment start
+                break;
+            }
+
+            if (const auto price = nd.price + prices.literal(w[pos + cur]); price < nodes[cur + 1].price) {
+                nodes[cur + 1] = { .price = price, .lit_len = nd.lit_len + 1, .match_len = 0, .offset = 0, .last_offset = nd.last_offset };
+            }
+        }
+
+        if ((segment_end == 0) && forced.empty()) {
+            ++pos;
+            continue;
+        }
+
+        // Backtrack the cheapest path to the end of the segment
+        m_path.clear();
+        for(auto i = segment_end; i > 0;) {
+            if (const auto& nd = nodes[i]; nd.match_len != 0) {
+                i -= nd.match_len;
+                m_path.push_back({ i, { .length = nd.match_len, .offset = nd.offset } });
+            } else {
+                --i;
+            }
+        }
+
+        for(auto it = m_path.crbegin(); it != m_path.crend(); ++it) {
+            const auto start = pos + it->first;
+            dst.push_back({ .lit_len = std::uint32_t(start - anchor), .match_len = it->second.length, .offset = it->second.offset });
+            anchor = start + it->second.length;
+        }
+
+        last_offset = nodes[segment_end].last_offset;
+        pos += segment_end;
+
+        if (!forced.empty()) {
+            dst.push_back({ .lit_len = std::uint32_t(pos - anchor), .match_len = forced.length, .offset = forced.offset });
+            last_offset = forced.offset;
+            pos += forced.length;
+            anchor = pos;
+        }
+    }
+    return anchor;
+}
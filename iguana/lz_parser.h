@@ -0,0 +1,171 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+#include <array>
+#include <vector>
+#include <utility>
+#include "common.h"
+#include "lz_common.h"
+#include "lz_hash_chain.h"
+#include "lz_binary_tree.h"
+#include "lz_long_distance.h"
+#include "ans_byte_statistics.h"
+
+namespace iguana::lz {
+
+    // strategy specifies how the input is split into sequences.
+    enum class strategy : std::uint8_t {
+        greedy,     // Take the longest match at the current position
+        lazy,       // Defer the match by one byte if the next position yields a better one
+        lazy2,      // Defer the match by up to two bytes
+        optimal     // Minimize the estimated encoded size of the whole sequence list
+    };
+
+    // match_finder specifies how the candidate matches are looked up.
+    enum class match_finder : std::uint8_t {
+        hash_chain,     // Fast, but the search degrades on long runs of similar sequences
+        binary_tree     // Bounded search cost per position over the whole 24-bit offset window
+    };
+
+    //
+
+    struct sequence final {
+        std::uint32_t lit_len;
+        std::uint32_t match_len;
+        std::uint32_t offset;
+    };
+
+    //
+
+    struct parameters final {
+        strategy        parsing;
+        match_finder    finder;
+        std::uint32_t   hash_bits;
+        std::uint32_t   search_depth;
+        std::uint32_t   nice_length;
+        std::uint32_t   optimal_passes;     // The number of price model refinements for strategy::optimal
+        bool            long_distance;      // Seed the parse with the repeats found by long_distance_matcher
+    };
+
+    const parameters& parameters_for_level(std::uint32_t level);
+
+    //
+
+    // price_model estimates the encoded cost of the symbols of every iguana substream. The prices are
+    // expressed in 1/price_scale bit units and derived from the rANS statistics of a previous parse.
+    class price_model final {
+    public:
+        using table = std::array<std::uint32_t, 256>;
+
+        constexpr inline static std::uint32_t price_scale_bits = 8;
+        constexpr inline static std::uint32_t price_scale = std::uint32_t(1) << price_scale_bits;
+
+    public:
+        table tokens;
+        table offset16;
+        table offset24;
+        table var_lit_len;
+        table var_match_len;
+        table literals;
+
+    public:
+        price_model() noexcept {
+            reset();
+        }
+
+        ~price_model() noexcept = default;
+        price_model(const price_model&) = default;
+        price_model& operator =(const price_model&) = default;
+
+    public:
+        // Assumes no entropy compression: every byte costs 8 bits
+        void reset() noexcept;
+
+        // Derives the prices from the normalized frequencies rANS would assign to the given content
+        static void compute(table& t, const std::uint8_t* p, std::size_t n) noexcept;
+
+        // Derives the prices from previously gathered statistics
+        static void compute(table& t, const ans::byte_statistics& stats) noexcept;
+
+        std::uint32_t literal(std::uint8_t v) const noexcept {
+            return literals[v];
+        }
+
+        std::uint32_t sequence(std::uint32_t lit_len, std::uint32_t match_len, std::uint32_t offset, std::uint32_t last_offset) const noexcept;
+
+    private:
+        static std::uint32_t var_uint(const table& t, std::uint32_t v) noexcept;
+    };
+
+    //
+
+    class parser final {
+        // The state of the optimal parser at a given position
+        struct node final {
+            std::uint32_t price;
+            std::uint32_t lit_len;      // The number of literals since the last match
+            std::uint32_t match_len;    // The length of the match ending here, 0 if the position is reached with a literal
+            std::uint32_t offset;       // The offset of the match ending here
+            std::uint32_t last_offset;  // The offset a last offset token would refer to
+        };
+
+    private:
+        hash_chain                                  m_hash_chain;
+        binary_tree                                 m_binary_tree;
+        long_distance_matcher                       m_long_distance;
+        std::vector<long_distance_matcher::seed>    m_seeds;
+        std::vector<node>                           m_nodes;
+        std::vector<match>                          m_candidates;
+        std::vector<std::pair<std::size_t, match>>  m_path;
+
+    public:
+        parser();
+        ~parser() noexcept;
+
+        parser(const parser&) = delete;
+        parser& operator =(const parser&) = delete;
+
+        parser(parser&&) = default;
+        parser& operator =(parser&&) = default;
+
+    public:
+        // Splits src from begin on into sequences; the literals following the last sequence are not described.
+        // The matches may reference the bytes of src before begin, and the dictionary preceding them.
+        void parse(std::vector<sequence>& dst, const_byte_span dict, const_byte_span src, std::size_t begin, const parameters& params, const price_model& prices);
+
+    private:
+        template <
+            typename T_MATCHER
+        > void parse_seeded(std::vector<sequence>& dst, T_MATCHER& matcher, const window& w, std::size_t begin, const parameters& params, const price_model& prices);
+
+        // The parse_* functions cover [begin, end) and return the position following the last match.
+
+        template <
+            typename T_MATCHER
+        > std::size_t parse_range(std::vector<sequence>& dst, T_MATCHER& matcher, const window& w, std::size_t begin, std::size_t end, const parameters& params, const price_model& prices);
+
+        template <
+            typename T_MATCHER
+        > std::size_t parse_greedy(std::vector<sequence>& dst, T_MATCHER& matcher, const window& w, std::size_t begin, std::size_t end, const parameters& params);
+
+        template <
+            typename T_MATCHER
+        > std::size_t parse_lazy(std::vector<sequence>& dst, T_MATCHER& matcher, const window& w, std::size_t begin, std::size_t end, const parameters& params, std::uint32_t max_lazy);
+
+        template <
+            typename T_MATCHER
+        > std::size_t parse_optimal(std::vector<sequence>& dst, T_MATCHER& matcher, const window& w, std::size_t begin, std::size_t end, const parameters& params, const price_model& prices);
+    };
+}
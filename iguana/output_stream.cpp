@@ -12,28 +12,23 @@
 //  See the License for the specific language governing permissions and
 //  limitations under the License.
 
+#include <algorithm>
 #include "output_stream.h"
 
 void iguana::output_stream::append(const value_type* p, size_type n) {
-    // TODO: optimize me
-    for(auto* const e = p + n; p != e; ++p) {
-        append(*p);
-    }
+    m_content.insert(m_content.end(), p, p + n);
 }
 
 void iguana::output_stream::append(const output_stream& s) {
-    // TODO: optimize me
     append(s.data(), s.size());
 }
 
 void iguana::output_stream::append_reverse(const value_type* p, size_type n) {
-    // TODO: optimize me
-    for(auto* e = p + n; e != p;) {
-        append(*--e);
-    }
+    const auto pos = size();
+    resize(pos + n);
+    std::reverse_copy(p, p + n, data() + pos);
 }
 
 void iguana::output_stream::append_reverse(const output_stream& s) {
-    // TODO: optimize me
     append_reverse(s.data(), s.size());
 }
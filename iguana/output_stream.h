@@ -13,18 +13,52 @@
 //  limitations under the License.
 
 #pragma once
+#include <memory>
+#include <utility>
 #include <vector>
 #include "common.h"
 #include "span.h"
 
 namespace iguana {
+    namespace internal {
+        // Default-initializes the elements instead of value-initializing them, so that growing
+        // a vector of bytes leaves the memory as it is rather than zeroing it
+        template <
+            typename T
+        > class default_init_allocator : public std::allocator<T> {
+            using super = std::allocator<T>;
+
+        public:
+            template <
+                typename U
+            > struct rebind final {
+                using other = default_init_allocator<U>;
+            };
+
+            using super::super;
+
+            template <
+                typename U
+            > void construct(U* p) noexcept(std::is_nothrow_default_constructible_v<U>) {
+                ::new(static_cast<void*>(p)) U;
+            }
+
+            template <
+                typename U,
+                typename... T_ARGS
+            > void construct(U* p, T_ARGS&&... args) {
+                ::new(static_cast<void*>(p)) U(std::forward<T_ARGS>(args)...);
+            }
+        };
+    }
+
     class IGUANA_API output_stream final {
     public:
         using value_type = std::uint8_t;
         using size_type  = std::size_t;
 
     private:
-        std::vector<value_type> m_content;
+        std::vector<value_type, internal::default_init_allocator<value_type>> m_content;
 
     public:
         output_stream() noexcept = default;
@@ -45,6 +79,14 @@ namespace iguana {
             return m_content.data();
         }
 
+        value_type* data() noexcept {
+            return m_content.data();
+        }
+
+        size_type capacity() const noexcept {
+            return m_content.capacity();
+        }
+
         void reserve(size_type n) {
             m_content.reserve(n);
         }
@@ -57,6 +99,11 @@ namespace iguana {
             m_content.clear();
         }
 
+        // The bytes added by growing the stream are left uninitialized, for the caller to write through data()
+        void resize(size_type n) {
+            m_content.resize(n);
+        }
+
         //
 
         void append(value_type v) {
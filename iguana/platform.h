@@ -46,3 +46,19 @@
 //
 
 #define IGUANA_PROCESSOR_LITTLE_ENDIAN true
+
+#if defined(__x86_64__) || defined(_M_X64)
+  #define IGUANA_PROCESSOR_X64 true
+#endif
+
+// Enables instruction set extensions for a single function, so that the SIMD kernels can be built
+// without raising the baseline of the whole library. MSVC accepts the intrinsics unconditionally.
+#if defined(IGUANA_COMPILER_MSVC)
+  #define IGUANA_TARGET(features)
+#else
+  #define IGUANA_TARGET(features) __attribute__((__target__(features)))
+#endif
+
+#define IGUANA_TARGET_AVX2          IGUANA_TARGET("avx2,bmi,bmi2,lzcnt,popcnt")
+#define IGUANA_TARGET_AVX512        IGUANA_TARGET("avx512f,avx512bw,avx512vl,avx512dq,bmi,bmi2,lzcnt,popcnt")
+#define IGUANA_TARGET_AVX512_VBMI2  IGUANA_TARGET("avx512f,avx512bw,avx512vl,avx512dq,avx512vbmi,avx512vbmi2,bmi,bmi2,lzcnt,popcnt")
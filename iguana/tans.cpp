@@ -0,0 +1,245 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "tans.h"
+#include "bitops.h"
+#include "utils.h"
+
+namespace iguana::tans {
+    const cpu::kernel_table<encoder::kernel_function> encoder::g_Kernels = { &encoder::compress_portable };
+    cpu::kernel_dispatch<encoder::kernel_function> encoder::g_Compress("tans encoder", g_Kernels);
+    const internal::initializer<encoder> encoder::g_Initializer;
+
+    const cpu::kernel_table<decoder::kernel_function> decoder::g_Kernels = { &decoder::decompress_portable };
+    cpu::kernel_dispatch<decoder::kernel_function> decoder::g_Decompress("tans decoder", g_Kernels);
+    const internal::initializer<decoder> decoder::g_Initializer;
+
+    namespace {
+        // Collects the bits in the order they are written, the first ones at the lowest positions, and stores
+        // them in 8-byte words. Up to 56 bits may be put between two flushes.
+        struct tans_bit_writer final {
+            std::uint8_t*   out;
+            std::uint64_t   bits = 0;
+            std::uint32_t   n_bits = 0;
+
+            void put(std::uint32_t v, std::uint32_t n) noexcept {
+                bits |= std::uint64_t(v) << n_bits;
+                n_bits += n;
+            }
+
+            void flush() noexcept {
+                utils::write_little_endian<std::uint64_t>(out, bits);
+                out += n_bits >> 3;
+                bits >>= n_bits & ~7u;
+                n_bits &= 7;
+            }
+        };
+
+        // Reads the bits back from the last one written. The 8 bytes at the cursor are held in the container, of
+        // which the top consumed bits have been read. Up to 56 bits may be read between two refills.
+        struct tans_bit_reader final {
+            const std::uint8_t* begin;
+            const std::uint8_t* cursor;
+            std::uint64_t       container;
+            std::uint32_t       consumed;
+
+            std::uint32_t get(std::uint32_t n) noexcept {
+                // Reading no bits shifts the container out entirely. A corrupted stream may read past the
+                // beginning, which yields garbage rather than undefined behavior.
+                const auto v = std::uint32_t(((container << (consumed & 63)) >> 1) >> (63 - n));
+                consumed += n;
+                return v;
+            }
+
+            void refill() noexcept {
+                const auto n = std::min<std::size_t>(consumed >> 3, std::size_t(cursor - begin));
+                cursor -= n;
+                consumed -= std::uint32_t(n * 8);
+                container = utils::read_little_endian<std::uint64_t>(cursor);
+            }
+        };
+    }
+}
+
+//
+
+iguana::tans::encoder::~encoder() noexcept {}
+
+void iguana::tans::encoder::encode(output_stream& dst, const statistics& stats, const std::uint8_t *src, std::size_t src_len) {
+    statistics::encoding_table tab;
+    stats.build_encoding_table(tab);
+    context ctx { .dst = dst, .tab = tab, .src = src, .src_len = src_len };
+    g_Compress(ctx);
+
+    if (ctx.ec != error_code::ok) {
+        exception::from_error(ctx.ec);
+    }
+    dst.reserve_more(statistics::dense_table_max_length);
+    stats.serialize(dst);
+}
+
+void iguana::tans::encoder::compress_portable(context& ctx) {
+    const auto& tab = ctx.tab;
+    const std::uint32_t table_bits = tab.word_M_bits;
+    const std::uint32_t size = std::uint32_t(1) << table_bits;
+
+    // A symbol emits table_bits at most; the final states and the end mark follow, and the writer stores whole words
+    const auto max_size = (ctx.src_len * table_bits + states * table_bits + 1 + 7) / 8 + sizeof(std::uint64_t);
+    const auto origin = ctx.dst.size();
+    ctx.dst.resize(origin + max_size);
+    tans_bit_writer w{ .out = ctx.dst.data() + origin };
+
+    // The i-th symbol goes to the state i % states
+    std::uint32_t x[states];
+    std::fill_n(x, states, size);
+
+    const auto put = [&](std::uint32_t& state, std::uint8_t v) {
+        const auto& t = tab.transforms[v];
+        const std::uint32_t n = (state + t.delta_bits) >> 16;
+        w.put(state & ((std::uint32_t(1) << n) - 1), n);
+        state = tab.states[std::int32_t(state >> n) + t.delta_state];
+    };
+
+    // The symbols are coded backwards, starting with the incomplete round at the end
+    const auto round_end = ctx.src_len - (ctx.src_len % states);
+    for(auto i = ctx.src_len; i != round_end;) {
+        --i;
+        put(x[i - round_end], ctx.src[i]);
+    }
+    w.flush();
+
+    for(auto i = round_end; i != 0;) {
+        i -= states;
+        for(auto j = states; j != 0;) {
+            --j;
+            put(x[j], ctx.src[i + j]);
+        }
+        w.flush();
+    }
+
+    // The state of the first symbol comes last, followed by the end mark
+    for(auto j = states; j != 0;) {
+        --j;
+        w.put(x[j] - size, table_bits);
+    }
+    w.put(1, 1);
+    w.flush();
+
+    ctx.dst.resize(std::size_t(w.out - ctx.dst.data()) + ((w.n_bits + 7) >> 3));
+    ctx.ec = error_code::ok;
+}
+
+void iguana::tans::encoder::at_process_start() {
+    g_Compress.select();
+}
+
+void iguana::tans::encoder::at_process_end() {}
+
+//
+
+iguana::tans::decoder::~decoder() noexcept {}
+
+void iguana::tans::decoder::decode(output_stream& dst, std::size_t result_size, input_stream& src, const statistics::decoding_table& tab) {
+    dst.reserve_more(result_size);
+    context ctx{ .dst = dst, .result_size = result_size, .src = src, .tab = tab };
+    g_Decompress(ctx);
+
+    if (ctx.ec != error_code::ok) {
+        exception::from_error(ctx.ec);
+    }
+}
+
+void iguana::tans::decoder::decompress_portable(context& ctx) {
+    const std::size_t src_len = ctx.src.size();
+    if ((src_len == 0) || (ctx.src[src_len - 1] == 0)) {
+        ctx.ec = error_code::corrupted_bitstream;
+        return;
+    }
+
+    // A stream shorter than the container is read from a copy, behind as many bytes of padding
+    std::uint8_t padded[sizeof(std::uint64_t)] = {};
+    const std::uint8_t* begin = ctx.src.data();
+    std::uint32_t padding_bits = 0;
+    if (src_len < sizeof(padded)) {
+        padding_bits = std::uint32_t(sizeof(padded) - src_len) * 8;
+        std::copy_n(begin, src_len, padded + sizeof(padded) - src_len);
+        begin = padded;
+    }
+
+    const std::uint8_t* const end = begin + std::max(src_len, sizeof(padded));
+    tans_bit_reader r{ .begin = begin, .cursor = end - sizeof(std::uint64_t) };
+    r.container = utils::read_little_endian<std::uint64_t>(r.cursor);
+    r.consumed = 8 - bit::find_last_set(unsigned(end[-1]));
+
+    const auto* const tab = ctx.tab.entries;
+    const std::uint32_t table_bits = ctx.tab.word_M_bits;
+    std::uint32_t x[states];
+    for(std::size_t j = 0; j != states; ++j) {
+        x[j] = r.get(table_bits);
+    }
+    r.refill();
+
+    const auto origin = ctx.dst.size();
+    ctx.dst.resize(origin + ctx.result_size);
+    auto* const dst = ctx.dst.data() + origin;
+
+    // s, x = D(x): the states are independent, only the bits are read in turns
+    const auto get = [&](std::uint32_t& state) {
+        const auto t = tab[state];
+        state = t.base + r.get(t.bits);
+        return t.symbol;
+    };
+
+    const auto round_end = ctx.result_size - (ctx.result_size % states);
+    for(std::size_t i = 0; i != round_end; i += states) {
+        for(std::size_t j = 0; j != states; ++j) {
+            dst[i + j] = get(x[j]);
+        }
+        r.refill();
+
+        // Past the beginning, the stream is corrupted
+        if (r.consumed > 64) [[unlikely]] {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+    }
+
+    for(std::size_t i = round_end; i != ctx.result_size; ++i) {
+        dst[i] = get(x[i - round_end]);
+    }
+    r.refill();
+
+    // The bits must run out with the symbols, the states being back where the encoder started
+    if ((r.cursor != begin) || (r.consumed + padding_bits != 64)) {
+        ctx.ec = error_code::corrupted_bitstream;
+        return;
+    }
+    for(std::size_t j = 0; j != states; ++j) {
+        if (x[j] != 0) {
+            ctx.ec = error_code::corrupted_bitstream;
+            return;
+        }
+    }
+
+    ctx.ec = error_code::ok;
+}
+
+void iguana::tans::decoder::at_process_start() {
+    g_Decompress.select();
+}
+
+void iguana::tans::decoder::at_process_end() {}
@@ -98,9 +98,9 @@ namespace iguana::utils {
         typename T
     > inline std::enable_if_t<std::is_integral_v<T>> write_little_endian(void* p, T v) noexcept {
     #if IGUANA_PROCESSOR_LITTLE_ENDIAN
-        *static_cast<const T*>(p) = v;
+        *static_cast<T*>(p) = v;
     #else
-        *static_cast<const T*>(p) = swap_bytes(v);
+        *static_cast<T*>(p) = swap_bytes(v);
     #endif
     }
 
@@ -108,9 +108,9 @@ namespace iguana::utils {
         typename T
     > inline std::enable_if_t<std::is_integral_v<T>> write_big_endian(void* p, T v) noexcept {
     #if IGUANA_PROCESSOR_LITTLE_ENDIAN
-        *static_cast<const T*>(p) = swap_bytes(v);
+        *static_cast<T*>(p) = swap_bytes(v);
     #else
-        *static_cast<const T*>(p) = v;
+        *static_cast<T*>(p) = v;
     #endif
     }
 }
@@ -22,20 +22,29 @@
 #include <variant>
 #include <map>
 #include <memory>
+#include <vector>
 #include "iguana/error.h"
 #include "iguana/file.h"
 #include "iguana/output_stream.h"
 #include "iguana/decoder.h"
 #include "iguana/encoder.h"
+#include "iguana/dictionary_trainer.h"
 
 #if !defined(IGUANA_COMPILER_MSVC)
     // TODO: use a proper makefile
     #include "iguana/common.cpp"
     #include "iguana/ans_byte_statistics.cpp"
     #include "iguana/ans_nibble_statistics.cpp"
+    #include "iguana/ans_histogram.cpp"
+    #include "iguana/ans_histogram_avx512.cpp"
+    #include "iguana/ans_normalize.cpp"
+    #include "iguana/ans_tabled_statistics.cpp"
     #include "iguana/ans1.cpp"
     #include "iguana/ans32.cpp"
     #include "iguana/ans_nibble.cpp"
+    #include "iguana/tans.cpp"
+    #include "iguana/huffman_statistics.cpp"
+    #include "iguana/huffman.cpp"
     #include "iguana/ans_bitstream.cpp"
     #include "iguana/error.cpp"
     #include "iguana/entropy.cpp"
@@ -44,6 +53,20 @@
     #include "iguana/encoder.cpp"
     #include "iguana/c_bindings.cpp"
     #include "iguana/file.cpp"
+    #include "iguana/ans_nibble64.cpp"
+    #include "iguana/ans_nibble64_avx2.cpp"
+    #include "iguana/ans_nibble64_avx512.cpp"
+    #include "iguana/ans32_avx2.cpp"
+    #include "iguana/ans32_avx512.cpp"
+    #include "iguana/cpu.cpp"
+    #include "iguana/decoder_avx2.cpp"
+    #include "iguana/decoder_avx512.cpp"
+    #include "iguana/dictionary_trainer.cpp"
+    #include "iguana/dictionary.cpp"
+    #include "iguana/lz_long_distance.cpp"
+    #include "iguana/lz_binary_tree.cpp"
+    #include "iguana/lz_hash_chain.cpp"
+    #include "iguana/lz_parser.cpp"
 #endif
 
 //
@@ -192,10 +215,51 @@ iguana::command_line::map_type iguana::command_line::parser::parse() {
             continue;
         }
 
+        if ((std::strcmp(opt, "-l") == 0) || (std::strcmp(opt, "--level") == 0)) {
+            const auto v = get_double_parameter_for(opt);
+            if ((v < iguana::encoder::min_level) || (v > iguana::encoder::max_level) || (v != static_cast<std::uint32_t>(v))) {
+                throw std::invalid_argument(std::string("the value for the option '") + opt + "' must be an integer in the range [" +
+                    std::to_string(iguana::encoder::min_level) + ", " + std::to_string(iguana::encoder::max_level) + "]");
+            }
+            add("l", "level", v);
+            continue;
+        }
+
+        if ((std::strcmp(opt, "-j") == 0) || (std::strcmp(opt, "--threads") == 0)) {
+            const auto v = get_double_parameter_for(opt);
+            if ((v < 0) || (v != static_cast<std::uint32_t>(v))) {
+                throw std::invalid_argument(std::string("the value for the option '") + opt + "' must be a non-negative integer");
+            }
+            add("j", "threads", v);
+            continue;
+        }
+
+        if ((std::strcmp(opt, "-b") == 0) || (std::strcmp(opt, "--block-size") == 0)) {
+            const auto v = get_double_parameter_for(opt);
+            if ((v < iguana::encoder::min_block_size) || (v > iguana::encoder::max_block_size) || (v != static_cast<std::size_t>(v))) {
+                throw std::invalid_argument(std::string("the value for the option '") + opt + "' must be an integer in the range [" +
+                    std::to_string(iguana::encoder::min_block_size) + ", " + std::to_string(iguana::encoder::max_block_size) + "]");
+            }
+            add("b", "block-size", v);
+            continue;
+        }
+
+        if ((std::strcmp(opt, "-p") == 0) || (std::strcmp(opt, "--block-prefix") == 0)) {
+            const auto v = get_double_parameter_for(opt);
+            if ((v < 0) || (v > iguana::encoder::max_block_prefix_size) || (v != static_cast<std::size_t>(v))) {
+                throw std::invalid_argument(std::string("the value for the option '") + opt + "' must be an integer in the range [0, " +
+                    std::to_string(iguana::encoder::max_block_prefix_size) + "]");
+            }
+            add("p", "block-prefix", v);
+            continue;
+        }
+
         if ((std::strcmp(opt, "-e") == 0) || (std::strcmp(opt, "--entropy") == 0)) {
             const auto v = get_string_parameter_for(opt);
-            if ((v != "none") && (v != "ans32") && (v != "ans") && (v != "ans_nibble")) {
-                throw std::invalid_argument(std::string("unrecognized entropy mode '") + v + "' supplied for the option '" + opt + "'");
+            try {
+                iguana::entropy_mode_from_string(v.c_str());
+            } catch(const std::invalid_argument& e) {
+                throw std::invalid_argument(std::string(e.what()) + " supplied for the option '" + opt + "'");
             }
             add("e", "entropy", v);  
             continue;
@@ -249,11 +313,75 @@ void iguana::command_line::parser::add(const char* short_name, const char* long_
 
 //
 
+namespace {
+    // train [-s size] [-l level] -o file sample...
+    int train_dictionary(int argc, const char* const* const argv) {
+        iguana::dictionary_trainer::parameters params;
+        std::string output;
+        std::vector<std::vector<std::uint8_t>> samples;
+
+        const auto get_parameter = [&](int& i) -> const char* {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument(std::string("no argument provided for '") + argv[i] + "'");
+            }
+            return argv[++i];
+        };
+
+        for(int i = 1; i < argc; ++i) {
+            const char* const opt = argv[i];
+
+            if ((std::strcmp(opt, "-s") == 0) || (std::strcmp(opt, "--size") == 0)) {
+                params.dictionary_size = std::stoul(get_parameter(i));
+            } else if ((std::strcmp(opt, "-l") == 0) || (std::strcmp(opt, "--level") == 0)) {
+                params.level = static_cast<std::uint32_t>(std::stoul(get_parameter(i)));
+            } else if ((std::strcmp(opt, "-o") == 0) || (std::strcmp(opt, "--output") == 0)) {
+                output = get_parameter(i);
+            } else if (opt[0] == '-') {
+                throw std::invalid_argument(std::string("unrecognized option '") + opt + "'");
+            } else {
+                iguana::file f_in(opt, "rb");
+                auto& sample = samples.emplace_back(f_in.size());
+                f_in.read(sample.data(), sample.size());
+            }
+        }
+
+        if (output.empty()) {
+            throw std::invalid_argument("the option '-o' has not been provided");
+        }
+
+        std::vector<iguana::const_byte_span> spans;
+        for(const auto& sample : samples) {
+            if (!sample.empty()) {
+                spans.emplace_back(sample.data(), sample.size());
+            }
+        }
+
+        iguana::dictionary_trainer trainer;
+        const auto dict = trainer.train(spans.data(), spans.size(), params);
+
+        iguana::output_stream dst;
+        dict.serialize(dst);
+
+        iguana::file f_out(output, "wb");
+        f_out.write(dst.data(), dst.size());
+
+        std::cout << "dictionary id = " << dict.id() << ", size = " << dict.size() << std::endl;
+        return EXIT_SUCCESS;
+    }
+}
+
+//
+
 int main(int argc, char *argv[]) try {
 
+    if ((argc > 1) && (std::strcmp(argv[1], "train") == 0)) {
+        return train_dictionary(argc - 1, argv + 1);
+    }
+
     iguana::command_line options(argc, argv);
     if (options.contains("help")) {
         std::cout << argv[0] << " [args] [-o file]" << std::endl;
+        std::cout << argv[0] << " train [-s size] [-l level] -o file sample..." << std::endl;
         std::cout << "  -h, --help" << std::endl;
         std::cout << "  -i, --input file" << std::endl;
         std::cout << "  -o, --output file" << std::endl;
@@ -261,6 +389,10 @@ int main(int argc, char *argv[]) try {
         std::cout << "  -t, --threshold" << std::endl;
         std::cout << "  -e, --entropy" << std::endl;
         std::cout << "  -x, --encoding" << std::endl;
+        std::cout << "  -l, --level" << std::endl;
+        std::cout << "  -j, --threads" << std::endl;
+        std::cout << "  -b, --block-size" << std::endl;
+        std::cout << "  -p, --block-prefix" << std::endl;
         return EXIT_SUCCESS;
     }
 
@@ -282,12 +414,18 @@ int main(int argc, char *argv[]) try {
             iguana::output_stream dst;
 
             {   const iguana::encoder::part ep = {
-                    .m_entropy_mode = iguana::entropy_mode_from_string(options.get<std::string>("entropy", "ans32").c_str()),
+                    .m_data = data_in.get(),
+                    .m_size = f_in_size,
+                    .m_entropy_mode = iguana::entropy_mode_from_string(options.get<std::string>("entropy", "auto").c_str()),
                     .m_encoding = iguana::encoding_from_string(options.get<std::string>("encoding", "iguana").c_str()),
-                    .m_rejection_threshold = options.get<double>("threshold", 1.0)
+                    .m_rejection_threshold = options.get<double>("threshold", 1.0),
+                    .m_level = static_cast<std::uint32_t>(options.get<double>("level", iguana::encoder::default_level))
                 };
 
                 iguana::encoder enc;
+                enc.set_threads(static_cast<std::uint32_t>(options.get<double>("threads", 1)));
+                enc.set_block_size(static_cast<std::size_t>(options.get<double>("block-size", double(iguana::encoder::default_block_size))));
+                enc.set_block_prefix_size(static_cast<std::size_t>(options.get<double>("block-prefix", double(iguana::encoder::default_block_prefix_size))));
                 enc.encode(dst, ep);
             }
 
@@ -0,0 +1,80 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <cstdio>
+#include <vector>
+#include "iguana/ans_encoding_symbol.h"
+#include "iguana/ans_byte_statistics.h"
+#include "iguana/ans_nibble_statistics.h"
+#include "test.h"
+
+// The rANS encoders multiply by the reciprocal of the frequency instead of dividing by it, and must produce
+// the same states as the division: C(s,x) = ((x / freq) << scale_bits) + (x % freq) + start
+
+namespace {
+    using statistics = iguana::ans::byte_statistics;
+
+    std::uint32_t encode_dividing(std::uint32_t x, std::uint32_t start, std::uint32_t freq, std::uint32_t scale_bits) {
+        return ((x / freq) << scale_bits) + (x % freq) + start;
+    }
+
+    // Compares the two at both sides of every quotient boundary of the states the encoders see, which are
+    // renormalized into [word_L, x_max)
+    bool check_symbol(std::uint32_t start, std::uint32_t freq, std::uint32_t scale_bits) {
+        iguana::ans::encoding_symbol sym;
+        sym.init(start, freq, scale_bits, statistics::word_L_bits, statistics::word_L);
+
+        const std::uint64_t x_max = (std::uint64_t(statistics::word_L >> scale_bits) << statistics::word_L_bits) * freq;
+        if (sym.x_max != x_max) {
+            return false;
+        }
+
+        for(std::uint64_t q = statistics::word_L / freq; q * freq < x_max; ++q) {
+            for(const auto x : { q * freq - 1, q * freq }) {
+                if ((x < statistics::word_L) || (x >= x_max)) {
+                    continue;
+                }
+                if (sym.encode(std::uint32_t(x)) != encode_dividing(std::uint32_t(x), start, freq, scale_bits)) {
+                    std::fprintf(stderr, "freq %u, start %u, scale bits %u: state %llu\n", freq, start, scale_bits, (unsigned long long)x);
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+int main() {
+    static_assert(statistics::min_word_M_bits == iguana::ans::nibble_statistics::min_word_M_bits);
+    static_assert(statistics::max_word_M_bits == iguana::ans::nibble_statistics::max_word_M_bits);
+
+    for(auto scale_bits = std::uint32_t(statistics::min_word_M_bits); scale_bits <= statistics::max_word_M_bits; ++scale_bits) {
+        const std::uint32_t word_M = std::uint32_t(1) << scale_bits;
+
+        // 1, the powers of two and the highest frequency, which is 4095 at 12 bits
+        std::vector<std::uint32_t> freqs;
+        for(std::uint32_t f = 1; f < word_M; f *= 2) {
+            freqs.push_back(f);
+        }
+        freqs.push_back(word_M - 1);
+
+        for(const auto freq : freqs) {
+            IGUANA_CHECK(check_symbol(0, freq, scale_bits));
+            IGUANA_CHECK(check_symbol(word_M - freq, freq, scale_bits));
+        }
+    }
+
+    return iguana::test::result();
+}
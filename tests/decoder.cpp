@@ -0,0 +1,146 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include "iguana/decoder.h"
+#include "iguana/error.h"
+#include "iguana/input_stream.h"
+#include "iguana/output_stream.h"
+#include "test.h"
+
+// Decodes streams built by hand in the layouts other encoders produce
+
+namespace {
+    // The control bytes are read from the end of the stream, so they are listed in the order they are read
+    // and appended in reverse
+    struct stream_builder final {
+        std::vector<std::uint8_t> data;
+        std::vector<std::uint8_t> control;
+
+        void append_data(const char* s) {
+            data.insert(data.end(), s, s + std::strlen(s));
+        }
+
+        void append_data(std::initializer_list<std::uint8_t> v) {
+            data.insert(data.end(), v);
+        }
+
+        // The 7-bit groups come most significant first, the last one is marked with the top bit
+        void append_var_uint(std::uint64_t v) {
+            int n = 1;
+            while((n < 10) && ((v >> (7 * n)) != 0)) {
+                ++n;
+            }
+            for(int i = n - 1; i >= 0; --i) {
+                control.push_back(std::uint8_t(((v >> (7 * i)) & 0x7f) | ((i == 0) ? 0x80 : 0)));
+            }
+        }
+
+        std::vector<std::uint8_t> build() const {
+            auto r = data;
+            r.insert(r.end(), control.rbegin(), control.rend());
+            return r;
+        }
+    };
+
+    std::string decode(const std::vector<std::uint8_t>& stream, std::uint32_t threads) {
+        iguana::decoder dec;
+        dec.set_threads(threads);
+        iguana::input_stream is{stream.data(), stream.size()};
+        iguana::output_stream os;
+        dec.decode(os, is);
+        return std::string(reinterpret_cast<const char*>(os.data()), os.size());
+    }
+
+    bool decode_throws(const std::vector<std::uint8_t>& stream, std::uint32_t threads) {
+        try {
+            decode(stream, threads);
+        } catch(const iguana::exception&) {
+            return true;
+        }
+        return false;
+    }
+
+    // A raw command, then a decode_iguana command in the layout of the original format: the header, the lengths
+    // of the 6 substreams, and no output size. Its second match reaches into the output of the raw command.
+    std::vector<std::uint8_t> legacy_stream(std::uint64_t output_size) {
+        stream_builder b;
+        b.append_data("wxyz");
+        b.append_data({ 0x4b, 0x20 });                  // tokens: 3 literals + match 9, then match 4
+        b.append_data({ 0x03, 0x00, 0x10, 0x00 });      // offset16: 3, 16
+        b.append_data("abcXY");                         // literals
+
+        b.append_var_uint(output_size);
+        b.control.push_back(std::uint8_t(iguana::command::copy_raw));
+        b.append_var_uint(4);
+        b.control.push_back(std::uint8_t(iguana::command::decode_iguana) | iguana::last_command_marker);
+        b.append_var_uint(0);                           // header: no entropy coding
+        for(const std::uint64_t n : { 2, 4, 0, 0, 0, 5 }) {
+            b.append_var_uint(n);
+        }
+        return b.build();
+    }
+
+    // A raw command, then a decode_iguana_block command, which references nothing preceding it
+    std::vector<std::uint8_t> block_stream(std::uint64_t flags, std::uint64_t block_size) {
+        stream_builder b;
+        b.append_data("wxyz");
+        b.append_data({ 0x4b });                        // tokens: 3 literals + match 9
+        b.append_data({ 0x03, 0x00 });                  // offset16: 3
+        b.append_data("abcXY");                         // literals
+
+        b.append_var_uint(4 + block_size);
+        b.control.push_back(std::uint8_t(iguana::command::copy_raw));
+        b.append_var_uint(4);
+        b.control.push_back(std::uint8_t(iguana::command::decode_iguana_block) | iguana::last_command_marker);
+        b.append_var_uint(flags);
+        b.append_var_uint(block_size);
+        b.append_var_uint(0);                           // header: no entropy coding
+        for(const std::uint64_t n : { 1, 2, 0, 0, 0, 5 }) {
+            b.append_var_uint(n);
+        }
+        return b.build();
+    }
+}
+
+int main() {
+    const std::string expected = "wxyzabcabcabcabcwxyzXY";
+
+    for(const auto k : iguana::test::supported_kernels<iguana::decoder>()) {
+        iguana::decoder::set_kernel(k);
+
+        for(const std::uint32_t threads : { 1, 4 }) {
+            IGUANA_CHECK(decode(legacy_stream(expected.size()), threads) == expected);
+
+            // The size of the stream must match the output of its commands
+            IGUANA_CHECK(decode_throws(legacy_stream(expected.size() - 1), threads));
+            IGUANA_CHECK(decode_throws(legacy_stream(expected.size() + 1), threads));
+
+            for(const auto flags : { std::uint64_t(0), iguana::iguana_block_independent }) {
+                IGUANA_CHECK(decode(block_stream(flags, 14), threads) == "wxyzabcabcabcabcXY");
+
+                // The block must decode to its recorded size
+                IGUANA_CHECK(decode_throws(block_stream(flags, 13), threads));
+                IGUANA_CHECK(decode_throws(block_stream(flags, 15), threads));
+            }
+            IGUANA_CHECK(decode_throws(block_stream(0x02, 14), threads));
+        }
+    }
+
+    return iguana::test::result();
+}
@@ -0,0 +1,119 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "iguana/ans_byte_statistics.h"
+#include "iguana/ans_nibble_statistics.h"
+#include "iguana/ans_tabled_statistics.h"
+#include "iguana/encoder.h"
+#include "iguana/decoder.h"
+#include "iguana/entropy.h"
+#include "iguana/error.h"
+#include "iguana/input_stream.h"
+#include "iguana/output_stream.h"
+#include "test.h"
+
+// Round-trips every entropy mode, on its own and applied to the iguana substreams
+
+namespace {
+    constexpr iguana::entropy_mode entropy_test_modes[] = {
+        iguana::entropy_mode::none,
+        iguana::entropy_mode::ans32,
+        iguana::entropy_mode::ans1,
+        iguana::entropy_mode::ans_nibble,
+        iguana::entropy_mode::ans4,
+        iguana::entropy_mode::ans8,
+        iguana::entropy_mode::ans_nibble2,
+        iguana::entropy_mode::ans_nibble64,
+        iguana::entropy_mode::tans,
+        iguana::entropy_mode::huffman,
+        iguana::entropy_mode::automatic
+    };
+
+    // The streams are kept whatever their size, so that every mode is applied
+    constexpr double entropy_test_rejection_threshold = 1000.0;
+
+    bool round_trip(const std::vector<std::uint8_t>& src, iguana::encoding enc, iguana::entropy_mode em) {
+        iguana::encoder e;
+        iguana::output_stream compressed;
+        const iguana::encoder::part p{
+            .m_data = src.data(),
+            .m_size = src.size(),
+            .m_entropy_mode = em,
+            .m_encoding = enc,
+            .m_rejection_threshold = entropy_test_rejection_threshold
+        };
+        e.encode(compressed, p);
+
+        iguana::decoder d;
+        iguana::input_stream is{compressed.data(), compressed.size()};
+        iguana::output_stream decompressed;
+        try {
+            d.decode(decompressed, is);
+        } catch(const iguana::exception& ex) {
+            std::fprintf(stderr, "%s, %s, %zu bytes: %s\n", iguana::to_string(enc), iguana::to_string(em), src.size(), ex.what());
+            return false;
+        }
+
+        return (decompressed.size() == src.size()) && std::equal(src.cbegin(), src.cend(), decompressed.data());
+    }
+
+    // The sparse data takes a precision above the compact one, within the bounds of every table
+    void check_wide_precisions(const std::vector<std::uint8_t>& src) {
+        const iguana::ans::byte_statistics bytes(src.data(), src.size());
+        IGUANA_CHECK(bytes.scale_bits() > iguana::ans::byte_statistics::compact_word_M_bits);
+
+        const iguana::ans::nibble_statistics nibbles(src.data(), src.size());
+        IGUANA_CHECK(nibbles.scale_bits() > iguana::ans::nibble_statistics::compact_word_M_bits);
+
+        const iguana::ans::tabled_statistics tabled(src.data(), src.size());
+        IGUANA_CHECK(tabled.scale_bits() <= iguana::ans::tabled_statistics::max_word_M_bits);
+
+        // The tabled ANS tables are too small for the byte statistics, which are refused
+        iguana::output_stream s;
+        bytes.serialize(s);
+        iguana::input_stream is{s.data(), s.size()};
+        bool refused = false;
+        try {
+            iguana::ans::tabled_statistics{is};
+        } catch(const iguana::exception&) {
+            refused = true;
+        }
+        IGUANA_CHECK(refused == (bytes.scale_bits() > iguana::ans::tabled_statistics::max_word_M_bits));
+    }
+}
+
+int main() {
+    std::vector<std::vector<std::uint8_t>> inputs;
+    for(const std::size_t n : { 1, 2, 100, 4095, 70000, 1 << 20 }) {
+        inputs.push_back(iguana::test::skewed_data(n, std::uint32_t(n)));
+    }
+    inputs.emplace_back(5000, std::uint8_t(0));         // A single symbol
+    for(const std::size_t n : { 70000, 1 << 20 }) {
+        inputs.push_back(iguana::test::sparse_data(n, std::uint32_t(n)));
+        check_wide_precisions(inputs.back());
+    }
+
+    for(const auto em : entropy_test_modes) {
+        for(const auto& src : inputs) {
+            IGUANA_CHECK(round_trip(src, iguana::encoding::raw, em));
+            IGUANA_CHECK(round_trip(src, iguana::encoding::iguana, em));
+        }
+    }
+
+    return iguana::test::result();
+}
@@ -0,0 +1,162 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "iguana/ans32.h"
+#include "iguana/ans_nibble64.h"
+#include "iguana/encoder.h"
+#include "iguana/decoder.h"
+#include "iguana/dictionary.h"
+#include "iguana/error.h"
+#include "iguana/input_stream.h"
+#include "iguana/output_stream.h"
+#include "test.h"
+
+// The SIMD kernels must decode the exact bitstream the portable kernels produce. Every stream is encoded with
+// the portable kernel and decoded with every kernel the processor supports.
+
+namespace {
+    bool same(const std::vector<std::uint8_t>& src, const iguana::output_stream& dst) {
+        return (dst.size() == src.size()) && std::equal(src.cbegin(), src.cend(), dst.data());
+    }
+
+    // Phrases drawn from a small vocabulary, which leave matches at every distance for the sequence decoders
+    std::vector<std::uint8_t> repetitive_data(std::size_t n, std::uint32_t seed) {
+        const auto noise = iguana::test::skewed_data(n, seed);
+        std::vector<std::uint8_t> r;
+        r.reserve(n);
+        for(std::size_t i = 0; r.size() < n; ++i) {
+            const auto v = noise[i % n];
+            if ((v & 0x0c) == 0) {
+                r.push_back(v);                                 // A literal
+            } else {
+                const auto len = std::min<std::size_t>(4 + (v & 0x0f) * 5, n - r.size());
+                const auto offs = std::min<std::size_t>(r.size(), 1 + std::size_t(v) * (i % 97));
+                for(std::size_t k = 0; k != len; ++k) {
+                    r.push_back((offs != 0) ? r[r.size() - offs] : std::uint8_t(k));
+                }
+            }
+        }
+        return r;
+    }
+
+    // Every kernel of the encoder produces the bytes of the portable one, which every kernel of the decoder decodes
+    template <
+        typename T_ENCODER,
+        typename T_DECODER
+    > void check_entropy_kernels(const std::vector<std::vector<std::uint8_t>>& inputs) {
+        const auto encoder_kernel = T_ENCODER::get_kernel();
+        const auto decoder_kernel = T_DECODER::get_kernel();
+
+        for(const auto& src : inputs) {
+            T_ENCODER::set_kernel(iguana::kernel::portable);
+            iguana::output_stream compressed;
+            T_ENCODER().encode(compressed, src.data(), src.size());
+
+            for(const auto k : iguana::test::supported_kernels<T_ENCODER>()) {
+                T_ENCODER::set_kernel(k);
+                iguana::output_stream s;
+                T_ENCODER().encode(s, src.data(), src.size());
+                IGUANA_CHECK((s.size() == compressed.size()) && std::equal(s.data(), s.data() + s.size(), compressed.data()));
+            }
+
+            for(const auto k : iguana::test::supported_kernels<T_DECODER>()) {
+                T_DECODER::set_kernel(k);
+                iguana::input_stream is{compressed.data(), compressed.size()};
+                iguana::output_stream decompressed;
+                T_DECODER().decode(decompressed, src.size(), is);
+                IGUANA_CHECK(same(src, decompressed));
+            }
+        }
+
+        T_ENCODER::set_kernel(encoder_kernel);
+        T_DECODER::set_kernel(decoder_kernel);
+    }
+
+    // The stream of the encoder decodes with every kernel of the sequence decoder, whether its blocks reference
+    // a dictionary, the preceding blocks or nothing
+    void check_sequence_kernels(const std::vector<std::vector<std::uint8_t>>& inputs) {
+        const auto decoder_kernel = iguana::decoder::get_kernel();
+
+        const auto dict_content = repetitive_data(50000, 1000);
+        const auto dict = std::make_shared<const iguana::dictionary>(dict_content.data(), dict_content.size());
+
+        for(const auto& src : inputs) {
+            for(const std::uint32_t level : { iguana::encoder::min_level, iguana::encoder::default_level, iguana::encoder::max_level }) {
+                for(const bool use_dictionary : { false, true }) {
+                    iguana::encoder e;
+                    e.set_block_size(1 << 16);
+                    e.set_block_prefix_size(use_dictionary ? 0 : (1 << 12));
+                    if (use_dictionary) {
+                        e.set_dictionary(dict);
+                    }
+
+                    iguana::output_stream compressed;
+                    const iguana::encoder::part p{
+                        .m_data = src.data(),
+                        .m_size = src.size(),
+                        .m_entropy_mode = iguana::entropy_mode::none,
+                        .m_encoding = iguana::encoding::iguana,
+                        .m_rejection_threshold = iguana::encoder::default_rejection_threshold,
+                        .m_level = level
+                    };
+                    e.encode(compressed, p);
+
+                    for(const auto k : iguana::test::supported_kernels<iguana::decoder>()) {
+                        iguana::decoder::set_kernel(k);
+                        iguana::decoder d;
+                        d.register_dictionary(dict);
+                        iguana::input_stream is{compressed.data(), compressed.size()};
+                        iguana::output_stream decompressed;
+                        d.decode(decompressed, is);
+                        IGUANA_CHECK(same(src, decompressed));
+                    }
+                }
+            }
+        }
+
+        iguana::decoder::set_kernel(decoder_kernel);
+    }
+}
+
+int main() {
+    // The sizes around the lane counts leave partial groups of every size
+    std::vector<std::vector<std::uint8_t>> inputs;
+    for(const std::size_t n : { 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 1000, 65537, 300000 }) {
+        inputs.push_back(iguana::test::skewed_data(n, std::uint32_t(n)));
+    }
+    for(const std::size_t n : { 65537, 1 << 20 }) {
+        inputs.push_back(iguana::test::sparse_data(n, std::uint32_t(n)));   // The wide precisions
+    }
+
+    try {
+        check_entropy_kernels<iguana::ans32::encoder, iguana::ans32::decoder>(inputs);
+        check_entropy_kernels<iguana::ans_nibble64::encoder, iguana::ans_nibble64::decoder>(inputs);
+
+        std::vector<std::vector<std::uint8_t>> sequences;
+        for(const std::size_t n : { 100, 5000, 300000 }) {
+            sequences.push_back(repetitive_data(n, std::uint32_t(n)));
+        }
+        check_sequence_kernels(sequences);
+    } catch(const iguana::exception& ex) {
+        std::fprintf(stderr, "%s\n", ex.what());
+        IGUANA_CHECK(false);
+    }
+
+    return iguana::test::result();
+}
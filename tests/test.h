@@ -0,0 +1,80 @@
+// Copyright 2023 Sneller, Inc.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include "iguana/cpu.h"
+
+// A minimal harness for the test applications: the checks report their failures and the test exits with
+// the number of the failed checks.
+
+namespace iguana::test {
+    inline int g_failures = 0;
+
+    inline void check(bool ok, const char* expr, const char* file, int line) {
+        if (!ok) {
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+            ++g_failures;
+        }
+    }
+
+    inline int result() {
+        if (g_failures != 0) {
+            std::fprintf(stderr, "%d check(s) failed\n", g_failures);
+        }
+        return (g_failures != 0) ? 1 : 0;
+    }
+
+    // The kernels supported by the codec and the processor, the codec being any class exposing has_kernel()
+    template <
+        typename T_CODEC
+    > std::vector<kernel> supported_kernels() {
+        std::vector<kernel> r;
+        for(std::size_t i = 0; i != kernel_count; ++i) {
+            if (T_CODEC::has_kernel(static_cast<kernel>(i))) {
+                r.push_back(static_cast<kernel>(i));
+            }
+        }
+        return r;
+    }
+
+    // Deterministic data, mostly low byte values with the occasional full-range one
+    inline std::vector<std::uint8_t> skewed_data(std::size_t n, std::uint32_t seed) {
+        std::vector<std::uint8_t> r(n);
+        std::uint64_t x = 0x9e3779b97f4a7c15ull * (std::uint64_t(seed) + 1);
+        for(auto& v : r) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            const auto k = std::uint32_t(x >> 32);
+            v = std::uint8_t(((k & 7) == 0) ? (k >> 8) : ((k >> 8) & 0x0f));
+        }
+        return r;
+    }
+
+    // Deterministic data, zeros with every other byte value showing up once in a while: too skewed for the
+    // compact precisions, which lose the share of a slot to every rare symbol
+    inline std::vector<std::uint8_t> sparse_data(std::size_t n, std::uint32_t seed) {
+        std::vector<std::uint8_t> r(n, 0);
+        for(std::size_t i = 0; i < n; i += 4001) {
+            r[i] = std::uint8_t(seed + i);
+        }
+        return r;
+    }
+}
+
+#define IGUANA_CHECK(expr) ::iguana::test::check(bool(expr), #expr, __FILE__, __LINE__)